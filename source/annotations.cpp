@@ -1,13 +1,16 @@
 #include "annotations.h"
 #include <map>
 #include <algorithm>
-#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <iterator>
 #include "utils.h"
-#include <fstream>
 #include "rom_accessor.h"
 
 namespace {
 
+using namespace snestistics;
+
 struct DataMMIO {
 	uint32_t address;
 	const char * const name;
@@ -211,181 +214,286 @@ static DataMMIO mmio_annotations[] = {
 	{ 0x00437A, "REG_NTLR7", "HDMA Line Counter Register 7" }
 };
 
-}
 
-namespace snestistics {
+/*
+	Annotation cache, finalized annotations and lookup tables. Everything is fixed size records followed by
+	one block with all strings so it can be used straight from the mapped file.
+*/
+static const uint64_t ANNOTATION_CACHE_MAGIC = 0x534e53414e4e4f54;
+static const uint32_t ANNOTATION_CACHE_VERSION = 1;
 
-void AnnotationResolver::add_mmio_annotations() {
-	uint32_t num_mmio_annotations = sizeof(mmio_annotations)/sizeof(DataMMIO);
-	uint32_t first = (uint32_t)_annotations.size();
-	_annotations.resize(first + num_mmio_annotations);
-	for (uint32_t i = 0, offset = first; i<num_mmio_annotations; ++i, ++offset) {
-		const DataMMIO &d = mmio_annotations[i];
-		Annotation a;
-		a.type = AnnotationType::ANNOTATION_DATA;
-		a.name = d.name;
-		a.comment_is_multiline = false;
-		a.startOfRange = a.endOfRange = d.address;
-		a.useComment = d.use_comment;
-		_annotations[offset] = a;
-	}
-}
+#pragma pack(push, 1)
+struct AnnotationCacheHeader {
+	uint64_t magic = ANNOTATION_CACHE_MAGIC;
+	uint32_t version = ANNOTATION_CACHE_VERSION;
+	uint64_t key = 0;
+	uint32_t num_annotations = 0;
+	uint32_t num_hints = 0;
+	uint32_t num_owned_ranges = 0;
+	uint32_t num_blocking_ranges = 0;
+	uint32_t num_pages = 0;
+	uint64_t string_bytes = 0;
+};
 
-void AnnotationResolver::add_vector_comment(const RomAccessor &rom, const char * const comment, const uint16_t target_at) {
-	uint16_t target = *(uint16_t*)rom.evalPtr(target_at);
-	Annotation a;
-	a.type = ANNOTATION_LINE;
-	a.startOfRange = a.endOfRange = target;
-	a.comment = comment;
-	a.comment_is_multiline = false;
-	_annotations.push_back(a);
-}
+struct CachedString {
+	uint32_t offset, length;
+};
 
-void AnnotationResolver::add_vector_annotations(const RomAccessor &rom) {
-	// "Programming the 65816", page 55
-	add_vector_comment(rom, "Vector: Native COP",       0xFFE4);
-	add_vector_comment(rom, "Vector: Native BRK",       0xFFE6);
-	add_vector_comment(rom, "Vector: Native ABORT",     0xFFE8);
-	add_vector_comment(rom, "Vector: Native NMI",       0xFFEA);
-	add_vector_comment(rom, "Vector: Native IRQ",       0xFFEE);
-	add_vector_comment(rom, "Vector: Emulation COP",    0xFFF4);
-	add_vector_comment(rom, "Vector: Emulation ABORT",  0xFFF8);
-	add_vector_comment(rom, "Vector: Emulation NMI",    0xFFFA);
-	add_vector_comment(rom, "Vector: Emulation RESET",  0xFFFC);
-	add_vector_comment(rom, "Vector: Emulation IRQBRK", 0xFFFE);
-}
+struct CachedAnnotation {
+	uint8_t type;
+	uint8_t comment_is_multiline;
+	Pointer start, end;
+	CachedString name, comment, use_comment;
+};
 
-void AnnotationResolver::load(std::istream &input, const std::string &error_file) {
-	std::string comment;
-	std::string useComment;
-	bool comment_is_multiline = false;
+struct CachedHint {
+	uint8_t hints;
+	Pointer location;
+};
+#pragma pack(pop)
+
+/*
+	Annotation file parser working directly on the mapped file. Each line is matched like sscanf would:
+	a space in a pattern matches any amount of whitespace and it is enough for the first number to match.
+*/
+struct LineScanner {
+	const char *p, *end;
 
-	char name[1024]="";
-	char mycomment[1024];
+	LineScanner(const char *begin, const char *end_) : p(begin), end(end_) {}
+
+	void skip_space() {
+		while (p != end && isspace((unsigned char)*p)) p++;
+	}
+	bool keyword(const char * const word) {
+		const size_t len = strlen(word);
+		if ((size_t)(end - p) < len || memcmp(p, word, len) != 0)
+			return false;
+		p += len;
+		return true;
+	}
+	bool literal(const char c) {
+		if (p == end || *p != c)
+			return false;
+		p++;
+		return true;
+	}
+	// Same as %06X
+	bool hex(Pointer &value) {
+		skip_space();
+		Pointer v = 0;
+		int n = 0;
+		for (; n < 6 && p != end && isxdigit((unsigned char)*p); ++n, ++p) {
+			const char c = *p;
+			v = (v << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		}
+		if (n == 0)
+			return false;
+		value = v;
+		return true;
+	}
+	// Same as %s
+	bool token(std::string &value) {
+		skip_space();
+		const char *start = p;
+		while (p != end && !isspace((unsigned char)*p)) p++;
+		if (p == start)
+			return false;
+		value.assign(start, p);
+		return true;
+	}
+	// Same as %[^"]
+	bool until_quote(std::string &value) {
+		const char *start = p;
+		while (p != end && *p != '"') p++;
+		if (p == start)
+			return false;
+		value.assign(start, p);
+		return true;
+	}
+};
 
-	Pointer start;
+struct ParsedAnnotations {
+	std::vector<Annotation> annotations;
+	std::vector<Hint> hints;
+	std::string error; // First line that could not be parsed
+};
 
-	int size;
+void parse_annotations(const char *data, const size_t size, const std::string &filename, ParsedAnnotations &result) {
+	std::string comment;
+	std::string useComment;
+	bool comment_is_multiline = false;
 
-	std::istream &f = input;
+	// Like before the name is kept until an annotation uses it
+	std::string name;
+	std::string mycomment;
 
 	int line_number = 0;
-	
-	while (!f.eof()) {
-		line_number++;
-		char buf[4096];
-		f.getline(buf, 4096);
 
-		size = 0;
+	const char * const file_end = data + size;
+	for (const char *line = data; line < file_end; ) {
+		line_number++;
+		const char *line_end = (const char*)memchr(line, '\n', file_end - line);
+		if (!line_end) line_end = file_end;
+		const char * const next_line = line_end + 1;
+		if (line_end != line && line_end[-1] == '\r')
+			line_end--;
+		const size_t length = line_end - line;
 
-		if (strlen(buf) == 0) {
+		if (length == 0) {
+			line = next_line;
 			continue;
 		}
-		if (buf[0] == '@') {
+
+		if (line[0] == '@') {
 			// meta-comment
-			continue;
-		} else if (buf[0] == ';') {
-			const char *stripped = &buf[2];
-			if (buf[1]=='\0') {
-				stripped = "";
-			} else if (buf[1] != ' ') {
-				stripped = &buf[1];
+		} else if (line[0] == ';') {
+			const char *stripped = line + 2;
+			if (length == 1) {
+				stripped = line_end;
+			} else if (line[1] != ' ') {
+				stripped = line + 1;
 			}
 			if (!comment.empty()) {
-				comment = comment + "\n" + stripped;
+				comment.append(1, '\n');
+				comment.append(stripped, line_end);
 				comment_is_multiline = true;
 			}
 			else {
-				comment = stripped;
-			}
-		}
-		else if (buf[0] == '#') {
-			useComment = &buf[2];
-		} else if (sscanf(buf, "hint %06X %s", &start, (char*)&name) > 0) {
-
-			Hint ta;
-			if (strcmp(name, "jump_is_jsr")==0) {
-				ta.hints = Hint::JUMP_IS_JSR;
-			} else if (strcmp(name, "jump_is_jsr_ish")==0) {
-				ta.hints = Hint::JUMP_IS_JSR_ISH;
-			} else if (strcmp(name, "jsr_is_jmp")==0) {
-				ta.hints = Hint::JSR_IS_JMP;
-			} else if (strcmp(name, "branch_always") == 0) {
-				ta.hints = Hint::BRANCH_ALWAYS;
-			} else if (strcmp(name, "branch_never") == 0) {
-				ta.hints = Hint::BRANCH_NEVER;
-			} else if (strcmp(name, "annotate_merge") == 0) {
-				ta.hints = Hint::ANNOTATE_MERGE;
-			} else {
-				printf("Unknown hint '%s'\n", name);
+				comment.assign(stripped, line_end);
 			}
-			ta.location = start;
-			_hints.push_back(ta);
-			continue;
+		} else if (line[0] == '#') {
+			useComment.assign(length < 2 ? line_end : line + 2, line_end);
 		} else {
+			LineScanner hint_scanner(line, line_end);
+			Pointer start;
+			if (hint_scanner.keyword("hint") && hint_scanner.hex(start)) {
+				hint_scanner.token(name);
+				Hint ta;
+				ta.hints = 0;
+				if (name == "jump_is_jsr") {
+					ta.hints = Hint::JUMP_IS_JSR;
+				} else if (name == "jump_is_jsr_ish") {
+					ta.hints = Hint::JUMP_IS_JSR_ISH;
+				} else if (name == "jsr_is_jmp") {
+					ta.hints = Hint::JSR_IS_JMP;
+				} else if (name == "branch_always") {
+					ta.hints = Hint::BRANCH_ALWAYS;
+				} else if (name == "branch_never") {
+					ta.hints = Hint::BRANCH_NEVER;
+				} else if (name == "annotate_merge") {
+					ta.hints = Hint::ANNOTATE_MERGE;
+				} else {
+					printf("Unknown hint '%s'\n", name.c_str());
+				}
+				ta.location = start;
+				result.hints.push_back(ta);
+				line = next_line;
+				continue;
+			}
 
 			Annotation a;
+			LineScanner s(line, line_end);
 
-			if (sscanf(buf, "function %06X %06X %s", &a.startOfRange, &a.endOfRange, name) > 0) {
+			if (s.keyword("function") && s.hex(a.startOfRange)) {
 				a.type = ANNOTATION_FUNCTION;
-				const bool convert_single_byte_functions_to_labels = false;
-				if (convert_single_byte_functions_to_labels && a.startOfRange == a.endOfRange) {
-					a.type = ANNOTATION_LINE;
-					printf("Function '%s' is only one byte long, treating as 'label' instead!\n", name);
-					a.endOfRange = a.startOfRange;
-				}
-			} else if (sscanf(buf, "line %06X", &a.startOfRange) > 0) { // TODO: Does this makes sense?
+				if (!s.hex(a.endOfRange)) a.endOfRange = a.startOfRange;
+				else s.token(name);
+			} else if ((s = LineScanner(line, line_end)).keyword("line") && s.hex(a.startOfRange)) { // TODO: Does this makes sense?
 				a.type = ANNOTATION_LINE;
 				a.endOfRange = a.startOfRange;
-			} else if (sscanf(buf, "comment %06X \"%[^\"]", &a.startOfRange, mycomment) > 0) {
+			} else if ((s = LineScanner(line, line_end)).keyword("comment") && s.hex(a.startOfRange)) {
+				s.skip_space();
+				if (s.literal('"'))
+					s.until_quote(mycomment);
 				a.type = ANNOTATION_LINE;
 				if (comment.empty()) {
 					comment = mycomment;
 				} else {
-					comment = comment + "\n" + mycomment;
+					comment.append(1, '\n');
+					comment.append(mycomment);
 					comment_is_multiline = true;
 				}
-				useComment = "";
+				useComment.clear();
 				a.endOfRange = a.startOfRange;
-			} else if (sscanf(buf, "label %06X %s", &a.startOfRange, name) > 0) {
+			} else if ((s = LineScanner(line, line_end)).keyword("label") && s.hex(a.startOfRange)) {
+				s.token(name);
 				a.type = ANNOTATION_LINE;
 				a.endOfRange = a.startOfRange;
-			} else if (sscanf(buf, "data %06X %06X %s", &a.startOfRange, &a.endOfRange, name) >0 ) {
+			} else if ((s = LineScanner(line, line_end)).keyword("data") && s.hex(a.startOfRange)) {
+				if (!s.hex(a.endOfRange)) a.endOfRange = a.startOfRange;
+				else s.token(name);
 				a.type = ANNOTATION_DATA;
 			} else {
-				printf("%s:%d: Not supported format!\n\t'%s'\n", error_file.c_str(), line_number, buf);
-				exit(99);
+				if (result.error.empty()) {
+					char location[32];
+					sprintf(location, ":%d: ", line_number);
+					result.error = filename + location + "Not supported format!\n\t'" + std::string(line, line_end) + "'";
+				}
+				return;
 			}
 
-
 			a.useComment = useComment;
 			a.comment = comment;
 			a.comment_is_multiline = comment_is_multiline;
 			a.name = name;
-			_annotations.push_back(a);
+			result.annotations.push_back(a);
 
 			// Reset state
 			comment.clear();
 			useComment.clear();
 			comment_is_multiline = false;
-			name[0]='\0';
+			name.clear();
 		}
+		line = next_line;
 	}
 }
 
-void AnnotationResolver::finalize() {
-	Profile profile("finalize annotations", true);
+}
 
-	Pointer largest_adress = 0;
-	for (auto a : _annotations) {
-		largest_adress = std::max(largest_adress, a.endOfRange);
-	}
-	for (auto a : _hints) {
-		largest_adress = std::max(largest_adress, a.location);
+namespace snestistics {
+
+void AnnotationResolver::add_mmio_annotations() {
+	uint32_t num_mmio_annotations = sizeof(mmio_annotations)/sizeof(DataMMIO);
+	uint32_t first = (uint32_t)_annotations.size();
+	_annotations.resize(first + num_mmio_annotations);
+	for (uint32_t i = 0, offset = first; i<num_mmio_annotations; ++i, ++offset) {
+		const DataMMIO &d = mmio_annotations[i];
+		Annotation a;
+		a.type = AnnotationType::ANNOTATION_DATA;
+		a.name = d.name;
+		a.comment_is_multiline = false;
+		a.startOfRange = a.endOfRange = d.address;
+		a.useComment = d.use_comment;
+		_annotations[offset] = a;
 	}
-	uint32_t k = largest_adress + 1;
-	_annotation_for_adress.init(k);
-	_annotation_for_adress.fill(-1);
+}
+
+void AnnotationResolver::add_vector_comment(const RomAccessor &rom, const char * const comment, const uint16_t target_at) {
+	uint16_t target = *(uint16_t*)rom.evalPtr(target_at);
+	Annotation a;
+	a.type = ANNOTATION_LINE;
+	a.startOfRange = a.endOfRange = target;
+	a.comment = comment;
+	a.comment_is_multiline = false;
+	_annotations.push_back(a);
+}
+
+void AnnotationResolver::add_vector_annotations(const RomAccessor &rom) {
+	// "Programming the 65816", page 55
+	add_vector_comment(rom, "Vector: Native COP",       0xFFE4);
+	add_vector_comment(rom, "Vector: Native BRK",       0xFFE6);
+	add_vector_comment(rom, "Vector: Native ABORT",     0xFFE8);
+	add_vector_comment(rom, "Vector: Native NMI",       0xFFEA);
+	add_vector_comment(rom, "Vector: Native IRQ",       0xFFEE);
+	add_vector_comment(rom, "Vector: Emulation COP",    0xFFF4);
+	add_vector_comment(rom, "Vector: Emulation ABORT",  0xFFF8);
+	add_vector_comment(rom, "Vector: Emulation NMI",    0xFFFA);
+	add_vector_comment(rom, "Vector: Emulation RESET",  0xFFFC);
+	add_vector_comment(rom, "Vector: Emulation IRQBRK", 0xFFFE);
+}
+
+void AnnotationResolver::finalize() {
+	Profile profile("finalize annotations", true);
 
 	const auto annotation_sort = [](const Annotation &a, const Annotation &c) {
 		if (a.startOfRange != c.startOfRange) return a.startOfRange < c.startOfRange;
@@ -397,7 +505,6 @@ void AnnotationResolver::finalize() {
 
 	// First pass. Merge line annotations, possibly into functions/labels. Remove stale annotations.
 	// After this pass startOfRange is unique
-	// TODO: We could do this during parsing IF we build _annotation_for_adress then. Need to make it suffiently big before knowing usage, that's all.
 	Pointer merge_pc = INVALID_POINTER;
 	int last_written = 0;
 	for (int i=0; i<(int)_annotations.size(); ++i) {
@@ -452,36 +559,106 @@ void AnnotationResolver::finalize() {
 	// Remove unused annotations at the end
 	_annotations.resize(last_written);
 
-	// TODO: This code was a bit lazy!
-	for (int pass = 0; pass < 3; pass++) {
-		AnnotationType pass_type = ANNOTATION_NONE;
-		if (pass == 2) pass_type = ANNOTATION_LINE;
-		if (pass == 1) pass_type = ANNOTATION_DATA;
-		if (pass == 0) pass_type = ANNOTATION_FUNCTION;
-
+	// Paint the annotations on the address space, each pass on top of the previous.
+	// A key is where a range with a new owner starts, -1 means no owner.
+	std::map<Pointer, int> painted;
+	const auto owner_at = [&painted](const Pointer p) -> int {
+		auto it = painted.upper_bound(p);
+		if (it == painted.begin())
+			return -1;
+		return (--it)->second;
+	};
+	const AnnotationType pass_types[3] = { ANNOTATION_FUNCTION, ANNOTATION_DATA, ANNOTATION_LINE };
+	for (const AnnotationType pass_type : pass_types) {
 		for (int i=0; i<(int)_annotations.size(); ++i) {
-			Annotation &a = _annotations[i];
-
-			if (a.type != pass_type)
+			const Annotation &a = _annotations[i];
+			if (a.type != pass_type || a.endOfRange < a.startOfRange)
 				continue;
-
-			Pointer start = a.startOfRange;
-			for (uint32_t k=a.startOfRange; k <= a.endOfRange; ++k) {
-				_annotation_for_adress[k] = i;
-			}
+			const Pointer after = a.endOfRange + 1;
+			const int owner_after = owner_at(after);
+			painted.erase(painted.lower_bound(a.startOfRange), painted.upper_bound(after));
+			painted[a.startOfRange] = i;
+			painted[after] = owner_after;
 		}
 	}
 
-	// TODO: Merge multiple hints for same address
-	
-	_hint_for_adress.init(k);
-	_hint_for_adress.fill(-1);
+	// The last key is always the end of a range, so every owned range has a next key
+	_owned_ranges.clear();
+	_blocking_ranges.clear();
+	for (auto it = painted.begin(); it != painted.end(); ++it) {
+		if (it->second == -1)
+			continue;
+		auto next = it;
+		++next;
+		OwnedRange r;
+		r.start = it->first;
+		r.end = next->first - 1;
+		r.annotation = it->second;
+		_owned_ranges.push_back(r);
+		const AnnotationType type = _annotations[r.annotation].type;
+		if (type == ANNOTATION_FUNCTION || type == ANNOTATION_DATA)
+			_blocking_ranges.push_back(r);
+	}
 
-	std::sort(_hints.begin(), _hints.end());
-	for (uint32_t i = 0; i < _hints.size(); ++i) {
-		const Hint &ta = _hints[i];
-		_hint_for_adress[ta.location] = i;
+	const uint32_t num_pages = 1 << 16;
+	_range_for_page.resize(num_pages + 1);
+	uint32_t r = 0;
+	for (uint32_t page = 0; page <= num_pages; ++page) {
+		while (r < _owned_ranges.size() && _owned_ranges[r].end < (page << 8))
+			r++;
+		_range_for_page[page] = r;
+	}
+
+	_function_for_annotation.resize(_annotations.size());
+	int last_function = -1;
+	for (int i=0; i<(int)_annotations.size(); ++i) {
+		if (_annotations[i].type == ANNOTATION_FUNCTION)
+			last_function = i;
+		_function_for_annotation[i] = last_function;
 	}
+
+	// TODO: Merge multiple hints for same address
+	std::sort(_hints.begin(), _hints.end());
+}
+
+int AnnotationResolver::owner(const Pointer p) const {
+	if (p > 0xFFFFFF)
+		return -1;
+	// Ranges ending in this page come before the first range of the next page
+	const uint32_t page = p >> 8;
+	const auto first = _owned_ranges.begin() + _range_for_page[page];
+	const auto last = _owned_ranges.begin() + std::min(_range_for_page[page + 1] + 1, (uint32_t)_owned_ranges.size());
+	const auto it = std::lower_bound(first, last, p, [](const OwnedRange &r, const Pointer p) { return r.end < p; });
+	if (it == last || it->start > p)
+		return -1;
+	return it->annotation;
+}
+
+Pointer AnnotationResolver::find_last_free_before_or_at(const Pointer p, const Pointer stop) const {
+	if (p < stop)
+		return stop;
+	// Last function or data starting at or before p
+	auto it = std::upper_bound(_blocking_ranges.begin(), _blocking_ranges.end(), p, [](const Pointer p, const OwnedRange &r) { return p < r.start; });
+	if (it == _blocking_ranges.begin())
+		return stop;
+	--it;
+	if (it->end >= p)
+		return INVALID_POINTER; // No valid
+	if (it->end < stop)
+		return stop;
+	return _annotations[it->annotation].endOfRange + 1;
+}
+
+Pointer AnnotationResolver::find_last_free_after_or_at(const Pointer p, const Pointer stop) const {
+	if (p > stop)
+		return stop;
+	// First function or data ending at or after p
+	auto it = std::lower_bound(_blocking_ranges.begin(), _blocking_ranges.end(), p, [](const OwnedRange &r, const Pointer p) { return r.end < p; });
+	if (it == _blocking_ranges.end() || it->start > stop)
+		return stop;
+	if (it->start <= p)
+		return INVALID_POINTER; // No valid
+	return _annotations[it->annotation].startOfRange - 1; // Min here if we stared in a function
 }
 
 static void write_comment(FILE *output, const std::string &comment) {
@@ -568,69 +745,287 @@ std::string AnnotationResolver::data_label(const Pointer p, std::string * use_co
 	return std::string(t);
 }
 
+// The function is the closest one before the owner, as long as it reaches this far
+int AnnotationResolver::function_of_owner(const int owner_annotation, const Pointer p) const {
+	const int function = _function_for_annotation[owner_annotation];
+	if (function != -1 && _annotations[function].endOfRange >= p)
+		return function;
+	return -1;
+}
+
+int AnnotationResolver::function_index(const Pointer pc) const {
+	const int o = owner(pc);
+	return o == -1 ? -1 : function_of_owner(o, pc);
+}
+
 const Annotation * AnnotationResolver::resolve_annotation(Pointer resolve_adress, const Annotation ** function_scope, const Annotation ** data_scope) const {
 	if (function_scope) *function_scope = nullptr;
 	if (data_scope) *data_scope = nullptr;
 
-	int start = -1;
-	if (resolve_adress < _annotation_for_adress.size()) {
-		start = _annotation_for_adress[resolve_adress];
-	}
-	// This is based on init of function and data filling all addresses as belonging to them when there is no line info. So -1 means nothing, no scope...
+	// Functions and data own all their addresses unless there is line info. So -1 means nothing, no scope...
+	const int start = owner(resolve_adress);
 	if (start == -1) {
 		return nullptr;
 	}
 
-	const Annotation *line_annotation = &_annotations[start];
+	const Annotation &owner_annotation = _annotations[start];
+
+	if (function_scope) {
+		const int function = function_of_owner(start, resolve_adress);
+		if (function != -1)
+			*function_scope = &_annotations[function];
+	}
+
+	if (data_scope && owner_annotation.type == ANNOTATION_DATA)
+		*data_scope = &owner_annotation;
 
-	const Annotation *found_data = nullptr;
+	return owner_annotation.startOfRange == resolve_adress ? &owner_annotation : nullptr;
+}
 
-	if (line_annotation && line_annotation->type == ANNOTATION_FUNCTION && line_annotation->startOfRange == resolve_adress) {
-		if (function_scope)	*function_scope = line_annotation;
-		return line_annotation;
+void AnnotationResolver::load(const std::vector<std::string> & filenames, const std::string &cache_file) {
+	uint64_t key = 0;
+	if (!cache_file.empty()) {
+		key = cache_key(filenames);
+		if (load_cache(cache_file, key))
+			return;
 	}
-	else if (line_annotation && line_annotation->type == ANNOTATION_DATA) {
-		found_data = line_annotation;
+
+	for (auto f : filenames) {
+		printf("Loading annotations from %s...\n", f.c_str());
 	}
 
-	if (line_annotation->startOfRange != resolve_adress)
-		line_annotation = nullptr;
+	// Files are parsed in parallel and then added in the order they were given, which finalize relies on
+	const int num_files = (int)filenames.size();
+	std::vector<ParsedAnnotations> parsed(num_files);
+	std::vector<char> open_failed(num_files, 0);
 
-	for (int k = start; k >= 0; --k) {
-		const Annotation &a = _annotations[k];
-		if (a.type == ANNOTATION_FUNCTION && a.endOfRange < resolve_adress)
-			break;
-		if (!found_data && a.type == ANNOTATION_DATA && a.startOfRange >= resolve_adress && a.endOfRange <= resolve_adress) found_data = &a;
-		if (a.type == ANNOTATION_FUNCTION) {
-			if (function_scope) *function_scope = &a;
-			break;
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < num_files; ++i) {
+		MappedFile file(filenames[i]);
+		if (!file.is_open()) {
+			open_failed[i] = 1;
+			continue;
 		}
+		parse_annotations(file.data, file.size, filenames[i], parsed[i]);
 	}
-	if (found_data && data_scope) {
-		*data_scope = found_data;
-	}
-	return line_annotation;
-}
 
-void AnnotationResolver::load(const std::vector<std::string> & filenames) {
-	for (auto f : filenames) {
-		printf("Loading annotations from %s...\n", f.c_str());
-		std::ifstream loader;
-		loader.open(f.c_str(), std::ios::in);
-		if (!loader.is_open()) {
-			printf("Failed to open '%s'\n", f.c_str());
+	size_t num_annotations = _annotations.size(), num_hints = _hints.size();
+	for (int i = 0; i < num_files; ++i) {
+		if (open_failed[i]) {
+			printf("Failed to open '%s'\n", filenames[i].c_str());
 			throw std::runtime_error("Failed to open file!");
 		}
-		load(loader, f);
+		if (!parsed[i].error.empty()) {
+			printf("%s\n", parsed[i].error.c_str());
+			exit(99);
+		}
+		num_annotations += parsed[i].annotations.size();
+		num_hints += parsed[i].hints.size();
 	}
+
+	_annotations.reserve(num_annotations);
+	_hints.reserve(num_hints);
+	for (ParsedAnnotations &p : parsed) {
+		std::move(p.annotations.begin(), p.annotations.end(), std::back_inserter(_annotations));
+		_hints.insert(_hints.end(), p.hints.begin(), p.hints.end());
+	}
+
 	finalize();
+
+	if (!cache_file.empty())
+		save_cache(cache_file, key);
+}
+
+uint64_t AnnotationResolver::cache_key(const std::vector<std::string> &filenames) const {
+	Profile profile("Hashing annotations", true);
+	Fnv1a h;
+	h.add(ANNOTATION_CACHE_VERSION);
+
+	// Annotations added before load, such as the MMIO and vector ones
+	h.add((uint32_t)_annotations.size());
+	for (const Annotation &a : _annotations) {
+		h.add((uint8_t)a.type);
+		h.add(a.startOfRange);
+		h.add(a.endOfRange);
+		h.add(a.comment_is_multiline);
+		h.add(a.name);
+		h.add(a.comment);
+		h.add(a.useComment);
+	}
+	h.add((uint32_t)_hints.size());
+	for (const Hint &hint : _hints) {
+		h.add(hint.hints);
+		h.add(hint.location);
+	}
+
+	h.add((uint32_t)filenames.size());
+	for (const std::string &filename : filenames) {
+		h.add(filename);
+		MappedFile file(filename);
+		h.add(file.is_open());
+		h.add((uint64_t)file.size);
+		if (file.data)
+			h.add(file.data, file.size);
+	}
+	return h.h;
+}
+
+bool AnnotationResolver::load_cache(const std::string &cache_file, const uint64_t key) {
+	Profile profile("Loading annotation cache", true);
+	MappedFile file(cache_file);
+	if (!file.is_open())
+		return false;
+
+	AnnotationCacheHeader header;
+	if (file.size < sizeof(header))
+		return false;
+	memcpy(&header, file.data, sizeof(header));
+	if (header.magic != ANNOTATION_CACHE_MAGIC || header.version != ANNOTATION_CACHE_VERSION || header.key != key)
+		return false;
+
+	const uint64_t expected_size = sizeof(header)
+		+ (uint64_t)header.num_annotations * sizeof(CachedAnnotation)
+		+ (uint64_t)header.num_hints * sizeof(CachedHint)
+		+ (uint64_t)(header.num_owned_ranges + header.num_blocking_ranges) * sizeof(OwnedRange)
+		+ (uint64_t)header.num_pages * sizeof(uint32_t)
+		+ (uint64_t)header.num_annotations * sizeof(int)
+		+ header.string_bytes;
+	if (file.size != expected_size) {
+		printf("Ignoring broken annotation cache '%s'\n", cache_file.c_str());
+		return false;
+	}
+
+	const char *p = file.data + sizeof(header);
+	const CachedAnnotation * const cached_annotations = (const CachedAnnotation*)p;
+	p += header.num_annotations * sizeof(CachedAnnotation);
+	const CachedHint * const cached_hints = (const CachedHint*)p;
+	p += header.num_hints * sizeof(CachedHint);
+	const char * const owned_ranges = p;
+	p += header.num_owned_ranges * sizeof(OwnedRange);
+	const char * const blocking_ranges = p;
+	p += header.num_blocking_ranges * sizeof(OwnedRange);
+	const char * const pages = p;
+	p += header.num_pages * sizeof(uint32_t);
+	const char * const functions = p;
+	p += header.num_annotations * sizeof(int);
+	const char * const strings = p;
+
+	const auto string_at = [&](const CachedString &s, std::string &out) {
+		if ((uint64_t)s.offset + s.length > header.string_bytes)
+			return false;
+		out.assign(strings + s.offset, s.length);
+		return true;
+	};
+
+	std::vector<Annotation> annotations(header.num_annotations);
+	for (uint32_t i = 0; i < header.num_annotations; ++i) {
+		CachedAnnotation c;
+		memcpy(&c, &cached_annotations[i], sizeof(c));
+		Annotation &a = annotations[i];
+		a.type = (AnnotationType)c.type;
+		a.comment_is_multiline = c.comment_is_multiline != 0;
+		a.startOfRange = c.start;
+		a.endOfRange = c.end;
+		if (!string_at(c.name, a.name) || !string_at(c.comment, a.comment) || !string_at(c.use_comment, a.useComment)) {
+			printf("Ignoring broken annotation cache '%s'\n", cache_file.c_str());
+			return false;
+		}
+	}
+
+	std::vector<Hint> hints(header.num_hints);
+	for (uint32_t i = 0; i < header.num_hints; ++i) {
+		CachedHint c;
+		memcpy(&c, &cached_hints[i], sizeof(c));
+		hints[i].hints = c.hints;
+		hints[i].location = c.location;
+	}
+
+	_annotations.swap(annotations);
+	_hints.swap(hints);
+	_owned_ranges.resize(header.num_owned_ranges);
+	_blocking_ranges.resize(header.num_blocking_ranges);
+	_range_for_page.resize(header.num_pages);
+	_function_for_annotation.resize(header.num_annotations);
+	if (header.num_owned_ranges != 0)
+		memcpy(&_owned_ranges[0], owned_ranges, header.num_owned_ranges * sizeof(OwnedRange));
+	if (header.num_blocking_ranges != 0)
+		memcpy(&_blocking_ranges[0], blocking_ranges, header.num_blocking_ranges * sizeof(OwnedRange));
+	if (header.num_pages != 0)
+		memcpy(&_range_for_page[0], pages, header.num_pages * sizeof(uint32_t));
+	if (header.num_annotations != 0)
+		memcpy(&_function_for_annotation[0], functions, header.num_annotations * sizeof(int));
+	return true;
+}
+
+void AnnotationResolver::save_cache(const std::string &cache_file, const uint64_t key) const {
+	Profile profile("Saving annotation cache", true);
+
+	std::string strings;
+	const auto add_string = [&strings](const std::string &s) {
+		CachedString c;
+		c.offset = (uint32_t)strings.size();
+		c.length = (uint32_t)s.length();
+		strings.append(s);
+		return c;
+	};
+
+	std::vector<CachedAnnotation> annotations(_annotations.size());
+	for (size_t i = 0; i < _annotations.size(); ++i) {
+		const Annotation &a = _annotations[i];
+		CachedAnnotation &c = annotations[i];
+		c.type = (uint8_t)a.type;
+		c.comment_is_multiline = a.comment_is_multiline ? 1 : 0;
+		c.start = a.startOfRange;
+		c.end = a.endOfRange;
+		c.name = add_string(a.name);
+		c.comment = add_string(a.comment);
+		c.use_comment = add_string(a.useComment);
+	}
+
+	std::vector<CachedHint> hints(_hints.size());
+	for (size_t i = 0; i < _hints.size(); ++i) {
+		hints[i].hints = _hints[i].hints;
+		hints[i].location = _hints[i].location;
+	}
+
+	AnnotationCacheHeader header;
+	header.key = key;
+	header.num_annotations = (uint32_t)annotations.size();
+	header.num_hints = (uint32_t)hints.size();
+	header.num_owned_ranges = (uint32_t)_owned_ranges.size();
+	header.num_blocking_ranges = (uint32_t)_blocking_ranges.size();
+	header.num_pages = (uint32_t)_range_for_page.size();
+	header.string_bytes = strings.size();
+
+	BigFile f;
+	f._file = fopen(cache_file.c_str(), "wb");
+	if (!f._file) {
+		printf("Could not write annotation cache '%s'\n", cache_file.c_str());
+		return;
+	}
+	f.write(header);
+	if (!annotations.empty())
+		f.write(&annotations[0], annotations.size() * sizeof(CachedAnnotation));
+	if (!hints.empty())
+		f.write(&hints[0], hints.size() * sizeof(CachedHint));
+	if (!_owned_ranges.empty())
+		f.write(&_owned_ranges[0], _owned_ranges.size() * sizeof(OwnedRange));
+	if (!_blocking_ranges.empty())
+		f.write(&_blocking_ranges[0], _blocking_ranges.size() * sizeof(OwnedRange));
+	if (!_range_for_page.empty())
+		f.write(&_range_for_page[0], _range_for_page.size() * sizeof(uint32_t));
+	if (!_function_for_annotation.empty())
+		f.write(&_function_for_annotation[0], _function_for_annotation.size() * sizeof(int));
+	f.write(strings.c_str(), strings.size());
+	fclose(f._file);
 }
 
 const Hint * AnnotationResolver::hint(const Pointer pc) const {
-	if (pc >= _annotation_for_adress.size())
+	// If there are many hints for pc the last one is used
+	auto it = std::upper_bound(_hints.begin(), _hints.end(), pc, [](const Pointer pc, const Hint &h) { return pc < h.location; });
+	if (it == _hints.begin())
 		return nullptr;
-	int tai = _hint_for_adress[pc];
-	if (tai == -1) return nullptr;
-	return &_hints[tai];
+	--it;
+	return it->location == pc ? &*it : nullptr;
 }
 }
@@ -75,60 +75,47 @@ public:
 	std::string label(const Pointer p, std::string *use_comment, bool force) const;
 	std::string data_label(const Pointer p, std::string *use_comment, const bool force = false) const;
 	const Annotation* resolve_annotation(Pointer resolve_adress, const Annotation **function_scope = nullptr, const Annotation **data_scope = nullptr) const;
+	// Index in _annotations of the function scope of pc, -1 if none. Read only so threads can share the resolver.
+	int function_index(const Pointer pc) const;
 	
-	void load(const std::vector<std::string> & filenames);
+	// With a cache_file the finalized result is stored there and reused as long as the files and the annotations added before are the same
+	void load(const std::vector<std::string> & filenames, const std::string &cache_file = std::string());
 	std::vector<Annotation> _annotations;
 	std::vector<Hint> _hints;
 
 	const Hint* hint(const Pointer pc) const;
 
-	Pointer find_last_free_before_or_at(const Pointer p, const Pointer stop) const {
-		// TODO: We could binary search annotations for stop instead to avoid linear search
-
-		// Assume in same bank
-		for (int i = p; i >= (int32_t)stop; i--) {
-			if ((uint32_t)i >= _annotation_for_adress.size())
-				continue;
-			int ai = _annotation_for_adress[i];
-			if (ai == -1)
-				continue;
-			const Annotation &a = _annotations[ai];
-			if (a.type == ANNOTATION_FUNCTION || a.type == ANNOTATION_DATA) {
-				if ((uint32_t)i == p)
-					return INVALID_POINTER; // No valid
-				return a.endOfRange+1;
-			}
-		}
-		return stop;
-	}
-
-	Pointer find_last_free_after_or_at(Pointer p, Pointer stop) const {
-
-		// Assume in same bank
-		for (uint32_t i = p; i <= stop; i++) {
-			if (i >= _annotation_for_adress.size())
-				continue;
-			int ai = _annotation_for_adress[i];
-			if (ai == -1)
-				continue;
-			const Annotation &a = _annotations[ai];
-			if (a.type == ANNOTATION_FUNCTION || a.type == ANNOTATION_DATA) {
-				if (i==p)
-					return INVALID_POINTER; // No valid
-				return a.startOfRange-1; // Min here if we stared in a function
-			}
-		}
-		return stop;
-	}
+	// Scans backwards from p to stop (same bank) for a function or data. Returns the address after it, INVALID_POINTER if p is in one or stop if none was found.
+	Pointer find_last_free_before_or_at(const Pointer p, const Pointer stop) const;
+	// Scans forward from p to stop (same bank) for a function or data. Returns the address before it, INVALID_POINTER if p is in one or stop if none was found.
+	Pointer find_last_free_after_or_at(const Pointer p, const Pointer stop) const;
 
 private:
 
 	void add_vector_comment(const RomAccessor &rom, const char * const comment, const uint16_t target_at);
 
-	// Prefer load(std::vector<string>)
-	void load(std::istream &input, const std::string &error_file); // Can be called many times, end with finalize
 	void finalize();
 
-	Array<int> _annotation_for_adress, _hint_for_adress;
+	/*
+		Which annotation owns an address, stored as sorted ranges so memory follows the number of annotations.
+		Functions are painted first, then data and last lines, so the innermost annotation owns an address.
+		A page table over the 24-bit address space points out the first range to look at for each 256 byte page.
+	*/
+	struct OwnedRange {
+		Pointer start, end;
+		int annotation;
+	};
+	std::vector<OwnedRange> _owned_ranges;
+	std::vector<OwnedRange> _blocking_ranges; // Owned by functions or data, for the free space queries
+	std::vector<uint32_t> _range_for_page;    // First range ending at or after the start of each page, plus one for the end
+	std::vector<int> _function_for_annotation; // Closest function at or before each annotation, -1 if none
+
+	int owner(const Pointer p) const;
+	int function_of_owner(const int owner_annotation, const Pointer p) const;
+
+	uint64_t cache_key(const std::vector<std::string> &filenames) const;
+	bool load_cache(const std::string &cache_file, const uint64_t key);
+	void save_cache(const std::string &cache_file, const uint64_t key) const;
 };
+
 }
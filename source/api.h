@@ -25,10 +25,24 @@ struct Registers {
 	uint8_t db;
 };
 
+// So plugins written in C can include this (see plugin_api.h)
+#ifndef __cplusplus
+typedef struct Replay Replay;
+typedef struct ReportWriter ReportWriter;
+typedef struct Registers Registers;
+#endif
+
 // Replay
 void replay_set_breakpoint(Replay* replay, uint32_t pc);
 void replay_set_breakpoint_range(Replay* replay, uint32_t pc0, uint32_t p1);
 
+// kinds is any of these or:ed together. Same values as Replay::WatchKind
+#define REPLAY_WATCH_READ   1
+#define REPLAY_WATCH_WRITE  2
+#define REPLAY_WATCH_CHANGE 4
+void replay_set_watchpoint(Replay* replay, uint32_t address, uint32_t kinds);
+void replay_set_watchpoint_range(Replay* replay, uint32_t address0, uint32_t address1, uint32_t kinds);
+
 Registers *replay_registers(Replay *replay);
 
 /*
@@ -38,5 +52,8 @@ uint8_t  replay_read_byte(Replay *replay, uint32_t address);
 uint16_t replay_read_word(Replay *replay, uint32_t address);
 uint32_t replay_read_long(Replay *replay, uint32_t address);
 
+// Copies length bytes starting at address to dest. Wraps at 24-bit.
+void replay_read_block(Replay *replay, uint32_t address, uint8_t *dest, uint32_t length);
+
 // Report
 void report_writer_print(ReportWriter *report_writer, const char * const str, uint32_t len);
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "annotations.h"
 #include "rom_accessor.h"
 #include "trace.h"
+#include <unordered_map>
 
 /*
 	TODO: This look of this file is partially to blame for me wanting multiple asm output languages.
@@ -229,7 +230,8 @@ private:
 	Pointer m_nextPC;
 	bool m_bankOpen = false;
 	int m_sectionCounter = 0;
-	FILE * const m_outFile;
+	std::vector<uint64_t> *m_sectionOffsets;
+	ReportWriter &m_report;
 
 	inline int adjusted_column(const int s) {
 		int target = 72;
@@ -237,41 +239,53 @@ private:
 		return target;
 	}
 
-	inline int indent_column(FILE *f, int target, int pos, bool comment = false) {
-		static const char spaces[160]="                                                                                                                                                               ";
+	inline int indent_column(int target, int pos, bool comment = false) {
 		assert(target >= pos);
 		int wanted_spaces = target-pos;
 		assert(wanted_spaces <= 159);
-		fwrite(spaces, 1, wanted_spaces, f);
+		m_report.repeat(' ', wanted_spaces);
 		if (comment) {
-			wanted_spaces += fprintf(f, "; ");
+			m_report.write("; ", 2);
+			wanted_spaces += 2;
 		}
 		return pos + wanted_spaces;
 	}
 
-	ReportWriter &m_report;
-
 public:
-	AsmWriteWLADX(ReportWriter &report, const Options &options, const snestistics::RomAccessor &romData) : m_options(options), m_report(report), m_romData(romData), m_nextPC(INVALID_POINTER), m_outFile(report.report) {
+	// If section_offsets is given section numbers are left out and their positions in the report are stored instead
+	AsmWriteWLADX(ReportWriter &report, const Options &options, const snestistics::RomAccessor &romData, std::vector<uint64_t> *section_offsets = nullptr) : m_options(options), m_romData(romData), m_nextPC(INVALID_POINTER), m_sectionOffsets(section_offsets), m_report(report) {
 	}
 	~AsmWriteWLADX() {
 		// TODO: Write footer I guess
-		if (m_outFile) {
-			if (m_bankOpen) {
-				emitBankEnd();
-			}
+		if (m_bankOpen) {
+			emitBankEnd();
 		}
 	}
 
+	// Pick up where another writer left off, with a bank open and the last op ending at next_pc
+	void continueBank(const Pointer next_pc) {
+		m_nextPC = next_pc;
+		m_bankOpen = true;
+	}
+
+	// Don't end the open bank when destroyed, another writer will continue it
+	void detachBank() {
+		m_bankOpen = false;
+	}
+
 	void writeDefine(const std::string &thing, const std::string &value, const std::string &description) {
-		int nw = fprintf(m_outFile, ".EQU %s %s", thing.c_str(), value.c_str());
+		m_report.write(".EQU ", 5);
+		m_report.write(thing);
+		m_report.write(' ');
+		m_report.write(value);
+		int nw = 6 + (int)thing.length() + (int)value.length();
 		writeCommentHelper(nw, adjusted_column(nw), description);
 	}
 
 	void writeCommentHelper(const int start_pos, const int target_column, const std::string &comment) {
 
 		if (comment.empty()) {
-			fputc('\n', m_outFile);
+			m_report.write('\n');
 			return;
 		}
 
@@ -280,17 +294,17 @@ public:
 		bool line_start = true;
 		for (size_t i=0; i<comment.length(); ++i) {
 			if (line_start) {
-				nw = indent_column(m_outFile, target_column, nw, true);
+				nw = indent_column(target_column, nw, true);
 				line_start = false;
 			}
 			char c = comment[i];
-			fputc(c, m_outFile);
+			m_report.write(c);
 			if (c == '\n') {
 				line_start = true;
 				nw = 0;
 			}
 		}
-		fputc('\n', m_outFile);
+		m_report.write('\n');
 	}
 
 	void writeComment(const Pointer pc, const std::string &comment, const int start_pos = 0, const int target_column = 0) {
@@ -313,19 +327,22 @@ public:
 	void writeLabel(const Pointer pc, const std::string &labelName, const std::string &description, const std::string &comment) {
 		prepareWrite(pc);
 		int nw = 0;
-		fprintf(m_outFile, "\n");
+		m_report.write('\n');
 		if (!description.empty())
 			writeCommentHelper(0, 0, description);
-		nw = fprintf(m_outFile, "%s:", labelName.c_str());
+		m_report.write(labelName);
+		m_report.write(':');
+		nw = (int)labelName.length() + 1;
 		if (!comment.empty()) {
-			nw = indent_column(m_outFile, adjusted_column(nw), nw);
-			fprintf(m_outFile, "; %s", comment.c_str());
+			nw = indent_column(adjusted_column(nw), nw);
+			m_report.write("; ", 2);
+			m_report.write(comment);
 			// TODO: Support multiline
 		}			
-		fprintf(m_outFile, "\n");
+		m_report.write('\n');
 	}
 
-	void writeInstruction(const Pointer pc, const int numBits, const int numBytesUsed, const std::string &param, const std::string &line_comment, CombinationBool accumulator_wide, CombinationBool index_wide, Combination8 data_bank, Combination16 direct_page, bool is_predicted) {
+	void writeInstruction(const Pointer pc, const int numBits, const int numBytesUsed, const std::string &param, const std::string &line_comment, CombinationBool accumulator_wide, CombinationBool index_wide, Combination8 data_bank, Combination16 direct_page, bool is_predicted, const Trace::OpExecution *execution) {
 		prepareWrite(pc);
 		const uint8_t* data = m_romData.evalPtr(pc);
 
@@ -339,110 +356,142 @@ public:
 		// Keep track of bytes written so we can align comment column
 		int nw = 0;
 
-		const bool emitCommentPC = m_options.asm_print_pc || m_options.asm_print_bytes || overrideInstructionWithDB;
+		const bool emitCommentPC = m_options.asm_print_pc || m_options.asm_print_bytes || m_options.asm_print_counts || overrideInstructionWithDB;
 
-		nw += fprintf(m_outFile, "    ");
+		m_report.write("    ", 4);
+		nw += 4;
 		if (emitCommentPC) {
-			nw += fprintf(m_outFile, "/*%c", is_predicted ? 'p':' ');
+			m_report.write("/*", 2);
+			m_report.write(is_predicted ? 'p':' ');
+			nw += 3;
 		}
 
 		if (m_options.asm_print_register_sizes) {
 			if(!accumulator_wide.has_value) {
-				fputc('?', m_outFile);
+				m_report.write('?');
 			} else if (accumulator_wide.single_value) {
 				if (accumulator_wide.value) {
-					fputc('M', m_outFile);
+					m_report.write('M');
 				} else {
-					fputc('m', m_outFile);
+					m_report.write('m');
 				}
 			} else {
-				fputc('*', m_outFile);
+				m_report.write('*');
 			}
 			if(!index_wide.has_value) {
-				fputc('?', m_outFile);
+				m_report.write('?');
 			} else if (index_wide.single_value) {
 				if (index_wide.value) {
-					fputc('I', m_outFile);
+					m_report.write('I');
 				} else {
-					fputc('i', m_outFile);
+					m_report.write('i');
 				}
 			} else {
-				fputc('*', m_outFile);
+				m_report.write('*');
 			}
-			fputc(' ', m_outFile);
+			m_report.write(' ');
 			nw += 3;
 		}
 
 		if (m_options.asm_print_db) {
 			assert(data_bank.has_value);
 			if (data_bank.single_value) {
-				nw += fprintf(m_outFile, "%02X ", data_bank.value);
+				m_report.hex(data_bank.value, 2);
+				m_report.write(' ');
 			} else {
-				nw += fprintf(m_outFile, "   ");
+				m_report.write("   ", 3);
 			}
+			nw += 3;
 		}
 
 		if (m_options.asm_print_dp) {
 			assert(direct_page.has_value);
 			if (direct_page.single_value) {
-				nw += fprintf(m_outFile, "%04X ", direct_page.value);
+				m_report.hex(direct_page.value, 4);
+				m_report.write(' ');
 			} else {
-				nw += fprintf(m_outFile, "     ");
+				m_report.write("     ", 5);
 			}
+			nw += 5;
 		}
 
 		if (m_options.asm_print_pc) {
-			nw += fprintf(m_outFile, "%06X ", pc);
+			nw += m_report.hex(pc, 6);
+			m_report.write(' ');
+			nw += 1;
 		}
 		if (m_options.asm_print_bytes) {
 			for (int k = 0; k < numBytesUsed; k++) {
-				nw += fprintf(m_outFile, "%02X ", data[k]);
-			}
-			for (int k = numBytesUsed; k < 4; k++) {
-				nw += fprintf(m_outFile, "   ");
+				m_report.hex(data[k], 2);
+				m_report.write(' ');
 			}
+			m_report.repeat(' ', 3 * (4 - numBytesUsed));
+			nw += 3 * std::max(4, numBytesUsed);
+		}
+		if (m_options.asm_print_counts) {
+			// Execution count, empty for predicted ops
+			char count[20];
+			const int len = execution ? snestistics::format_decimal64(count, execution->count) : 0;
+			m_report.repeat(' ', std::max(0, 10 - len));
+			m_report.write(count, len);
+			m_report.write(' ');
+			nw += std::max(10, len) + 1;
 		}
 
 		if (emitCommentPC && !overrideInstructionWithDB) {
-			nw += fprintf(m_outFile, "*/ ");
+			m_report.write("*/ ", 3);
+			nw += 3;
 		}
 
 		const char * const op = opCodeInfo[data[0]].mnemonics;
 		if (m_options.asm_lower_case_op) {
-			nw += fprintf(m_outFile, "%c%c%c", tolower(op[0]), tolower(op[1]), tolower(op[2]));
+			m_report.write((char)tolower(op[0]));
+			m_report.write((char)tolower(op[1]));
+			m_report.write((char)tolower(op[2]));
+			nw += 3;
 		} else {
-			nw += fprintf(m_outFile, "%s", op);
+			m_report.write(op);
+			nw += (int)strlen(op);
 		}
 
 		if (strcmp(opCodeInfo[data[0]].mnemonics, "BRL") == 0) {
 
 		} else if (numBits == 0) {
 		} else if (numBits == 8) {
-			nw += fprintf(m_outFile, ".b");
+			m_report.write(".b", 2);
+			nw += 2;
 		} else if (numBits == 16) {
-			nw += fprintf(m_outFile, ".w");
+			m_report.write(".w", 2);
+			nw += 2;
 		} else if (numBits == 24) {
-			nw += fprintf(m_outFile, ".l");
+			m_report.write(".l", 2);
+			nw += 2;
 		} else {
 			assert(false);
 		}
 
 		if (!param.empty()) {
-			nw += fprintf(m_outFile, " %s", param.c_str());
+			m_report.write(' ');
+			m_report.write(param);
+			nw += 1 + (int)param.length();
 		}
 
 		if (overrideInstructionWithDB) {
-			nw += fprintf(m_outFile, "*/ ");
+			m_report.write("*/ ", 3);
+			nw += 3;
 		}
 
 		writeCommentHelper(nw, adjusted_column(nw), line_comment);
 
 		if (overrideInstructionWithDB) {
-			fprintf(m_outFile, ".DB ");
+			m_report.write(".DB ", 4);
 			for (int k = 0; k < numBytesUsed; k++) {
-				fprintf(m_outFile, "$%02X%s", data[k], k != numBytesUsed-1 ? ", ":"");
+				m_report.write('$');
+				m_report.hex(data[k], 2);
+				if (k != numBytesUsed-1)
+					m_report.write(", ", 2);
 			}
-			fprintf(m_outFile, "\n");
+			m_report.write('\n');
 		}
 
 		m_nextPC = pc + numBytesUsed;
@@ -450,21 +499,21 @@ public:
 
 	void write_vectors(const snestistics::AnnotationResolver &annotations, const LargeBitfield &trace) {
 		// "Programming the 65816", page 55
-		fprintf(m_outFile, ".SNESNATIVEVECTOR      ; Define Native Mode interrupt vector table\n");
+		m_report.write(".SNESNATIVEVECTOR      ; Define Native Mode interrupt vector table\n");
 		write_vector_single("COP",   annotations, trace, 0xFFE4);
 		write_vector_single("BRK",   annotations, trace, 0xFFE6);
 		write_vector_single("ABORT", annotations, trace, 0xFFE8);
 		write_vector_single("NMI",   annotations, trace, 0xFFEA);
 		write_vector_single("IRQ",   annotations, trace, 0xFFEE);
-		fprintf(m_outFile, ".ENDNATIVEVECTOR\n");
+		m_report.write(".ENDNATIVEVECTOR\n");
 
-		fprintf(m_outFile, "\n.SNESEMUVECTOR         ; Define Emulation Mode interrupt vector table\n");
+		m_report.write("\n.SNESEMUVECTOR         ; Define Emulation Mode interrupt vector table\n");
 		write_vector_single("COP",    annotations, trace, 0xFFF4);
 		write_vector_single("ABORT",  annotations, trace, 0xFFF8);
 		write_vector_single("NMI",    annotations, trace, 0xFFFA);
 		write_vector_single("RESET",  annotations, trace, 0xFFFC);
 		write_vector_single("IRQBRK", annotations, trace, 0xFFFE);
-		fprintf(m_outFile, ".ENDEMUVECTOR\n");
+		m_report.write(".ENDEMUVECTOR\n");
 	}
 
 private:
@@ -476,23 +525,30 @@ private:
 		if (labels[target] && (target & 0xFF0000) == 0) {
 			std::string label_name = annotations.label(target, nullptr, true);
 			if (!label_name.empty()) {
-				fprintf(m_outFile, "  %-6s %s\n", name, label_name.c_str());
+				m_report.format("  %-6s %s\n", name, label_name.c_str());
 				return;
 			}
 		}
-		fprintf(m_outFile, "  %-6s $%04X\n", name, target);
+		m_report.format("  %-6s $%04X\n", name, target);
 	}
 
 	void emitBankStart(const Pointer pc) {
-		fprintf(m_outFile, "\n");
-		fprintf(m_outFile, ".BANK $%02X SLOT 0\n", pc >> 16);
-		fprintf(m_outFile, ".ORG $%04X-$8000\n", pc & 0xffff);
-		fprintf(m_outFile, ".SECTION SnestisticsSection%d OVERWRITE\n", m_sectionCounter);
-		m_sectionCounter++;
+		m_report.write("\n.BANK $");
+		m_report.hex(pc >> 16, 2);
+		m_report.write(" SLOT 0\n.ORG $");
+		m_report.hex(pc & 0xffff, 4);
+		m_report.write("-$8000\n.SECTION SnestisticsSection");
+		if (m_sectionOffsets) {
+			m_sectionOffsets->push_back(m_report.bytes_written());
+		} else {
+			m_report.decimal(m_sectionCounter);
+			m_sectionCounter++;
+		}
+		m_report.write(" OVERWRITE\n");
 	}
 
 	void emitBankEnd() {
-		fprintf(m_outFile, "\n.ENDS\n\n");
+		m_report.write("\n.ENDS\n\n");
 	}
 
 	void prepareWrite(const Pointer pc, const bool advancePC=true) {
@@ -511,81 +567,267 @@ private:
 			if (holeSize > 1024 || ((m_nextPC >> 16) != (pc >> 16))) {
 				emitBankEnd();
 
-				fprintf(m_outFile, "\n; %d bytes gap (0x%X)\n\n", holeSize, holeSize);
+				m_report.format("\n; %d bytes gap (0x%X)\n\n", holeSize, holeSize);
 
 				emitBankStart(pc);
 			}
 			else {
 				Pointer p = m_nextPC;
-				fprintf(m_outFile, "\n");
+				m_report.write('\n');
 				while (p<pc) {
-					fprintf(m_outFile, ".DB ");
+					m_report.write(".DB ", 4);
 					for (int x = 0; x<32 && p<pc; x++, ++p) {
-						fprintf(m_outFile, "$%02X", m_romData.evalByte(p));
+						m_report.write('$');
+						m_report.hex(m_romData.evalByte(p), 2);
 
 						if (x != 32 - 1 && p != pc - 1) {
-							fprintf(m_outFile, ",");
+							m_report.write(',');
 						}
 					}
-					fprintf(m_outFile, "\n");
+					m_report.write('\n');
 				}
-				fprintf(m_outFile, "\n");
+				m_report.write('\n');
 			}
 
 			m_nextPC = pc;
 		}
 	}
 };
-}
 
-namespace snestistics {
+// Ops in one ROM bank. Banks are formatted on their own so they can be done in parallel.
+struct AsmBank {
+	std::map<Pointer, Trace::OpVariantLookup>::const_iterator begin, end;
+	const DecodedOp *decoded; // Decoded begin
+	Pointer next_op; // Where the last op of the previous bank ended, INVALID_POINTER for the first bank
+	uint32_t first_dma_event;
+};
 
-void asm_writer(ReportWriter &report, const Options &options, Trace &trace, const AnnotationResolver &annotations, const RomAccessor &rom_accessor) {
-	AsmWriteWLADX writer(report, options, rom_accessor);
+/*
+	The rendered text of each bank is cached in <asm file>.cache so only banks that changed are rendered again.
+	A cached bank is reused if its key matches (ops, labels, DMA, ROM and options) and all annotation lookups
+	done while rendering it give the same answers as before.
+*/
+static const uint64_t ASM_CACHE_MAGIC = 0x534e534153434348;
+static const uint32_t ASM_CACHE_VERSION = 2;
+
+#pragma pack(push, 1)
+struct AsmLookup {
+	enum Type : uint8_t { LINE_INFO, LABEL };
+	enum Flags : uint8_t { FORCE=1, WANT_LABEL=2, WANT_COMMENT=4, WANT_USE_COMMENT=8 };
+	Pointer p;
+	uint8_t type;
+	uint8_t flags;
+};
+#pragma pack(pop)
 
-	int next_dma_event = 0;
+// Goes between write_bank and the annotations, hashing the answers if they are to be checked later
+struct AsmLookups {
+	const AnnotationResolver &annotations;
+	const bool hash;
+	std::vector<AsmLookup> *recorded;
+	Fnv1a answers;
 
-	for (const Annotation &a : annotations._annotations) {
-		if (a.type == ANNOTATION_FUNCTION || (a.type == ANNOTATION_LINE && !a.name.empty()))
-			trace.labels.set_bit(a.startOfRange);
+	AsmLookups(const AnnotationResolver &annotations_, const bool hash_, std::vector<AsmLookup> *recorded_) : annotations(annotations_), hash(hash_), recorded(recorded_) {}
+
+	void line_info(const Pointer p, std::string *label_out, std::string *comment_out, std::string *use_comment_out, const bool force_label) {
+		const AsmLookup l = { p, AsmLookup::LINE_INFO, flags(force_label, label_out, comment_out, use_comment_out) };
+		lookup(l, label_out, comment_out, use_comment_out);
+	}
+	std::string label(const Pointer p, std::string *use_comment, const bool force) {
+		std::string name;
+		const AsmLookup l = { p, AsmLookup::LABEL, flags(force, &name, nullptr, use_comment) };
+		lookup(l, &name, nullptr, use_comment);
+		return name;
 	}
 
-	writer.writeSeperator("Header");
+	void lookup(const AsmLookup &l, std::string *label_out, std::string *comment_out, std::string *use_comment_out) {
+		const bool force = (l.flags & AsmLookup::FORCE) != 0;
+		if (l.type == AsmLookup::LINE_INFO) {
+			annotations.line_info(l.p, label_out, comment_out, use_comment_out, force);
+		} else {
+			*label_out = annotations.label(l.p, use_comment_out, force);
+		}
+		if (recorded) recorded->push_back(l);
+		if (!hash) return;
+		if (label_out) answers.add(*label_out);
+		if (comment_out) answers.add(*comment_out);
+		if (use_comment_out) answers.add(*use_comment_out);
+	}
 
-	if (!options.asm_header_file.empty()) {
-		Array<unsigned char> header;
-		read_file(options.asm_header_file, header);
-		fwrite(&header[0], header.size(), 1, report.report);
-		char newline = '\n';
-		fwrite(&newline, 1, 1, report.report);
+private:
+	static uint8_t flags(const bool force, const void * const label_out, const void * const comment_out, const void * const use_comment_out) {
+		uint8_t f = force ? AsmLookup::FORCE : 0;
+		if (label_out) f |= AsmLookup::WANT_LABEL;
+		if (comment_out) f |= AsmLookup::WANT_COMMENT;
+		if (use_comment_out) f |= AsmLookup::WANT_USE_COMMENT;
+		return f;
 	}
+};
 
-	writer.write_vectors(annotations, trace.labels);
+struct AsmCachedBank {
+	uint64_t key = 0;
+	uint64_t answers = 0;
+	std::vector<AsmLookup> lookups;
+	std::vector<uint64_t> section_offsets;
+	std::string text;
+};
 
-	writer.writeSeperator("Data");
+// Asks the same questions again and checks that the annotations still give the same answers
+bool lookups_unchanged(const AnnotationResolver &annotations, const AsmCachedBank &cached) {
+	AsmLookups check(annotations, true, nullptr);
+	std::string label, comment, use_comment;
+	for (const AsmLookup &l : cached.lookups) {
+		check.lookup(l,
+			(l.flags & AsmLookup::WANT_LABEL) ? &label : nullptr,
+			(l.flags & AsmLookup::WANT_COMMENT) ? &comment : nullptr,
+			(l.flags & AsmLookup::WANT_USE_COMMENT) ? &use_comment : nullptr);
+	}
+	return check.answers.h == cached.answers;
+}
 
-	// Generate EQU for each label
-	// TODO: Only include USED labels?
-	for (const Annotation &a : annotations._annotations) {
-		if (a.type != ANNOTATION_DATA)
-			continue;
+// Everything that is the same for all banks
+uint64_t shared_cache_key(const Options &options, const RomAccessor &rom_accessor) {
+	Fnv1a h;
+	h.add(ASM_CACHE_VERSION);
+	const bool flags[] = { options.asm_print_pc, options.asm_print_bytes, options.asm_print_register_sizes, options.asm_print_db, options.asm_print_dp, options.asm_print_counts, options.asm_lower_case_op };
+	h.add(flags, sizeof(flags));
+	h.add(options.rom_size);
+	const Array<uint8_t> &rom = rom_accessor.data();
+	if (rom.size() != 0)
+		h.add(&rom[0], rom.size());
+	return h.h;
+}
 
-		// NOTE: We only use 16-bit here... the high byte is almost never used in an op
-		// TODO: Validate so this doesn't mess thing up when we use it
-		char target[512];
-		sprintf(target, "$%04X", a.startOfRange&0xFFFF);
-		writer.writeDefine(a.name, target, a.comment.empty() ? a.useComment : a.comment);
+uint64_t bank_cache_key(const uint64_t shared_key, const Trace &trace, const AsmBank &bank, const bool first_bank, const bool last_bank, const bool print_counts) {
+	Fnv1a h;
+	h.add(shared_key);
+	h.add(first_bank);
+	h.add(last_bank);
+	h.add(bank.next_op);
+
+	Pointer next_op = bank.next_op;
+	Pointer last_pc = 0;
+	const DecodedOp *decoded = bank.decoded;
+	for (auto it = bank.begin; it != bank.end; ++it, ++decoded) {
+		const Pointer pc = it->first;
+		// Labels are emitted from where the previous op ended
+		for (Pointer p = next_op == INVALID_POINTER ? pc : next_op; p <= pc; ++p) {
+			if (trace.labels[p])
+				h.add(p);
+		}
+		h.add(pc);
+		h.add(trace.is_predicted[pc]);
+		if (print_counts) {
+			const Trace::OpExecution *execution = trace.execution(pc);
+			h.add(execution ? execution->count : 0);
+		}
+		h.add(it->second.count);
+		for (uint32_t i = 0; i < it->second.count; ++i) {
+			const OpInfo &o = trace.variant(it->second, i);
+			h.add(o.indirect_base_pointer);
+			h.add(o.jump_target);
+			h.add(o.P);
+			h.add(o.DP);
+			h.add(o.X);
+			h.add(o.Y);
+			h.add(o.DB);
+		}
+		next_op = pc + decoded->size;
+		last_pc = pc;
 	}
 
-	writer.writeSeperator("Code");
+	for (uint32_t i = bank.first_dma_event; i < trace.dma_transfers.size() && trace.dma_transfers[i].pc <= last_pc; ++i) {
+		const DmaTransfer &d = trace.dma_transfers[i];
+		h.add(d.pc);
+		h.add(d.a_address);
+		h.add(d.transfer_bytes);
+		h.add(d.transfer_mode);
+		h.add(d.b_address);
+		h.add(d.a_bank);
+		h.add(d.wram);
+		h.add(d.flags);
+	}
+	return h.h;
+}
 
-	Pointer nextOp(INVALID_POINTER);
+bool load_asm_cache(const std::string &filename, std::vector<AsmCachedBank> &banks) {
+	BigFile f;
+	f._file = fopen(filename.c_str(), "rb");
+	if (!f._file)
+		return false;
+
+	bool ok = true;
+	uint64_t magic = 0;
+	uint32_t version = 0, num_banks = 0;
+	ok = ok && f.read(magic) == sizeof(magic) && magic == ASM_CACHE_MAGIC;
+	ok = ok && f.read(version) == sizeof(version) && version == ASM_CACHE_VERSION;
+	ok = ok && f.read(num_banks) == sizeof(num_banks);
+	if (ok)
+		banks.resize(num_banks);
+	for (uint32_t b = 0; ok && b < num_banks; ++b) {
+		AsmCachedBank &bank = banks[b];
+		uint32_t num_lookups = 0, num_sections = 0;
+		uint64_t text_length = 0;
+		ok = ok && f.read(bank.key) == sizeof(bank.key);
+		ok = ok && f.read(bank.answers) == sizeof(bank.answers);
+		ok = ok && f.read(num_lookups) == sizeof(num_lookups);
+		if (ok && num_lookups != 0) {
+			bank.lookups.resize(num_lookups);
+			ok = f.read(&bank.lookups[0], num_lookups * sizeof(AsmLookup)) == num_lookups * sizeof(AsmLookup);
+		}
+		ok = ok && f.read(num_sections) == sizeof(num_sections);
+		if (ok && num_sections != 0) {
+			bank.section_offsets.resize(num_sections);
+			ok = f.read(&bank.section_offsets[0], num_sections * sizeof(uint64_t)) == num_sections * sizeof(uint64_t);
+		}
+		ok = ok && f.read(text_length) == sizeof(text_length);
+		if (ok && text_length != 0) {
+			bank.text.resize((size_t)text_length);
+			ok = f.read(&bank.text[0], text_length) == text_length;
+		}
+	}
+	fclose(f._file);
+
+	if (!ok) {
+		printf("Ignoring broken or old asm cache '%s'\n", filename.c_str());
+		banks.clear();
+	}
+	return ok;
+}
+
+void save_asm_cache(const std::string &filename, const std::vector<AsmCachedBank> &banks) {
+	BigFile f;
+	f._file = fopen(filename.c_str(), "wb");
+	if (!f._file) {
+		printf("Could not write asm cache '%s'\n", filename.c_str());
+		return;
+	}
+	f.write(ASM_CACHE_MAGIC);
+	f.write(ASM_CACHE_VERSION);
+	f.write((uint32_t)banks.size());
+	for (const AsmCachedBank &bank : banks) {
+		f.write(bank.key);
+		f.write(bank.answers);
+		f.write((uint32_t)bank.lookups.size());
+		if (!bank.lookups.empty())
+			f.write(&bank.lookups[0], bank.lookups.size() * sizeof(AsmLookup));
+		f.write((uint32_t)bank.section_offsets.size());
+		if (!bank.section_offsets.empty())
+			f.write(&bank.section_offsets[0], bank.section_offsets.size() * sizeof(uint64_t));
+		f.write((uint64_t)bank.text.length());
+		f.write(bank.text.c_str(), bank.text.length());
+	}
+	fclose(f._file);
+}
+
+void write_bank(AsmWriteWLADX &writer, const Trace &trace, AsmLookups &lookups, const RomAccessor &rom_accessor, const AsmBank &bank) {
+	Pointer nextOp(bank.next_op);
+	uint32_t next_dma_event = bank.first_dma_event;
 
 	std::vector<OpInfo> variants;
 	variants.reserve(1024*64);
 
-	// Now iterate the ops
-	for (auto opsit = trace.ops.begin(); opsit != trace.ops.end(); ++opsit) {
+	for (auto opsit = bank.begin; opsit != bank.end; ++opsit) {
 		const Pointer pc = opsit->first;
 
 		if (nextOp == INVALID_POINTER) {
@@ -601,7 +843,7 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 				// Emit label?
 				std::string label, line_comment, line_use_comment;
 
-				annotations.line_info(p, &label, &line_comment, &line_use_comment, true);
+				lookups.line_info(p, &label, &line_comment, &line_use_comment, true);
 
 				std::string description = line_comment;
 				if (line_comment.empty()) {
@@ -630,6 +872,7 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 		const bool ind16 = is_index_wide(first_variant.P);
 		const bool emu   = is_emulation_mode(first_variant.P);
 		const bool is_predicted = trace.is_predicted[pc];
+		const Trace::OpExecution *execution = trace.execution(pc);
 		if (emu) printf("emu mode at pc %06X\n", pc);
 
 		char target[128] = "\0";
@@ -820,13 +1063,13 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 
 		std::string line_comment;
 		if (!emitted_label) {
-			annotations.line_info(pc, nullptr, &line_comment, nullptr, false);
+			lookups.line_info(pc, nullptr, &line_comment, nullptr, false);
 		}
 
-		auto variant_writer = [&annotations, &line_comment, is_jump](StringBuilder &ss, const Pointer target_pointer, const Proposal &p, bool name_in_code) {
+		auto variant_writer = [&lookups, &line_comment, is_jump](StringBuilder &ss, const Pointer target_pointer, const Proposal &p, bool name_in_code) {
 			ss.clear();
 			std::string use_comment, pointer_comment = p;
-			const std::string name = annotations.label(target_pointer, &use_comment, is_jump);
+			const std::string name = lookups.label(target_pointer, &use_comment, is_jump);
 
 			if (!name_in_code || name.empty()) {
 				if (!name.empty()) {
@@ -865,14 +1108,14 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 			std::string name = variant_writer(ss, proposals.begin()->first, proposals.begin()->second, name_in_code);
 
 			if (!name_in_code || name.empty()) {
-				writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, target, ss.c_str(), accumulator_wide, index_wide, shared_db, shared_dp, is_predicted);
+				writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, target, ss.c_str(), accumulator_wide, index_wide, shared_db, shared_dp, is_predicted, execution);
 			} else {
 				char wow[256];
 				sprintf(wow, target_label, name.c_str());
-				writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, wow, ss.c_str(), accumulator_wide, index_wide, shared_db, shared_dp, is_predicted);
+				writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, wow, ss.c_str(), accumulator_wide, index_wide, shared_db, shared_dp, is_predicted, execution);
 			}
 		} else {
-			writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, target, line_comment, accumulator_wide, index_wide, shared_db, shared_dp, is_predicted);
+			writer.writeInstruction(pc, numBitsNeeded, numBytesNeeded, target, line_comment, accumulator_wide, index_wide, shared_db, shared_dp, is_predicted, execution);
 			// List all possible targets in comments!
 			for (auto pit = proposals.begin(); pit != proposals.end(); ++pit) {
 				std::string name = variant_writer(ss, pit->first, pit->second, false);
@@ -930,7 +1173,7 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 				StringBuilder ss;
 
 				std::string use_comment;
-				const std::string name = annotations.label(v.indirect_base_pointer, &use_comment, is_jump);
+				const std::string name = lookups.label(v.indirect_base_pointer, &use_comment, is_jump);
 
 				ss.format("indirect base=%06X", v.indirect_base_pointer);
 				if (depend_DP) ss.format(", DP=%X", v.DP);
@@ -956,11 +1199,136 @@ void asm_writer(ReportWriter &report, const Options &options, Trace &trace, cons
 			const DmaTransfer &d = trace.dma_transfers[next_dma_event++];
 			StringBuilder ss;
 			bool reverse = d.flags & DmaTransfer::REVERSE_TRANSFER;
-			int num_bytes = d.transfer_bytes == 0 ? 0x10000 : d.transfer_bytes;
-			assert(d.b_address == 0x80); // So we can detect that we've enabled more and can improve
-			ss.format("dma-event $%02X:%04X %s $%02X:%04X (via $2180), $%X/%d bytes%s%s", d.a_bank, d.a_address, reverse ? "<-" : "->", d.wram>>16, d.wram&0xFFFF, num_bytes, num_bytes, d.flags & DmaTransfer::A_ADDRESS_DECREMENT ?" (decrease A)":"", d.flags & DmaTransfer::A_ADDRESS_FIXED ? " (A fixed)":"");
+			const uint32_t num_bytes = d.num_bytes();
+			if (d.flags & DmaTransfer::HDMA)
+				ss.format("hdma-event table $%02X:%04X %s $21%02X, mode %d%s", d.a_bank, d.a_address, reverse ? "<-" : "->", d.b_address, d.transfer_mode, d.flags & DmaTransfer::HDMA_INDIRECT ? " (indirect)":"");
+			else if (d.b_address == 0x80)
+				ss.format("dma-event $%02X:%04X %s $%02X:%04X (via $2180), $%X/%d bytes%s%s", d.a_bank, d.a_address, reverse ? "<-" : "->", d.wram>>16, d.wram&0xFFFF, num_bytes, num_bytes, d.flags & DmaTransfer::A_ADDRESS_DECREMENT ?" (decrease A)":"", d.flags & DmaTransfer::A_ADDRESS_FIXED ? " (A fixed)":"");
+			else
+				ss.format("dma-event $%02X:%04X %s $21%02X, mode %d, $%X/%d bytes%s%s", d.a_bank, d.a_address, reverse ? "<-" : "->", d.b_address, d.transfer_mode, num_bytes, num_bytes, d.flags & DmaTransfer::A_ADDRESS_DECREMENT ?" (decrease A)":"", d.flags & DmaTransfer::A_ADDRESS_FIXED ? " (A fixed)":"");
 			writer.writeComment(pc, ss.c_str(), 0, 10);
 		}
 	}
 }
 }
+
+namespace snestistics {
+
+void asm_writer(ReportWriter &report, const Options &options, Trace &trace, const DecodedOps &decoded, const AnnotationResolver &annotations, const RomAccessor &rom_accessor) {
+	CUSTOM_ASSERT(decoded.size() == trace.ops.size());
+
+	AsmWriteWLADX writer(report, options, rom_accessor);
+
+	for (const Annotation &a : annotations._annotations) {
+		if (a.type == ANNOTATION_FUNCTION || (a.type == ANNOTATION_LINE && !a.name.empty()))
+			trace.labels.set_bit(a.startOfRange);
+	}
+
+	writer.writeSeperator("Header");
+
+	if (!options.asm_header_file.empty()) {
+		Array<unsigned char> header;
+		read_file(options.asm_header_file, header);
+		report.write((const char*)&header[0], (uint32_t)header.size());
+		report.write('\n');
+	}
+
+	writer.write_vectors(annotations, trace.labels);
+
+	writer.writeSeperator("Data");
+
+	// Generate EQU for each label
+	// TODO: Only include USED labels?
+	for (const Annotation &a : annotations._annotations) {
+		if (a.type != ANNOTATION_DATA)
+			continue;
+
+		// NOTE: We only use 16-bit here... the high byte is almost never used in an op
+		// TODO: Validate so this doesn't mess thing up when we use it
+		char target[512];
+		sprintf(target, "$%04X", a.startOfRange&0xFFFF);
+		writer.writeDefine(a.name, target, a.comment.empty() ? a.useComment : a.comment);
+	}
+
+	writer.writeSeperator("Code");
+
+	// Split ops into banks. Each bank is formatted into memory on its own thread, then written in order.
+	// The output is the same as doing it in one go, only section numbers need to be filled in afterwards.
+	std::vector<AsmBank> banks;
+	Pointer next_op = INVALID_POINTER;
+	size_t decoded_index = 0;
+	for (auto opsit = trace.ops.cbegin(); opsit != trace.ops.cend(); ) {
+		AsmBank bank;
+		bank.begin = opsit;
+		bank.decoded = &decoded[decoded_index];
+		bank.next_op = next_op;
+		bank.first_dma_event = (uint32_t)(std::lower_bound(trace.dma_transfers.begin(), trace.dma_transfers.end(), opsit->first, [](const DmaTransfer &d, const Pointer pc) { return d.pc < pc; }) - trace.dma_transfers.begin());
+		const uint32_t bank_nr = opsit->first >> 16;
+		while (opsit != trace.ops.cend() && (opsit->first >> 16) == bank_nr) {
+			++opsit;
+			++decoded_index;
+		}
+		bank.end = opsit;
+		const DecodedOp &last = decoded[decoded_index - 1];
+		next_op = last.pc + last.size;
+		banks.push_back(bank);
+	}
+
+	const int num_banks = (int)banks.size();
+	int section_counter = 0;
+	int num_reused = 0;
+
+	const std::string cache_file = options.asm_out_file + ".cache";
+	std::vector<AsmCachedBank> old_cache;
+	load_asm_cache(cache_file, old_cache);
+	std::unordered_map<uint64_t, AsmCachedBank*> old_cache_by_key;
+	for (AsmCachedBank &c : old_cache)
+		old_cache_by_key.insert(std::make_pair(c.key, &c));
+
+	const uint64_t shared_key = shared_cache_key(options, rom_accessor);
+	std::vector<AsmCachedBank> cache(num_banks);
+
+	#pragma omp parallel for ordered schedule(dynamic) reduction(+:num_reused)
+	for (int b = 0; b < num_banks; ++b) {
+		AsmCachedBank &entry = cache[b];
+		const uint64_t key = bank_cache_key(shared_key, trace, banks[b], b == 0, b == num_banks - 1, options.asm_print_counts);
+
+		// Keys are unique so no other thread will touch the same old entry
+		auto found = old_cache_by_key.find(key);
+		if (found != old_cache_by_key.end() && lookups_unchanged(annotations, *found->second)) {
+			entry = std::move(*found->second);
+			num_reused++;
+		} else {
+			entry.key = key;
+			AsmLookups lookups(annotations, true, &entry.lookups);
+			{
+				ReportWriter bank_report(entry.text);
+				AsmWriteWLADX bank_writer(bank_report, options, rom_accessor, &entry.section_offsets);
+				if (b != 0)
+					bank_writer.continueBank(banks[b].next_op);
+				write_bank(bank_writer, trace, lookups, rom_accessor, banks[b]);
+				if (b != num_banks - 1)
+					bank_writer.detachBank();
+			}
+			entry.answers = lookups.answers.h;
+		}
+
+		#pragma omp ordered
+		{
+			const std::string &text = entry.text;
+			size_t pos = 0;
+			for (const uint64_t offset : entry.section_offsets) {
+				report.write(text.c_str() + pos, (uint32_t)(offset - pos));
+				report.decimal(section_counter++);
+				pos = (size_t)offset;
+			}
+			report.write(text.c_str() + pos, (uint32_t)(text.size() - pos));
+		}
+	}
+
+	if (num_reused != 0)
+		printf(" Reused %d of %d banks from asm cache\n", num_reused, num_banks);
+
+	save_asm_cache(cache_file, cache);
+}
+}
@@ -1,10 +1,12 @@
 #pragma once
 
+#include "decode.h"
+
 struct ReportWriter;
 namespace snestistics {
 	struct Trace;
 	class RomAccessor;
 	class AnnotationResolver;
-	void asm_writer(ReportWriter &report, const Options &options, Trace &trace, const AnnotationResolver &annotations, const RomAccessor &rom_accessor);
+	void asm_writer(ReportWriter &report, const Options &options, Trace &trace, const DecodedOps &decoded, const AnnotationResolver &annotations, const RomAccessor &rom_accessor);
 }
 
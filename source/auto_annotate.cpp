@@ -2,8 +2,7 @@
 #include "utils.h"
 #include "cputable.h"
 #include "annotations.h"
-#include "trace.h"
-#include "rom_accessor.h"
+#include <set>
 
 namespace snestistics {
 
@@ -11,7 +10,7 @@ inline bool same_bank(Pointer pc, Pointer target) {
 	return ((pc >> 16) == (target >> 16));
 }
 
-void guess_range(const Trace &trace, const RomAccessor &rom, const AnnotationResolver &annotations, std::string &output_file) {
+void guess_range(const DecodedOps &decoded, const AnnotationResolver &annotations, std::string &output_file) {
 
 	FILE *output = fopen(output_file.c_str(), "wt");
 
@@ -31,10 +30,10 @@ void guess_range(const Trace &trace, const RomAccessor &rom, const AnnotationRes
 	// TODO: Support trace annotation jump is jsr
 	std::vector<FoundRange> found_ranges;
 
-	for (auto it = trace.ops.begin(); it != trace.ops.end(); ++it) {
+	for (auto it = decoded.begin(); it != decoded.end(); ++it) {
 		FoundRange found;
-		while (it != trace.ops.end()) {
-			Pointer pc = it->first;
+		while (it != decoded.end()) {
+			Pointer pc = it->pc;
 
 			const Annotation *function = nullptr;
 			annotations.resolve_annotation(pc, &function);
@@ -43,7 +42,7 @@ void guess_range(const Trace &trace, const RomAccessor &rom, const AnnotationRes
 			if (function)
 				break;
 
-			uint8_t opcode = rom.evalByte(pc);
+			uint8_t opcode = it->opcode;
 
 			if (found.start == INVALID_POINTER)
 				found.start = pc;
@@ -53,8 +52,8 @@ void guess_range(const Trace &trace, const RomAccessor &rom, const AnnotationRes
 				bool merge_long_jumps = hint && hint->has_hint(Hint::ANNOTATE_MERGE);
 				bool relevant_jump = merge_long_jumps || branches8[opcode];
 
-				Pointer jump_target, jump_secondary_target;
-				bool op_is_jump_or_branch = decode_static_jump(opcode, rom, pc, &jump_target, &jump_secondary_target);
+				const Pointer jump_target = it->jump_target, jump_secondary_target = it->secondary_target;
+				const bool op_is_jump_or_branch = it->is_jump_or_branch;
 
 				bool jump_is_jsr = false;
 				if (hint && hint->has_hint(Hint::JUMP_IS_JSR))
@@ -1,10 +1,9 @@
 #pragma once
 
 #include <string>
+#include "decode.h"
 
 namespace snestistics {
-	struct Trace;
-	class RomAccessor;
 	class AnnotationResolver;
-	void guess_range(const Trace &trace, const RomAccessor &rom, const AnnotationResolver &annotations, std::string &output_file);
+	void guess_range(const DecodedOps &decoded, const AnnotationResolver &annotations, std::string &output_file);
 }
@@ -0,0 +1,384 @@
+#include "call_graph.h"
+#include "annotations.h"
+#include "cputable.h"
+#include "options.h"
+#include "replay.h"
+#include "report_writer.h"
+#include "trace.h"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace snestistics;
+
+namespace {
+
+static const uint32_t CALL_GRAPH_NMIS_PER_CHUNK = 100;
+static const uint32_t MAX_CALL_DEPTH = 1024;
+
+struct Cost {
+	uint64_t instructions = 0, cycles = 0;
+
+	void add(const Cost &o) {
+		instructions += o.instructions;
+		cycles += o.cycles;
+	}
+};
+
+// Functions are named by their first pc. Annotated functions use the start of the annotation.
+// Ops run with nothing on the call stack and outside all functions go to OUTSIDE_FUNCTIONS.
+static const Pointer OUTSIDE_FUNCTIONS = INVALID_POINTER;
+
+struct Call {
+	Pointer caller, call_pc, callee;
+	bool operator<(const Call &o) const {
+		if (caller != o.caller) return caller < o.caller;
+		if (call_pc != o.call_pc) return call_pc < o.call_pc;
+		return callee < o.callee;
+	}
+};
+
+struct CallCost {
+	uint64_t calls = 0;
+	Cost inclusive;
+};
+
+struct CallGraph {
+	std::unordered_map<uint64_t, Cost> self; // Key is function << 32 | pc
+	std::map<Call, CallCost> calls;
+};
+
+Cost cost_since(const Cost &now, const Cost &entry) {
+	Cost c;
+	c.instructions = now.instructions - entry.instructions;
+	c.cycles = now.cycles - entry.cycles;
+	return c;
+}
+
+struct StackFrame {
+	Call call;
+	Pointer return_pc;
+	Cost entry; // Total cost when the call was made
+};
+
+/*
+	Chunks are replayed in parallel so a chunk doesn't know the calls still running when it starts. Ops run
+	with nothing on the chunk's own stack belong to BELOW_CHUNK_START | n, n being the number of
+	returns below the start seen so far. The merge knows the stack the chunk started with and replaces
+	them with the real function and finishes the calls those returns go back to.
+*/
+static const Pointer BELOW_CHUNK_START = 0x80000000;
+
+struct ReturnBelowStart {
+	Pointer target; // INVALID_POINTER for a reset, which ends all calls
+	Cost total;     // Total cost of the chunk when it happened
+};
+
+struct CallGraphChunk {
+	CallGraph graph;
+	std::vector<StackFrame> open; // Calls still running at the end of the chunk
+	std::vector<ReturnBelowStart> returns;
+	Cost total;
+};
+
+struct CallGraphRecorder {
+	CallGraphRecorder(const AnnotationResolver &annotations_, CallGraphChunk &chunk_) : annotations(annotations_), chunk(chunk_), graph(chunk_.graph), stack(chunk_.open), total(chunk_.total) {}
+
+	const AnnotationResolver &annotations;
+	CallGraphChunk &chunk;
+	CallGraph &graph;
+	std::vector<StackFrame> &stack;
+	Cost &total;
+	uint16_t P_before = 0;
+
+	Pointer function(const Pointer pc) {
+		const int f = annotations.function_index(pc);
+		return f == -1 ? pc : annotations._annotations[f].startOfRange;
+	}
+
+	Pointer current_function(const Pointer pc) {
+		if (!stack.empty())
+			return stack.back().call.callee;
+		return BELOW_CHUNK_START | (Pointer)chunk.returns.size();
+	}
+
+	void call(const Pointer pc, const Pointer target, const Pointer return_pc) {
+		if (stack.size() == MAX_CALL_DEPTH) {
+			// Something is not returning the way we expect, forget the oldest call
+			finish(stack.front());
+			stack.erase(stack.begin());
+		}
+		StackFrame frame;
+		frame.call.caller = current_function(pc);
+		frame.call.call_pc = pc;
+		frame.call.callee = function(target);
+		frame.return_pc = return_pc;
+		frame.entry = total;
+		stack.push_back(frame);
+		graph.calls[frame.call].calls++;
+	}
+
+	void finish(const StackFrame &frame) {
+		graph.calls[frame.call].inclusive.add(cost_since(total, frame.entry));
+	}
+
+	// Returns that don't go back to a call on the stack (like pushing an address and using RTS to jump) are ignored.
+	// With nothing on the stack the merge decides if it goes back to a call from before the chunk. A return past
+	// calls of the chunk into calls from before it is ignored.
+	void ret(const Pointer target) {
+		for (size_t i = stack.size(); i-- > 0; ) {
+			if (stack[i].return_pc != target)
+				continue;
+			while (stack.size() > i) {
+				finish(stack.back());
+				stack.pop_back();
+			}
+			return;
+		}
+		if (stack.empty())
+			return_below_start(target);
+	}
+
+	void reset() {
+		while (!stack.empty()) {
+			finish(stack.back());
+			stack.pop_back();
+		}
+		return_below_start(INVALID_POINTER);
+	}
+
+	void return_below_start(const Pointer target) {
+		ReturnBelowStart r;
+		r.target = target;
+		r.total = total;
+		chunk.returns.push_back(r);
+	}
+};
+
+void call_graph_op(Replay &replay, const uint32_t pc, void *context) {
+	CallGraphRecorder &r = *(CallGraphRecorder*)context;
+	const EmulateRegisters &regs = replay.regs;
+	const Events event = regs.event;
+
+	if (event == Events::RESET) {
+		r.reset();
+	} else if (event == Events::NMI || event == Events::IRQ) {
+		r.call(pc, regs._PC, pc);
+	} else {
+		// The op belongs to the function it executed in, also for calls and returns
+		const uint8_t opcode = regs._memory[regs.remap(pc)];
+		Cost cost;
+		cost.instructions = 1;
+		cost.cycles = estimate_cycles(opcode, r.P_before, event == Events::BRANCH);
+		r.graph.self[((uint64_t)r.current_function(pc) << 32) | pc].add(cost);
+		r.total.add(cost);
+
+		if (event == Events::JSR_OR_JSL) {
+			const uint32_t size = opcode == 0x22 ? 4 : 3; // JSL or JSR
+			r.call(pc, regs._PC, (pc & 0xFF0000) | ((pc + size) & 0xFFFF));
+		} else if (event == Events::RTS_OR_RTL || event == Events::RTI) {
+			r.ret(regs._PC);
+		}
+	}
+	r.P_before = regs._P;
+}
+
+// NMIs [nmi_first, nmi_last] on a replay of its own
+void record_call_graph(Replay &replay, const AnnotationResolver &annotations, const uint32_t nmi_first, const uint32_t nmi_last, CallGraphChunk &chunk) {
+	if (!replay.skip_until_nmi(nmi_first))
+		return;
+
+	CallGraphRecorder r(annotations, chunk);
+	r.P_before = replay.regs._P;
+
+	ReplayObserver observer;
+	observer.context = &r;
+	observer.op = call_graph_op;
+	replay.add_observer(observer);
+	while (!replay.nmi_range_done(nmi_last)) {
+		if (!replay.next())
+			break;
+	}
+	replay.remove_observer(&r);
+}
+
+/*
+	Adds the chunks of a trace in order, as if they were replayed by one recorder. The stack of calls still
+	running is carried from one chunk to the next with costs counted from the start of the trace.
+*/
+class CallGraphMerger {
+public:
+	CallGraphMerger(const AnnotationResolver &annotations, CallGraph &graph) : _annotations(annotations), _graph(graph) {}
+
+	void add(const CallGraphChunk &chunk) {
+		// Function of the ops below the start of the chunk after each return below it
+		_below.clear();
+		for (const ReturnBelowStart &r : chunk.returns) {
+			_below.push_back(_stack.empty() ? BELOW_CHUNK_START : _stack.back().call.callee);
+			const Cost now = add_cost(_total, r.total);
+			if (r.target == INVALID_POINTER) {
+				while (!_stack.empty())
+					finish(now);
+				continue;
+			}
+			for (size_t i = _stack.size(); i-- > 0; ) {
+				if (_stack[i].return_pc != r.target)
+					continue;
+				while (_stack.size() > i)
+					finish(now);
+				break;
+			}
+		}
+		_below.push_back(_stack.empty() ? BELOW_CHUNK_START : _stack.back().call.callee);
+
+		for (const auto &s : chunk.graph.self) {
+			const Pointer pc = (Pointer)(s.first & 0xFFFFFFFF);
+			const Pointer function = resolve((Pointer)(s.first >> 32), pc);
+			_graph.self[((uint64_t)function << 32) | pc].add(s.second);
+		}
+		for (const auto &c : chunk.graph.calls) {
+			Call call = c.first;
+			call.caller = resolve(call.caller, call.call_pc);
+			CallCost &cc = _graph.calls[call];
+			cc.calls += c.second.calls;
+			cc.inclusive.add(c.second.inclusive);
+		}
+		for (StackFrame frame : chunk.open) {
+			frame.call.caller = resolve(frame.call.caller, frame.call.call_pc);
+			frame.entry = add_cost(_total, frame.entry);
+			_stack.push_back(frame);
+		}
+		_total.add(chunk.total);
+	}
+
+	// Calls still running are cut off where the range ends
+	void finish_all() {
+		while (!_stack.empty())
+			finish(_total);
+	}
+
+private:
+	static Cost add_cost(Cost a, const Cost &b) {
+		a.add(b);
+		return a;
+	}
+
+	void finish(const Cost &now) {
+		_graph.calls[_stack.back().call].inclusive.add(cost_since(now, _stack.back().entry));
+		_stack.pop_back();
+	}
+
+	Pointer resolve(const Pointer function, const Pointer pc) const {
+		if (function == OUTSIDE_FUNCTIONS || (function & BELOW_CHUNK_START) == 0)
+			return function;
+		const Pointer below = _below[function & ~BELOW_CHUNK_START];
+		if (below != BELOW_CHUNK_START)
+			return below;
+		// Nothing running, same as for the first chunk
+		const int f = _annotations.function_index(pc);
+		return f == -1 ? OUTSIDE_FUNCTIONS : _annotations._annotations[f].startOfRange;
+	}
+
+	const AnnotationResolver &_annotations;
+	CallGraph &_graph;
+	std::vector<StackFrame> _stack;
+	std::vector<Pointer> _below;
+	Cost _total;
+};
+
+void write_function_name(ReportWriter &writer, StringBuilder &sb, const char * const prefix, const AnnotationResolver &annotations, const Pointer function) {
+	sb.clear();
+	if (function == OUTSIDE_FUNCTIONS) {
+		sb.format("%s=(outside functions)\n", prefix);
+	} else {
+		const Annotation *a = nullptr;
+		annotations.resolve_annotation(function, &a);
+		if (a && a->startOfRange == function)
+			sb.format("%s=%s\n", prefix, a->name.c_str());
+		else
+			sb.format("%s=%06X\n", prefix, function);
+	}
+	writer.write(sb.c_str(), (uint32_t)sb.length());
+}
+
+void write_cost(ReportWriter &writer, StringBuilder &sb, const Pointer pc, const Cost &cost) {
+	sb.clear();
+	sb.format("0x%06X %llu %llu\n", pc, (unsigned long long)cost.instructions, (unsigned long long)cost.cycles);
+	writer.write(sb.c_str(), (uint32_t)sb.length());
+}
+
+void write_callgrind(ReportWriter &writer, const AnnotationResolver &annotations, const CallGraph &graph) {
+	StringBuilder sb;
+
+	// Self cost and calls grouped on function, in pc order
+	std::map<Pointer, std::map<Pointer, Cost>> self;
+	Cost total;
+	for (const auto &s : graph.self) {
+		self[(Pointer)(s.first >> 32)][(Pointer)(s.first & 0xFFFFFFFF)] = s.second;
+		total.add(s.second);
+	}
+	std::map<Pointer, std::vector<std::pair<Call, CallCost>>> calls;
+	for (const auto &c : graph.calls) {
+		calls[c.first.caller].push_back(c);
+		self[c.first.caller]; // Callers without cost of their own are listed as well
+	}
+
+	writer.write("# callgrind format\n");
+	writer.write("version: 1\n");
+	writer.write("creator: snestistics\n");
+	writer.write("positions: instr\n");
+	writer.write("events: Instructions Cycles\n");
+	sb.clear();
+	sb.format("summary: %llu %llu\n", (unsigned long long)total.instructions, (unsigned long long)total.cycles);
+	writer.write(sb.c_str(), (uint32_t)sb.length());
+
+	for (const auto &f : self) {
+		writer.write('\n');
+		write_function_name(writer, sb, "fn", annotations, f.first);
+		for (const auto &s : f.second)
+			write_cost(writer, sb, s.first, s.second);
+		for (const std::pair<Call, CallCost> &c : calls[f.first]) {
+			write_function_name(writer, sb, "cfn", annotations, c.first.callee);
+			sb.clear();
+			sb.format("calls=%llu 0x%06X\n", (unsigned long long)c.second.calls, c.first.callee);
+			writer.write(sb.c_str(), (uint32_t)sb.length());
+			write_cost(writer, sb, c.first.call_pc, c.second.inclusive);
+		}
+	}
+}
+}
+
+namespace snestistics {
+
+void call_graph_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations) {
+	CallGraph graph;
+
+	for (const std::string &trace_file : options.trace_files) {
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+		if (!split_nmi_range(trace_file, options.nmi_first, options.nmi_last, CALL_GRAPH_NMIS_PER_CHUNK, ranges))
+			ranges.assign(1, std::make_pair(options.nmi_first, options.nmi_last));
+
+		std::vector<CallGraphChunk> chunks(ranges.size());
+
+		#pragma omp parallel
+		{
+			Replay replay(rom, trace_file.c_str());
+
+			#pragma omp for schedule(dynamic)
+			for (int i = 0; i < (int)ranges.size(); ++i) {
+				record_call_graph(replay, annotations, ranges[i].first, ranges[i].second, chunks[i]);
+			}
+		}
+
+		CallGraphMerger merger(annotations, graph);
+		for (const CallGraphChunk &chunk : chunks)
+			merger.add(chunk);
+		merger.finish_all();
+	}
+
+	ReportWriter writer(options.call_graph_out_file.c_str());
+	ReportWriterProfile profile("Call graph output", writer);
+	write_callgrind(writer, annotations, graph);
+}
+
+}
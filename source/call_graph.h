@@ -0,0 +1,14 @@
+#pragma once
+
+struct Options;
+
+namespace snestistics {
+
+class RomAccessor;
+class AnnotationResolver;
+
+// Dynamic call graph of NMIs [nmi_first, nmi_last] of all traces in callgrind format, with call counts and the
+// exclusive and inclusive cost of each function. Calls are followed with a shadow call stack during replay.
+void call_graph_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations);
+
+}
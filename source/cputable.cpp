@@ -9,6 +9,38 @@ bool jumps[256];
 bool pushpops[256];
 bool jump_or_branch[256];
 
+// Cycles in native mode with 8-bit accumulator and index, branches not taken
+static const uint8_t base_cycles[256] = {
+	8, 6, 8, 4, 5, 3, 5, 6, 3, 2, 2, 4, 6, 4, 6, 5, // 0x00
+	2, 5, 5, 7, 5, 4, 6, 6, 2, 4, 2, 2, 6, 4, 7, 5, // 0x10
+	6, 6, 8, 4, 3, 3, 5, 6, 4, 2, 2, 5, 4, 4, 6, 5, // 0x20
+	2, 5, 5, 7, 4, 4, 6, 6, 2, 4, 2, 2, 4, 4, 7, 5, // 0x30
+	7, 6, 2, 4, 7, 3, 5, 6, 3, 2, 2, 3, 3, 4, 6, 5, // 0x40
+	2, 5, 5, 7, 7, 4, 6, 6, 2, 4, 3, 2, 4, 4, 7, 5, // 0x50
+	6, 6, 6, 4, 3, 3, 5, 6, 4, 2, 2, 6, 5, 4, 6, 5, // 0x60
+	2, 5, 5, 7, 4, 4, 6, 6, 2, 4, 4, 2, 6, 4, 7, 5, // 0x70
+	3, 6, 4, 4, 3, 3, 3, 6, 2, 2, 2, 3, 4, 4, 4, 5, // 0x80
+	2, 6, 5, 7, 4, 4, 4, 6, 2, 5, 2, 2, 4, 5, 5, 5, // 0x90
+	2, 6, 2, 4, 3, 3, 3, 6, 2, 2, 2, 4, 4, 4, 4, 5, // 0xA0
+	2, 5, 5, 7, 4, 4, 4, 6, 2, 4, 2, 2, 4, 4, 4, 5, // 0xB0
+	2, 6, 3, 4, 3, 3, 5, 6, 2, 2, 2, 3, 4, 4, 6, 5, // 0xC0
+	2, 5, 5, 7, 6, 4, 6, 6, 2, 4, 3, 3, 6, 4, 7, 5, // 0xD0
+	2, 6, 3, 4, 3, 3, 5, 6, 2, 2, 2, 3, 4, 4, 6, 5, // 0xE0
+	2, 5, 5, 7, 5, 4, 6, 6, 2, 4, 4, 2, 8, 4, 7, 5, // 0xF0
+};
+
+// Which register width adds cycles to an op
+enum CycleWidth : uint8_t { WIDTH_NONE, WIDTH_MEMORY, WIDTH_MODIFY, WIDTH_INDEX };
+static CycleWidth cycle_width[256];
+
+static bool is_mnemonic(const char * const mnemonic, const char * const list) {
+	for (const char *m = list; *m; m += 4) {
+		if (strncmp(mnemonic, m, 3) == 0)
+			return true;
+	}
+	return false;
+}
+
 void initLookupTables() {
 	for (int ih = 0; ih<256; ih++) {
 		jumps[ih] = false;
@@ -17,6 +49,15 @@ void initLookupTables() {
 		jump_or_branch[ih]=false;
 		pushpops[ih] = false;
 		const char * const i = snestistics::mnemonic_names[ih];
+
+		cycle_width[ih] = WIDTH_NONE;
+		if (is_mnemonic(i, "ORA AND EOR ADC STA LDA CMP SBC BIT STZ PHA PLA "))
+			cycle_width[ih] = WIDTH_MEMORY;
+		else if (is_mnemonic(i, "ASL ROL LSR ROR INC DEC TSB TRB ") && opCodeInfo[ih].adressMode != 0 && opCodeInfo[ih].adressMode != 24)
+			cycle_width[ih] = WIDTH_MODIFY;
+		else if (is_mnemonic(i, "LDX LDY STX STY CPX CPY PHX PHY PLX PLY "))
+			cycle_width[ih] = WIDTH_INDEX;
+
 		if (i[0] == 'J') {
 			jumps[ih] = true;
 			if (strcmp(i, "JMP")==0)
@@ -97,6 +138,17 @@ uint32_t instruction_size(const uint8_t opcode, const bool acc16, const bool ind
 	}
 }
 
+uint32_t estimate_cycles(const uint8_t opcode, const uint16_t P, const bool branch_taken) {
+	uint32_t cycles = base_cycles[opcode];
+	const CycleWidth width = cycle_width[opcode];
+	if (width == WIDTH_MEMORY && is_memory_accumulator_wide(P)) cycles += 1;
+	else if (width == WIDTH_MODIFY && is_memory_accumulator_wide(P)) cycles += 2;
+	else if (width == WIDTH_INDEX && is_index_wide(P)) cycles += 1;
+	if (branch_taken && branches8[opcode] && opcode != 0x80) // BRA is always taken
+		cycles += 1;
+	return cycles;
+}
+
 uint32_t calculateFormattingandSize(const uint8_t * data, const bool acc16, const bool ind16, char * target, char * targetLabel, int * bitmodeNeeded) {
 	const uint8_t opcode = data[0];
 	const int am = opCodeInfo[opcode].adressMode;
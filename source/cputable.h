@@ -395,6 +395,10 @@ uint32_t calculateFormattingandSize(const uint8_t *data, const bool acc16, const
 
 uint32_t instruction_size(const uint8_t opcode, const bool acc16, const bool ind16);
 
+// Cycles for one execution of an op. An estimate; direct page alignment, page crossing, emulation mode and 16-bit
+// index registers in indexed addressing are ignored. MVN/MVP count one byte.
+uint32_t estimate_cycles(const uint8_t opcode, const uint16_t P, const bool branch_taken);
+
 // Jumps, branches but not JSLs
 // If secondary target is set, it is always set to the next op after this op
 bool decode_static_jump(uint8_t opcode, const snestistics::RomAccessor &rom, const Pointer pc, Pointer *target, Pointer *secondary_target);
@@ -0,0 +1,59 @@
+#include "decode.h"
+#include "trace.h"
+#include "rom_accessor.h"
+#include "cputable.h"
+
+namespace snestistics {
+
+void decode_ops(const Trace &trace, const RomAccessor &rom, DecodedOps &decoded) {
+	// Nothing new if every pc is already decoded. Only the size is not enough, another set of ops can have the same size.
+	if (decoded.size() == trace.ops.size()) {
+		size_t index = 0;
+		for (const auto &it : trace.ops) {
+			if (decoded[index].pc != it.first)
+				break;
+			index++;
+		}
+		if (index == decoded.size())
+			return;
+	}
+
+	Profile profile("Decode ops", true);
+
+	// Keep the ops we already have, decode the rest
+	DecodedOps result(trace.ops.size());
+	std::vector<const Trace::OpVariantLookup*> todo(trace.ops.size(), nullptr);
+	size_t old_index = 0, index = 0;
+	for (const auto &it : trace.ops) {
+		while (old_index < decoded.size() && decoded[old_index].pc < it.first)
+			old_index++;
+		if (old_index < decoded.size() && decoded[old_index].pc == it.first) {
+			result[index] = decoded[old_index];
+		} else {
+			result[index].pc = it.first;
+			todo[index] = &it.second;
+		}
+		index++;
+	}
+
+	const int num_ops = (int)result.size();
+	#pragma omp parallel for
+	for (int i = 0; i < num_ops; ++i) {
+		if (!todo[i])
+			continue;
+		DecodedOp &d = result[i];
+		const OpInfo &first_variant = trace.variant(*todo[i], 0);
+		const uint8_t *data = rom.evalPtr(d.pc);
+		d.opcode = data[0];
+		d.adress_mode = (uint8_t)opCodeInfo[d.opcode].adressMode;
+		d.size = (uint8_t)instruction_size(d.opcode, is_memory_accumulator_wide(first_variant.P), is_index_wide(first_variant.P));
+		d.operand = 0;
+		for (int k = d.size - 1; k >= 1; --k)
+			d.operand = (d.operand << 8) | data[k];
+		d.is_jump_or_branch = decode_static_jump(d.opcode, rom, d.pc, &d.jump_target, &d.secondary_target);
+	}
+
+	decoded.swap(result);
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include "utils.h"
+
+/*
+	Every op in a trace decoded once, using the P of its first variant like everything else looking at the trace.
+	predict, guess_range, asm_writer and the branch report read this instead of decoding the ROM themselves.
+*/
+
+namespace snestistics {
+	struct Trace;
+	class RomAccessor;
+
+	struct DecodedOp {
+		Pointer pc;
+		Pointer jump_target;      // See decode_static_jump, INVALID_POINTER if not known
+		Pointer secondary_target; // Next op for conditional branches, INVALID_POINTER otherwise
+		uint32_t operand;         // Operand bytes (size-1 of them), little endian
+		uint8_t opcode;
+		uint8_t size;
+		uint8_t adress_mode;
+		bool is_jump_or_branch;   // Return value of decode_static_jump
+	};
+
+	// Same order as Trace::ops
+	typedef std::vector<DecodedOp> DecodedOps;
+
+	// Decodes the ops of trace not already in decoded, so it can be called again after ops have been added
+	void decode_ops(const Trace &trace, const RomAccessor &rom, DecodedOps &decoded);
+}
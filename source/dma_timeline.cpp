@@ -0,0 +1,217 @@
+#include "dma_timeline.h"
+#include "annotations.h"
+#include "options.h"
+#include "replay.h"
+#include "report_writer.h"
+#include "trace.h"
+#include <algorithm>
+#include <map>
+
+using namespace snestistics;
+
+namespace {
+
+static const uint32_t DMA_TIMELINE_NMIS_PER_CHUNK = 100;
+
+struct DmaEvent {
+	uint32_t nmi;
+	DmaTransfer dma;
+};
+
+struct DmaChunk {
+	std::vector<DmaEvent> events; // In the order they happened
+	uint32_t nmi_first = 0, nmi_end = 0; // NMIs replayed
+};
+
+void timeline_dma(Replay &replay, const DmaTransfer &dma, void *context) {
+	DmaChunk &chunk = *(DmaChunk*)context;
+	if (replay.current_nmi() == 0)
+		return; // Reset and init before the first NMI belong to no NMI
+	DmaEvent e;
+	e.nmi = replay.current_nmi() - 1; // NMI n has started
+	e.dma = dma;
+	chunk.events.push_back(e);
+}
+
+// NMIs [nmi_first, nmi_last] on a replay of its own
+void record_dma_timeline(Replay &replay, const uint32_t nmi_first, const uint32_t nmi_last, DmaChunk &chunk) {
+	chunk.nmi_first = chunk.nmi_end = nmi_first;
+	if (!replay.skip_until_nmi(nmi_first))
+		return;
+
+	ReplayObserver observer;
+	observer.context = &chunk;
+	observer.dma = timeline_dma;
+	replay.add_observer(observer);
+	while (!replay.nmi_range_done(nmi_last)) {
+		if (!replay.next())
+			break;
+	}
+	replay.remove_observer(&chunk);
+	chunk.nmi_end = replay.current_nmi();
+}
+
+// Totals for something transfers are grouped on, and the NMI where it transferred the most
+struct Bandwidth {
+	uint64_t transfers = 0, bytes = 0;
+	uint64_t nmi_bytes = 0, max_bytes = 0;
+	uint32_t nmi = 0, max_nmi = 0;
+
+	void add(const uint32_t at_nmi, const uint32_t num_bytes) {
+		if (transfers == 0 || at_nmi != nmi) {
+			nmi = at_nmi;
+			nmi_bytes = 0;
+		}
+		transfers++;
+		bytes += num_bytes;
+		nmi_bytes += num_bytes;
+		if (nmi_bytes > max_bytes) {
+			max_bytes = nmi_bytes;
+			max_nmi = nmi;
+		}
+	}
+};
+
+void write_bandwidth(ReportWriter &writer, StringBuilder &sb, const char * const name, const Bandwidth &b, const uint32_t num_nmis) {
+	sb.format("%-32s %10llu %12llu %10llu %10llu %8u", name, (unsigned long long)b.transfers, (unsigned long long)b.bytes,
+		(unsigned long long)(num_nmis ? b.bytes / num_nmis : 0), (unsigned long long)b.max_bytes, b.max_nmi);
+	writer.writeComment(sb);
+}
+
+void write_bandwidth_header(ReportWriter &writer, const char * const title, const char * const grouped_on) {
+	StringBuilder sb;
+	writer.writeSeperator(title);
+	sb.format("%-32s %10s %12s %10s %10s %8s", grouped_on, "Transfers", "Bytes", "Per NMI", "Most", "In NMI");
+	writer.writeComment(sb);
+}
+
+// Name of a B-bus register from the hardware annotations
+std::string b_bus_name(const AnnotationResolver &annotations, const uint8_t b_address) {
+	const Pointer address = 0x2100 | b_address;
+	const Annotation *a = annotations.resolve_annotation(address);
+	StringBuilder sb;
+	if (a && a->startOfRange == address)
+		sb.format("$%04X %s", address, a->name.c_str());
+	else
+		sb.format("$%04X", address);
+	return sb.c_str();
+}
+
+void write_report(ReportWriter &writer, const AnnotationResolver &annotations, const std::vector<DmaChunk> &chunks) {
+	StringBuilder sb;
+
+	uint32_t num_nmis = 0;
+	Bandwidth total, channels[8], targets[256];
+	std::map<int, Bandwidth> functions;
+
+	for (const DmaChunk &chunk : chunks) {
+		num_nmis += chunk.nmi_end - chunk.nmi_first;
+		for (const DmaEvent &e : chunk.events) {
+			const uint32_t bytes = e.dma.num_bytes();
+			total.add(e.nmi, bytes);
+			channels[e.dma.channel & 7].add(e.nmi, bytes);
+			targets[e.dma.b_address].add(e.nmi, bytes);
+			functions[annotations.function_index(e.dma.pc)].add(e.nmi, bytes);
+		}
+	}
+
+	writer.writeSeperator("DMA bandwidth");
+	writer.writeComment("Bytes are what the DMA registers asked for. HDMA is counted as a transfer without bytes.");
+	writer.writeComment("");
+	sb.format("%u NMIs, %llu transfers, %llu bytes, %llu bytes per NMI on average", num_nmis, (unsigned long long)total.transfers,
+		(unsigned long long)total.bytes, (unsigned long long)(num_nmis ? total.bytes / num_nmis : 0));
+	writer.writeComment(sb);
+	if (total.transfers != 0) {
+		sb.format("Most bytes in NMI %u with %llu bytes", total.max_nmi, (unsigned long long)total.max_bytes);
+		writer.writeComment(sb);
+	}
+
+	write_bandwidth_header(writer, "DMA per channel", "Channel");
+	for (int c = 0; c < 8; ++c) {
+		if (channels[c].transfers == 0)
+			continue;
+		char name[16];
+		sprintf(name, "%d", c);
+		write_bandwidth(writer, sb, name, channels[c], num_nmis);
+	}
+
+	write_bandwidth_header(writer, "DMA per B-bus target", "Target");
+	for (int t = 0; t < 256; ++t) {
+		if (targets[t].transfers != 0)
+			write_bandwidth(writer, sb, b_bus_name(annotations, (uint8_t)t).c_str(), targets[t], num_nmis);
+	}
+
+	write_bandwidth_header(writer, "DMA per function", "Function");
+	std::vector<std::pair<int, Bandwidth>> sorted(functions.begin(), functions.end());
+	std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<int, Bandwidth> &a, const std::pair<int, Bandwidth> &b) {
+		return a.second.bytes > b.second.bytes;
+	});
+	for (const std::pair<int, Bandwidth> &f : sorted)
+		write_bandwidth(writer, sb, f.first == -1 ? "(outside functions)" : annotations._annotations[f.first].name.c_str(), f.second, num_nmis);
+
+	writer.writeSeperator("DMA timeline");
+	std::vector<std::string> b_names(256);
+	for (const DmaChunk &chunk : chunks) {
+		for (size_t i = 0; i < chunk.events.size(); ) {
+			const uint32_t nmi = chunk.events[i].nmi;
+			size_t end = i;
+			uint64_t bytes = 0;
+			for (; end < chunk.events.size() && chunk.events[end].nmi == nmi; ++end)
+				bytes += chunk.events[end].dma.num_bytes();
+			sb.format("NMI %u: %d transfers, %llu bytes", nmi, (int)(end - i), (unsigned long long)bytes);
+			writer.writeComment(sb);
+
+			for (; i < end; ++i) {
+				const DmaTransfer &d = chunk.events[i].dma;
+				std::string &b_name = b_names[d.b_address];
+				if (b_name.empty())
+					b_name = b_bus_name(annotations, d.b_address);
+				const int f = annotations.function_index(d.pc);
+				const bool reverse = (d.flags & DmaTransfer::REVERSE_TRANSFER) != 0;
+				sb.format("    ch%d ", d.channel);
+				if (reverse)
+					sb.format("%s -> %02X:%04X", b_name.c_str(), d.a_bank, d.a_address);
+				else
+					sb.format("%02X:%04X -> %s", d.a_bank, d.a_address, b_name.c_str());
+				if (d.flags & DmaTransfer::HDMA)
+					sb.format(" HDMA mode %d%s", d.transfer_mode, (d.flags & DmaTransfer::HDMA_INDIRECT) ? " indirect" : "");
+				else
+					sb.format(" %u bytes mode %d", d.num_bytes(), d.transfer_mode);
+				if (d.flags & DmaTransfer::A_ADDRESS_FIXED) sb.format(" fixed");
+				else if (d.flags & DmaTransfer::A_ADDRESS_DECREMENT) sb.format(" decrement");
+				sb.format(" from %s (%06X)", f == -1 ? "?" : annotations._annotations[f].name.c_str(), d.pc);
+				writer.writeComment(sb);
+			}
+		}
+	}
+}
+}
+
+namespace snestistics {
+
+void dma_timeline_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations) {
+	const std::string &trace_file = options.trace_files[0];
+
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+	if (!split_nmi_range(trace_file, options.nmi_first, options.nmi_last, DMA_TIMELINE_NMIS_PER_CHUNK, ranges))
+		ranges.assign(1, std::make_pair(options.nmi_first, options.nmi_last));
+
+	// Only DMA events are kept so all chunks fit in memory at once
+	std::vector<DmaChunk> chunks(ranges.size());
+
+	#pragma omp parallel
+	{
+		Replay replay(rom, trace_file.c_str());
+
+		#pragma omp for schedule(dynamic)
+		for (int i = 0; i < (int)ranges.size(); ++i) {
+			record_dma_timeline(replay, ranges[i].first, ranges[i].second, chunks[i]);
+		}
+	}
+
+	ReportWriter writer(options.dma_timeline_out_file.c_str());
+	ReportWriterProfile profile("DMA timeline output", writer);
+	write_report(writer, annotations, chunks);
+}
+
+}
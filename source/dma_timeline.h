@@ -0,0 +1,14 @@
+#pragma once
+
+struct Options;
+
+namespace snestistics {
+
+class RomAccessor;
+class AnnotationResolver;
+
+// Report of every DMA transfer started in NMIs [nmi_first, nmi_last] with bandwidth per NMI, channel and function.
+// NMI ranges are replayed in parallel when the trace has an emulation cache.
+void dma_timeline_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations);
+
+}
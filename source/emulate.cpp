@@ -1035,81 +1035,107 @@ void execute_irq(EmulateRegisters &regs) {
 template<int IDX, typename T>
 bool bit(const T t) { return (t >> IDX)&1; }
 
+// Offset added to the B-bus address for each byte of a transfer unit, per transfer mode
+static const uint8_t dma_b_offsets[8][4] = {
+	{0,0,0,0}, {0,1,0,1}, {0,0,0,0}, {0,0,1,1}, {0,1,2,3}, {0,1,0,1}, {0,0,0,0}, {0,0,1,1},
+};
+
+inline bool is_wram_port(const uint8_t b_address) { return b_address >= 0x80 && b_address <= 0x83; }
+
+// DMA/HDMA channel registers as a DmaTransfer for the observers
+DmaTransfer dma_transfer(const EmulateRegisters &regs, const int channel) {
+	const uint32_t b = 0x4300|(channel<<4);
+	const uint8_t params = regs._memory[b|0];
+
+	DmaTransfer d;
+	d.b_address = regs._memory[b|1];
+	d.a_address = (regs._memory[b|3]<<8)|regs._memory[b|2];
+	d.a_bank = regs._memory[b|4];
+	d.transfer_bytes = (regs._memory[b|6]<<8)|regs._memory[b|5];
+	d.transfer_mode = params & 7;
+	d.channel = channel;
+	d.pc = regs._PC_before;
+	d.flags = 0;
+	d.wram = regs._WRAM;
+
+	if (bit<4>(params)) d.flags |= DmaTransfer::A_ADDRESS_DECREMENT;
+	if (bit<3>(params)) d.flags |= DmaTransfer::A_ADDRESS_FIXED;
+	if (bit<7>(params)) d.flags |= DmaTransfer::REVERSE_TRANSFER;
+	return d;
+}
+
+/*
+	Only what ends up in WRAM is emulated, that is transfers through the WRAM ports $2180-$2183.
+	PPU->CPU transfers read registers that are not emulated, so what they write comes from DMA events in the trace.
+	Like on hardware the A-bus address wraps within its bank and the channel registers are left where the transfer ended.
+*/
 void execute_dma(EmulateRegisters & regs, uint8_t channels) {
 	for (int channel=0; channel<8; channel++) {
 		if ((channels & (1<<channel))==0)
 			continue;
 
-		const uint32_t bc = channel<<4;
-		const uint32_t b = 0x4300|bc;
-
-		const uint8_t params = regs._memory[b|0];
-		const bool reverse_transfer = bit<7>(params);
-		const bool type = bit<6>(params);
-		const bool decrement = bit<4>(params);
-		const uint8_t transfer_mode = params & 7;
-		const bool fixed = bit<3>(params);
-
-		const uint16_t a_address = (regs._memory[b|3]<<8)|regs._memory[b|2];
-		const uint8_t b_address = regs._memory[b|1];
-		const uint8_t a_bank = regs._memory[b|4];
-		const uint32_t transfer_bytes = (regs._memory[b|6]<<8)|regs._memory[b|5];
-		
-		if (regs._dma_function) {
-			DmaTransfer d;
-
-			d.b_address = b_address;
-			d.a_address = a_address;
-			d.a_bank = a_bank;
-			d.transfer_bytes = transfer_bytes;
-			d.transfer_mode = transfer_mode;
-			d.channel = channel;
-			d.pc = regs._PC_before;
-			d.flags = 0;
-			d.wram= regs._WRAM;
-			
-			if (decrement) d.flags |= DmaTransfer::A_ADDRESS_DECREMENT;
-			if (fixed) d.flags |= DmaTransfer::A_ADDRESS_FIXED;
-			if (reverse_transfer) d.flags |= DmaTransfer::REVERSE_TRANSFER;
+		const DmaTransfer d = dma_transfer(regs, channel);
 
+		if (regs._dma_function)
 			regs._dma_function(regs._callback_context, d);
-		}
-
-		// Ignore everything but CPU->$2180 DMA for now
-		// Also filter invalid source for 2180 target (7E or 7F)
-		if (a_bank == 0x7E || a_bank == 0x7F || b_address != 0x80 || reverse_transfer)
-			continue;
-		bool skip_wram_dma = (!(a_bank & 0x40) && a_address < 0x2000);
-		if (skip_wram_dma)
-			continue;
 
-		if (reverse_transfer) {
-			printf("Error! Emulator does not support DMA from PPU->CPU!\n");
-			printf("Progress of this feature is tracked in https://github.com/breakin/snestistics/issues/9\n");
-			exit(1);
+		const uint32_t b = 0x4300|(channel<<4);
+		const uint32_t num_transfer = d.transfer_bytes == 0 ? 0x10000 : d.transfer_bytes;
+		const int delta = (d.flags & DmaTransfer::A_ADDRESS_FIXED) ? 0 : ((d.flags & DmaTransfer::A_ADDRESS_DECREMENT) ? -1 : 1);
+		const uint8_t * const b_offsets = dma_b_offsets[d.transfer_mode];
+
+		bool uses_wram_port = false;
+		for (int k = 0; k < 4; ++k)
+			uses_wram_port |= is_wram_port((uint8_t)(d.b_address + b_offsets[k]));
+
+		// WRAM can't be both source and target, such bytes are not written
+		const bool a_is_wram = d.a_bank == 0x7E || d.a_bank == 0x7F || (!(d.a_bank & 0x40) && d.a_address < 0x2000);
+		const bool reverse = (d.flags & DmaTransfer::REVERSE_TRANSFER) != 0;
+
+		uint16_t a_address = d.a_address;
+		if (uses_wram_port) {
+			for (uint32_t k=0; k<num_transfer; k++) {
+				const uint8_t b_address = (uint8_t)(d.b_address + b_offsets[k & 3]);
+				if (!reverse && b_address == 0x80) {
+					if (!a_is_wram) {
+						regs.write_dma_byte(0x7E0000+regs._WRAM, regs._memory[regs.remap((d.a_bank<<16)|a_address)]);
+						regs._WRAM = (regs._WRAM + 1) & 0x1ffff;
+					}
+				} else if (!reverse && is_wram_port(b_address)) {
+					regs.special_write_a(0x2100|b_address, regs._memory[regs.remap((d.a_bank<<16)|a_address)]);
+				} else if (reverse && b_address == 0x80) {
+					// WRAM to the A-bus, which is never WRAM and not kept
+					regs._WRAM = (regs._WRAM + 1) & 0x1ffff;
+				}
+				a_address = (uint16_t)(a_address + delta);
+			}
+		} else {
+			a_address = (uint16_t)(a_address + delta * (int)num_transfer);
 		}
 
-		const uint32_t num_transfer = transfer_bytes == 0 ? 0x10000 : transfer_bytes;
-
-		uint32_t source = (a_bank<<16)|a_address;
-		uint32_t wram = regs._WRAM;
-
-		const int delta = fixed ? 0 : (decrement ? -1 : 1);
-
-		if (transfer_mode != 0) {
-			printf("Error! Emulator does not support DMA from CPU->WRAM through $2180 with transfer mode = %d\n", transfer_mode);
-			exit(1);
-		}
+		regs._memory[b|2] = a_address & 0xFF;
+		regs._memory[b|3] = a_address >> 8;
+		regs._memory[b|5] = 0;
+		regs._memory[b|6] = 0;
+	}
+}
 
-		for (uint32_t k=0; k<num_transfer; k++) {
-			uint32_t s = regs.remap(source);
-			source += delta;
-			uint32_t d = regs.remap(0x7E0000+wram);
-			wram=(wram+1)&0x1ffff;
-			uint8_t db = d>>16;
-			regs._memory[d] = regs._memory[s];
-		}
-		regs._WRAM = wram;
+/*
+	HDMA runs on every scanline which the replay does not know about. Channels that are enabled are reported to the
+	observers with their table address, writes into WRAM come from DMA events in the trace.
+*/
+void execute_hdma(EmulateRegisters & regs, uint8_t channels) {
+	if (!regs._dma_function)
+		return;
+	for (int channel=0; channel<8; channel++) {
+		if ((channels & (1<<channel))==0)
+			continue;
+		DmaTransfer d = dma_transfer(regs, channel);
+		d.flags &= ~(DmaTransfer::A_ADDRESS_DECREMENT|DmaTransfer::A_ADDRESS_FIXED);
+		d.flags |= DmaTransfer::HDMA;
+		if (bit<6>(regs._memory[(0x4300|(channel<<4))|0])) d.flags |= DmaTransfer::HDMA_INDIRECT;
+		d.transfer_bytes = 0;
+		regs._dma_function(regs._callback_context, d);
 	}
 }
 }
@@ -55,6 +55,7 @@ enum class MemoryAccessType {
 
 struct EmulateRegisters;
 void execute_dma(EmulateRegisters &regs, uint8_t channels);
+void execute_hdma(EmulateRegisters &regs, uint8_t channels);
 
 struct EmulateRegisters {
 	Events event = Events::NONE;
@@ -273,6 +274,8 @@ struct EmulateRegisters {
 	void special_write_b(uint32_t r, uint8_t v) {
 		if (r == 0x420b) {
 			execute_dma(*this, v);
+		} else if (r == 0x420c) {
+			execute_hdma(*this, v);
 		}
 	}
 
@@ -301,6 +304,19 @@ struct EmulateRegisters {
 		_memory[r] = v;
 	}
 
+	// Memory written by DMA. Like for ops only WRAM is kept, DMA never triggers memory mapped registers here.
+	inline void write_dma_byte(uint32_t address, uint8_t v) {
+		uint32_t r = remap(address);
+		uint8_t bank = r>>16;
+		if (bank != 0x7E && bank != 0x7F)
+			return;
+
+		if(_write_function)
+			(*_write_function)(_callback_context, address, r, v, 1, MemoryAccessType::DMA_WRITE);
+
+		_memory[r] = v;
+	}
+
 	EmulateRegisters(const snestistics::RomAccessor &rom) {
 		// Duplicated bytes for mirrored/shared mem
 		// These are reads to memory other than ROM/SRAM (outside what we emulate)
@@ -354,5 +370,6 @@ void execute_op(EmulateRegisters &regs);
 void execute_nmi(EmulateRegisters &regs);
 void execute_irq(EmulateRegisters &regs);
 void execute_dma(EmulateRegisters &regs, uint8_t channels);
+void execute_hdma(EmulateRegisters &regs, uint8_t channels);
 
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "frame_budget.h"
+#include "annotations.h"
+#include "cputable.h"
+#include "options.h"
+#include "replay.h"
+#include "report_writer.h"
+#include "trace.h"
+#include <algorithm>
+
+using namespace snestistics;
+
+namespace {
+
+static const uint32_t FRAME_BUDGET_NMIS_PER_CHUNK = 100;
+static const uint32_t FRAME_BUDGET_CHUNKS_PER_BATCH = 32;
+
+struct Budget {
+	uint64_t instructions = 0, cycles = 0, dma_bytes = 0;
+
+	void add(const Budget &o) {
+		instructions += o.instructions;
+		cycles += o.cycles;
+		dma_bytes += o.dma_bytes;
+	}
+};
+
+struct NmiBudget {
+	uint32_t nmi;
+	Budget total;
+	std::vector<std::pair<int, Budget>> functions; // Sorted on function, -1 is outside functions
+};
+
+struct BudgetRecorder {
+	BudgetRecorder(const AnnotationResolver &annotations_, std::vector<NmiBudget> &result_) : annotations(annotations_), current(annotations_._annotations.size() + 1), is_touched(current.size(), false), result(result_) {}
+
+	const AnnotationResolver &annotations;
+	std::vector<Budget> current; // For the current NMI, index is function + 1
+	std::vector<bool> is_touched; // Same index as current, HDMA can touch a function without adding anything
+	std::vector<int> touched;
+	std::vector<NmiBudget> &result;
+	uint32_t nmi = 0;
+	uint16_t P_before = 0;
+
+	Budget &function(const Pointer pc) {
+		const int f = annotations.function_index(pc);
+		if (!is_touched[f + 1]) {
+			is_touched[f + 1] = true;
+			touched.push_back(f);
+		}
+		return current[f + 1];
+	}
+
+	void flush() {
+		if (touched.empty())
+			return;
+		std::sort(touched.begin(), touched.end());
+		result.resize(result.size() + 1);
+		NmiBudget &n = result.back();
+		n.nmi = nmi;
+		for (const int f : touched) {
+			Budget &b = current[f + 1];
+			n.total.add(b);
+			n.functions.push_back(std::make_pair(f, b));
+			b = Budget();
+			is_touched[f + 1] = false;
+		}
+		touched.clear();
+	}
+};
+
+void budget_op(Replay &replay, const uint32_t pc, void *context) {
+	BudgetRecorder &r = *(BudgetRecorder*)context;
+	const EmulateRegisters &regs = replay.regs;
+
+	// Ops after NMI n has started have current_nmi n+1. Reset and init before the first NMI belong to no NMI.
+	const bool in_nmi = replay.current_nmi() != 0;
+	const uint32_t nmi = replay.current_nmi() - 1;
+	if (in_nmi && nmi != r.nmi) {
+		r.flush();
+		r.nmi = nmi;
+	}
+
+	if (in_nmi && regs.event != Events::NMI && regs.event != Events::IRQ && regs.event != Events::RESET) {
+		const uint8_t opcode = regs._memory[regs.remap(pc)];
+		Budget &b = r.function(pc);
+		b.instructions++;
+		b.cycles += estimate_cycles(opcode, r.P_before, regs.event == Events::BRANCH);
+	}
+	r.P_before = regs._P;
+}
+
+void budget_dma(Replay &replay, const DmaTransfer &dma, void *context) {
+	BudgetRecorder &r = *(BudgetRecorder*)context;
+	if (replay.current_nmi() != 0)
+		r.function(dma.pc).dma_bytes += dma.num_bytes();
+}
+
+// NMIs [nmi_first, nmi_last] on a replay of its own
+void record_budget(Replay &replay, const AnnotationResolver &annotations, const uint32_t nmi_first, const uint32_t nmi_last, std::vector<NmiBudget> &result) {
+	if (!replay.skip_until_nmi(nmi_first))
+		return;
+
+	BudgetRecorder r(annotations, result);
+	r.nmi = nmi_first;
+	r.P_before = replay.regs._P;
+
+	ReplayObserver observer;
+	observer.context = &r;
+	observer.op = budget_op;
+	observer.dma = budget_dma;
+	replay.add_observer(observer);
+	while (!replay.nmi_range_done(nmi_last)) {
+		if (!replay.next())
+			break;
+	}
+	replay.remove_observer(&r);
+	r.flush();
+}
+
+void write_budget(ReportWriter &writer, StringBuilder &sb, const uint32_t nmi, const char * const function, const Budget &b) {
+	sb.clear();
+	sb.format("%u,%s,%llu,%llu,%llu\n", nmi, function, (unsigned long long)b.instructions, (unsigned long long)b.cycles, (unsigned long long)b.dma_bytes);
+	writer.write(sb.c_str(), (uint32_t)sb.length());
+}
+}
+
+namespace snestistics {
+
+void frame_budget_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations) {
+	const std::string &trace_file = options.trace_files[0];
+
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+	if (!split_nmi_range(trace_file, options.nmi_first, options.nmi_last, FRAME_BUDGET_NMIS_PER_CHUNK, ranges))
+		ranges.assign(1, std::make_pair(options.nmi_first, options.nmi_last));
+
+	ReportWriter writer(options.frame_budget_out_file.c_str());
+	ReportWriterProfile profile("Frame budget output", writer);
+	writer.write("nmi,function,instructions,cycles,dma_bytes\n");
+
+	StringBuilder sb;
+
+	for (size_t batch = 0; batch < ranges.size(); batch += FRAME_BUDGET_CHUNKS_PER_BATCH) {
+		const int batch_first = (int)batch;
+		const int batch_end = (int)std::min(ranges.size(), batch + FRAME_BUDGET_CHUNKS_PER_BATCH);
+
+		std::vector<std::vector<NmiBudget>> chunks(batch_end - batch_first);
+
+		#pragma omp parallel
+		{
+			Replay replay(rom, trace_file.c_str());
+
+			#pragma omp for schedule(dynamic)
+			for (int i = batch_first; i < batch_end; ++i) {
+				record_budget(replay, annotations, ranges[i].first, ranges[i].second, chunks[i - batch_first]);
+			}
+		}
+
+		// Total first, then each function that executed
+		for (const std::vector<NmiBudget> &chunk : chunks) {
+			for (const NmiBudget &n : chunk) {
+				write_budget(writer, sb, n.nmi, "(total)", n.total);
+				for (const std::pair<int, Budget> &f : n.functions)
+					write_budget(writer, sb, n.nmi, f.first == -1 ? "(outside functions)" : annotations._annotations[f.first].name.c_str(), f.second);
+			}
+		}
+	}
+}
+
+}
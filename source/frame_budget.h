@@ -0,0 +1,14 @@
+#pragma once
+
+struct Options;
+
+namespace snestistics {
+
+class RomAccessor;
+class AnnotationResolver;
+
+// CSV with instructions, estimated cycles and DMA bytes for each NMI in [nmi_first, nmi_last], in total and per function.
+// NMI ranges are replayed in parallel when the trace has an emulation cache.
+void frame_budget_report(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations);
+
+}
@@ -31,6 +31,9 @@ namespace {
 		printf("                                                Default: 0.\n");
 		printf(" -tracefile (--t) <filename>                    Trace file from an emulation session.\n");
 		printf("                                                Multiple allowed for assembly source listing.\n");
+		printf(" -traceexpression (--te) <text>                 Combine the -tracefile files with set algebra instead of merging them all, like (1|2)-0.\n");
+		printf("                                                Traces are numbered from 0 in the order given.\n");
+		printf("                                                | is union, & is intersection and - is difference.\n");
 		printf(" -nmifirst (--n0) <number>                      First NMI to consider for trace log.\n");
 		printf("                                                Default: 0.\n");
 		printf(" -nmilast (--n1) <number>                       Last NMI to consider for trace log.\n");
@@ -38,17 +41,39 @@ namespace {
 		printf(" -tracelogoutfile (--tl) <filename>             Generate trace log.\n");
 		printf("                                                Nmi range can be controlled using -nmifirst and -nmilast.\n");
 		printf("                                                Custom printing can be done using scripting.\n");
+		printf(" -traceloginclude (--tli) <text>                Only log functions with this name or starting in this hex range (like 808000-80FFFF).\n");
+		printf("                                                Multiple allowed.\n");
+		printf("                                                Code outside functions is then not logged.\n");
+		printf(" -tracelogexclude (--tle) <text>                Do not log functions with this name or starting in this hex range.\n");
+		printf("                                                Multiple allowed.\n");
+		printf("                                                Wins over -traceloginclude.\n");
+		printf(" -tracelogbinaryoutfile (--tlb) <filename>      Generate binary trace log.\n");
+		printf("                                                Much smaller and faster to write than -tracelogoutfile and indexed by NMI and function.\n");
+		printf("                                                Use -tracelogrenderfile to turn it into text.\n");
+		printf(" -tracelogrenderfile (--tlr) <filename>         Binary trace log to render as text into -renderedtracelogoutfile.\n");
+		printf("                                                Only NMIs -nmifirst to -nmilast are rendered.\n");
+		printf("                                                Needs no ROM or trace.\n");
+		printf(" -renderedtracelogoutfile (--rtl) <filename>    Text trace log rendered from -tracelogrenderfile.\n");
 		printf(" -scriptfile (--s) <filename>                   A squirrel script.\n");
 		printf("                                                See user guide for scripting reference.\n");
+		printf(" -pluginfile (--pl) <filename>                  A native plugin (shared library) run on NMIs -nmifirst to -nmilast.\n");
+		printf("                                                Multiple allowed.\n");
+		printf("                                                See user guide for the plugin interface.\n");
+		printf(" -pluginargument (--pla) <text>                 Passed on to every -pluginfile when it is initialized.\n");
 		printf(" -labelsfile (--l) <filename>                   A file containing annotations.\n");
 		printf("                                                Custom file format.\n");
 		printf(" -autolabelsfile (--al) <filename>              A file containing annotations.\n");
 		printf("                                                It will be regenerated if missing or if -autoannotate is specified.\n");
 		printf(" -autoannotate (--aa) <true|false>              A file where automatically generated annotations are stored.\n");
+		printf(" -labelscachefile (--lc) <filename>             Finalized annotations from -labelsfile and -autolabelsfile are stored here and reused while none of the files change.\n");
 		printf(" -symbolfmaoutfile (--sf) <filename>            Generate symbols file in FMA format compatible with bsnes-plus.\n");
-		printf(" -symbolmesensoutfile (--sm) <filename>          Generate symbols file in Mesen format compatible with Mesen emulator.\n");
+		printf(" -symbolmesensoutfile (--sm) <filename>         Generate symbols file in Mesen format compatible with Mesen emulator.\n");
 		printf(" -rewindoutfile (--rw) <filename>               Generate rewind report in dot file format.\n");
 		printf("                                                Use graphviz to generate PDF/PNG report.\n");
+		printf(" -framebudgetoutfile (--fb) <filename>          CSV with instructions, estimated cycles and DMA bytes for each NMI from -nmifirst to -nmilast, in total and per function.\n");
+		printf(" -callgraphoutfile (--cg) <filename>            Call graph in callgrind format with call counts and exclusive and inclusive cost of each function for NMIs -nmifirst to -nmilast of all -tracefile files.\n");
+		printf("                                                Open it in a profile viewer such as KCachegrind.\n");
+		printf(" -dmatimelineoutfile (--dt) <filename>          Report with every DMA transfer in NMIs -nmifirst to -nmilast and bandwidth per NMI, channel, target and function.\n");
 		printf(" -reportoutfile (--rp) <filename>               Generate assembly report.\n");
 		printf("                                                Companion file to -asmoutfile.\n");
 		printf(" -asmoutfile (--a) <filename>                   Generate assembly listing.\n");
@@ -58,6 +83,7 @@ namespace {
 		printf(" -asmprintregistersizes (--ars) <true|false>    Print registers sizes in assembly source listing.\n");
 		printf(" -asmprintdb (--adb) <true|false>               Print data bank in assembly source listing.\n");
 		printf(" -asmprintdp (--adp) <true|false>               Print direct page in assembly source listing.\n");
+		printf(" -asmprintcounts (--acn) <true|false>           Print how many times each op was executed in assembly source listing.\n");
 		printf(" -asmlowercaseop <true|false>                   Print lower-case opcode in assembly source listing.\n");
 		printf(" -asmcorrectwla <true|false>                    Make sure generated source compiled in WLA DX.\n");
 		printf(" -predict (--p) <never|*functions*|everywhere>  This setting specify where snestistics is allowed to predict code.\n");
@@ -91,6 +117,9 @@ void parse_options(const int argc, const char * const argv[], Options &options)
 			options.trace_files.push_back(opt);
 			need_rom = true;
 			k++;
+		} else if (strcmp(cmd, "traceexpression")==0 || strcmp(cmd, "-te")==0) {
+			options.trace_expression = opt;
+			k++;
 		} else if (strcmp(cmd, "nmifirst")==0 || strcmp(cmd, "-n0")==0) {
 			options.nmi_first = parse_uint(opt, error);
 			k++;
@@ -102,9 +131,34 @@ void parse_options(const int argc, const char * const argv[], Options &options)
 			need_single_trace = true;
 			need_trace = true;
 			k++;
+		} else if (strcmp(cmd, "traceloginclude")==0 || strcmp(cmd, "-tli")==0) {
+			options.trace_log_includes.push_back(opt);
+			k++;
+		} else if (strcmp(cmd, "tracelogexclude")==0 || strcmp(cmd, "-tle")==0) {
+			options.trace_log_excludes.push_back(opt);
+			k++;
+		} else if (strcmp(cmd, "tracelogbinaryoutfile")==0 || strcmp(cmd, "-tlb")==0) {
+			options.trace_log_binary_out_file = opt;
+			need_single_trace = true;
+			need_trace = true;
+			k++;
+		} else if (strcmp(cmd, "tracelogrenderfile")==0 || strcmp(cmd, "-tlr")==0) {
+			options.trace_log_render_file = opt;
+			k++;
+		} else if (strcmp(cmd, "renderedtracelogoutfile")==0 || strcmp(cmd, "-rtl")==0) {
+			options.rendered_trace_log_out_file = opt;
+			k++;
 		} else if (strcmp(cmd, "scriptfile")==0 || strcmp(cmd, "-s")==0) {
 			options.script_file = opt;
 			k++;
+		} else if (strcmp(cmd, "pluginfile")==0 || strcmp(cmd, "-pl")==0) {
+			options.plugin_files.push_back(opt);
+			need_single_trace = true;
+			need_trace = true;
+			k++;
+		} else if (strcmp(cmd, "pluginargument")==0 || strcmp(cmd, "-pla")==0) {
+			options.plugin_argument = opt;
+			k++;
 		} else if (strcmp(cmd, "labelsfile")==0 || strcmp(cmd, "-l")==0) {
 			options.labels_files.push_back(opt);
 			k++;
@@ -114,6 +168,9 @@ void parse_options(const int argc, const char * const argv[], Options &options)
 		} else if (strcmp(cmd, "autoannotate")==0 || strcmp(cmd, "-aa")==0) {
 			options.auto_annotate = parse_bool(opt, error);
 			k++;
+		} else if (strcmp(cmd, "labelscachefile")==0 || strcmp(cmd, "-lc")==0) {
+			options.labels_cache_file = opt;
+			k++;
 		} else if (strcmp(cmd, "symbolfmaoutfile")==0 || strcmp(cmd, "-sf")==0) {
 			options.symbol_fma_out_file = opt;
 			k++;
@@ -125,6 +182,20 @@ void parse_options(const int argc, const char * const argv[], Options &options)
 			need_single_trace = true;
 			need_trace = true;
 			k++;
+		} else if (strcmp(cmd, "framebudgetoutfile")==0 || strcmp(cmd, "-fb")==0) {
+			options.frame_budget_out_file = opt;
+			need_single_trace = true;
+			need_trace = true;
+			k++;
+		} else if (strcmp(cmd, "callgraphoutfile")==0 || strcmp(cmd, "-cg")==0) {
+			options.call_graph_out_file = opt;
+			need_trace = true;
+			k++;
+		} else if (strcmp(cmd, "dmatimelineoutfile")==0 || strcmp(cmd, "-dt")==0) {
+			options.dma_timeline_out_file = opt;
+			need_single_trace = true;
+			need_trace = true;
+			k++;
 		} else if (strcmp(cmd, "reportoutfile")==0 || strcmp(cmd, "-rp")==0) {
 			options.report_out_file = opt;
 			k++;
@@ -150,6 +221,9 @@ void parse_options(const int argc, const char * const argv[], Options &options)
 		} else if (strcmp(cmd, "asmprintdp")==0 || strcmp(cmd, "-adp")==0) {
 			options.asm_print_dp = parse_bool(opt, error);
 			k++;
+		} else if (strcmp(cmd, "asmprintcounts")==0 || strcmp(cmd, "-acn")==0) {
+			options.asm_print_counts = parse_bool(opt, error);
+			k++;
 		} else if (strcmp(cmd, "asmlowercaseop")==0 || strcmp(cmd, "-")==0) {
 			options.asm_lower_case_op = parse_bool(opt, error);
 			k++;
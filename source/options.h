@@ -16,16 +16,28 @@ struct Options {
 	std::string                  rom_file;
 	uint32_t                     rom_size = 0;
 	std::vector<std::string>     trace_files;
+	std::string                  trace_expression;
 	uint32_t                     nmi_first = 0;
 	uint32_t                     nmi_last = 0;
 	std::string                  trace_log_out_file;
+	std::vector<std::string>     trace_log_includes;
+	std::vector<std::string>     trace_log_excludes;
+	std::string                  trace_log_binary_out_file;
+	std::string                  trace_log_render_file;
+	std::string                  rendered_trace_log_out_file;
 	std::string                  script_file;
+	std::vector<std::string>     plugin_files;
+	std::string                  plugin_argument;
 	std::vector<std::string>     labels_files;
 	std::string                  auto_labels_file;
 	bool                         auto_annotate = false;
+	std::string                  labels_cache_file;
 	std::string                  symbol_fma_out_file;
 	std::string                  symbol_mesen_s_out_file;
 	std::string                  rewind_out_file;
+	std::string                  frame_budget_out_file;
+	std::string                  call_graph_out_file;
+	std::string                  dma_timeline_out_file;
 	std::string                  report_out_file;
 	std::string                  asm_out_file;
 	std::string                  asm_header_file;
@@ -34,6 +46,7 @@ struct Options {
 	bool                         asm_print_register_sizes = true;
 	bool                         asm_print_db = true;
 	bool                         asm_print_dp = true;
+	bool                         asm_print_counts = true;
 	bool                         asm_lower_case_op = true;
 	bool                         asm_correct_wla = false;
 	PredictEnum                  predict = PRD_FUNCTIONS;
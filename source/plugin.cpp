@@ -0,0 +1,173 @@
+#include "plugin.h"
+#include "replay.h"
+#include "options.h"
+#include "trace.h"
+#include "utils.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <dlfcn.h>
+#endif
+
+using namespace snestistics;
+
+namespace {
+
+void *open_library(const char * const filename) {
+#ifdef _WIN32
+	return (void*)LoadLibraryA(filename);
+#else
+	return dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+void *find_symbol(void * const library, const char * const name) {
+#ifdef _WIN32
+	return (void*)GetProcAddress((HMODULE)library, name);
+#else
+	return dlsym(library, name);
+#endif
+}
+
+void close_library(void * const library) {
+#ifdef _WIN32
+	FreeLibrary((HMODULE)library);
+#else
+	dlclose(library);
+#endif
+}
+
+const char *library_error() {
+#ifdef _WIN32
+	return "";
+#else
+	const char * const e = dlerror();
+	return e ? e : "";
+#endif
+}
+
+const SnestisticsHost &host_functions() {
+	static SnestisticsHost host;
+	host.api_version = SNESTISTICS_PLUGIN_API_VERSION;
+	host.registers = replay_registers;
+	host.read_byte = replay_read_byte;
+	host.read_word = replay_read_word;
+	host.read_long = replay_read_long;
+	host.read_block = replay_read_block;
+	return host;
+}
+
+void plugin_op(Replay &replay, const uint32_t pc, void *context) {
+	const PluginHost &host = *(const PluginHost*)context;
+	const uint32_t event = (uint32_t)replay.regs.event;
+	for (const SnestisticsPlugin *p : host.op_plugins)
+		p->op(p->user, &replay, pc, event);
+	if (replay.regs.event == Events::NMI) {
+		const uint32_t nmi = replay.current_nmi() - 1;
+		for (const SnestisticsPlugin *p : host.nmi_plugins)
+			p->nmi(p->user, &replay, nmi);
+	}
+}
+
+void plugin_memory_read(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void *context) {
+	const PluginHost &host = *(const PluginHost*)context;
+	for (const SnestisticsPlugin *p : host.read_plugins)
+		p->memory_read(p->user, &replay, location, remapped_location, value, (uint32_t)num_bytes, (uint32_t)reason);
+}
+
+void plugin_memory_write(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void *context) {
+	const PluginHost &host = *(const PluginHost*)context;
+	for (const SnestisticsPlugin *p : host.write_plugins)
+		p->memory_write(p->user, &replay, location, remapped_location, value, (uint32_t)num_bytes, (uint32_t)reason);
+}
+
+void plugin_dma(Replay &replay, const DmaTransfer &dma, void *context) {
+	const PluginHost &host = *(const PluginHost*)context;
+	SnestisticsDma d;
+	d.pc = dma.pc;
+	d.channel = dma.channel;
+	d.a_address = (dma.a_bank << 16) | dma.a_address;
+	d.b_address = 0x2100 | dma.b_address;
+	d.transfer_bytes = dma.transfer_bytes;
+	d.transfer_mode = dma.transfer_mode;
+	d.flags = dma.flags;
+	for (const SnestisticsPlugin *p : host.dma_plugins)
+		p->dma(p->user, &replay, &d);
+}
+
+bool plugin_done(Replay &replay, void *context) {
+	const PluginHost &host = *(const PluginHost*)context;
+	return replay.nmi_range_done(host.nmi_last);
+}
+
+void plugin_end(Replay &replay, void *context) {
+	PluginHost &host = *(PluginHost*)context;
+	for (PluginHost::LoadedPlugin &p : host.plugins) {
+		if (p.plugin.finish)
+			p.plugin.finish(p.plugin.user);
+	}
+}
+
+}
+
+namespace snestistics {
+
+PluginHost::PluginHost(const std::vector<std::string> &files, const std::string &argument) {
+	plugins.reserve(files.size()); // Hook lists point into plugins
+
+	for (const std::string &file : files) {
+		LoadedPlugin loaded;
+		memset(&loaded, 0, sizeof(loaded));
+
+		loaded.library = open_library(file.c_str());
+		if (!loaded.library) {
+			printf("Failed to load plugin '%s' %s\n", file.c_str(), library_error());
+			throw std::runtime_error("Could not load plugin!");
+		}
+
+		SnestisticsPluginInit init = (SnestisticsPluginInit)find_symbol(loaded.library, SNESTISTICS_PLUGIN_INIT_NAME);
+		if (!init) {
+			close_library(loaded.library);
+			printf("Plugin '%s' does not export %s\n", file.c_str(), SNESTISTICS_PLUGIN_INIT_NAME);
+			throw std::runtime_error("Could not load plugin!");
+		}
+
+		if (init(&host_functions(), argument.c_str(), &loaded.plugin) != 0) {
+			close_library(loaded.library);
+			printf("Plugin '%s' failed to initialize\n", file.c_str());
+			throw std::runtime_error("Could not load plugin!");
+		}
+
+		plugins.push_back(loaded);
+		const SnestisticsPlugin *p = &plugins.back().plugin;
+		if (p->op) op_plugins.push_back(p);
+		if (p->memory_read) read_plugins.push_back(p);
+		if (p->memory_write) write_plugins.push_back(p);
+		if (p->nmi) nmi_plugins.push_back(p);
+		if (p->dma) dma_plugins.push_back(p);
+	}
+}
+
+PluginHost::~PluginHost() {
+	for (LoadedPlugin &p : plugins)
+		close_library(p.library);
+}
+
+ReplayStage plugin_stage(PluginHost &host, const Options &options) {
+	host.nmi_last = options.nmi_last;
+	ReplayStage stage;
+	stage.nmi_first = options.nmi_first;
+	stage.observer.context = &host;
+	stage.observer.op = host.op_plugins.empty() && host.nmi_plugins.empty() ? nullptr : plugin_op;
+	stage.observer.memory_read = host.read_plugins.empty() ? nullptr : plugin_memory_read;
+	stage.observer.memory_write = host.write_plugins.empty() ? nullptr : plugin_memory_write;
+	stage.observer.dma = host.dma_plugins.empty() ? nullptr : plugin_dma;
+	stage.done = plugin_done;
+	stage.end = plugin_end;
+	return stage;
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "plugin_api.h"
+
+struct Options;
+struct Replay;
+struct ReplayStage;
+
+namespace snestistics {
+
+/*
+	Native plugins loaded from shared libraries, see plugin_api.h for the interface.
+	They run as a stage so they share the replay with the other analyses.
+*/
+struct PluginHost {
+	PluginHost(const std::vector<std::string> &files, const std::string &argument);
+	~PluginHost();
+
+	PluginHost(const PluginHost&) = delete;
+	PluginHost& operator=(const PluginHost&) = delete;
+
+	uint32_t nmi_last = 0xFFFFFFFF;
+
+	struct LoadedPlugin {
+		void *library;
+		SnestisticsPlugin plugin;
+	};
+	std::vector<LoadedPlugin> plugins;
+
+	// Plugins having each hook, so dispatch does not need to check for null
+	std::vector<const SnestisticsPlugin*> op_plugins, read_plugins, write_plugins, nmi_plugins, dma_plugins;
+};
+
+// Runs on NMIs nmi_first to nmi_last. Finish hooks are called when the stage ends.
+ReplayStage plugin_stage(PluginHost &host, const Options &options);
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/*
+	Native plugin interface. Plugins are shared libraries (dll on Windows) that get called from inside the replay,
+	for analyses that are too heavy for scripting. Only C types are used here so a plugin can be built with any compiler.
+
+	A plugin exports snestistics_plugin_init (see SnestisticsPluginInit). It is given the host functions and fills in
+	the hooks it wants; hooks left as null cost nothing. Plugins must not call functions in api.h directly, they are not
+	exported from the executable. Use the host functions instead.
+
+	SNESTISTICS_PLUGIN_API_VERSION is increased whenever anything in this file changes.
+*/
+
+#include <stdint.h>
+#include "api.h"
+
+#define SNESTISTICS_PLUGIN_API_VERSION 1
+#define SNESTISTICS_PLUGIN_INIT_NAME "snestistics_plugin_init"
+
+#ifdef __cplusplus
+	#define SNESTISTICS_EXTERN_C extern "C"
+#else
+	#define SNESTISTICS_EXTERN_C
+#endif
+
+// Put in front of snestistics_plugin_init
+#ifdef _WIN32
+	#define SNESTISTICS_PLUGIN_EXPORT SNESTISTICS_EXTERN_C __declspec(dllexport)
+#else
+	#define SNESTISTICS_PLUGIN_EXPORT SNESTISTICS_EXTERN_C __attribute__((visibility("default")))
+#endif
+
+// Same values as Events in emulate.h
+enum SnestisticsEvent {
+	SNESTISTICS_EVENT_NONE = 0,
+	SNESTISTICS_EVENT_NMI = 1,
+	SNESTISTICS_EVENT_IRQ = 2,
+	SNESTISTICS_EVENT_RESET = 4,
+	SNESTISTICS_EVENT_JMP_OR_JML = 8,
+	SNESTISTICS_EVENT_JSR_OR_JSL = 16,
+	SNESTISTICS_EVENT_RTS_OR_RTL = 32,
+	SNESTISTICS_EVENT_BRANCH = 64,
+	SNESTISTICS_EVENT_RTI = 128,
+};
+
+// Same order as MemoryAccessType in emulate.h
+enum SnestisticsMemoryAccess {
+	SNESTISTICS_ACCESS_PROGRAM_COUNTER_RELATIVE,
+	SNESTISTICS_ACCESS_STACK_RELATIVE,
+	SNESTISTICS_ACCESS_FETCH_MVN_MVP,
+	SNESTISTICS_ACCESS_WRITE_MVN_MVP,
+	SNESTISTICS_ACCESS_FETCH_NMI_VECTOR,
+	SNESTISTICS_ACCESS_FETCH_IRQ_VECTOR,
+	SNESTISTICS_ACCESS_FETCH_INDIRECT,
+	SNESTISTICS_ACCESS_RANDOM,
+	SNESTISTICS_ACCESS_DMA_READ,
+	SNESTISTICS_ACCESS_DMA_WRITE,
+};
+
+struct SnestisticsDma {
+	uint32_t pc;             // Program counter of the op starting the transfer
+	uint32_t channel;
+	uint32_t a_address;      // 24-bit
+	uint32_t b_address;      // 0x21xx
+	uint32_t transfer_bytes;
+	uint32_t transfer_mode;
+	uint32_t flags;          // DmaTransfer::Flags in trace.h
+};
+
+// Functions the plugin can use to inspect the replay
+struct SnestisticsHost {
+	uint32_t api_version;
+	struct Registers* (*registers)(struct Replay *replay);
+	uint8_t  (*read_byte)(struct Replay *replay, uint32_t address);
+	uint16_t (*read_word)(struct Replay *replay, uint32_t address);
+	uint32_t (*read_long)(struct Replay *replay, uint32_t address);
+	void     (*read_block)(struct Replay *replay, uint32_t address, uint8_t *dest, uint32_t length);
+};
+
+// Filled in by the plugin. user is passed back as is to all hooks.
+struct SnestisticsPlugin {
+	void *user;
+	// After each op (or event), pc is where it started. Registers are after the op.
+	void (*op)(void *user, struct Replay *replay, uint32_t pc, uint32_t event);
+	// Every memory access. remapped_address is where it ends up after mirroring.
+	void (*memory_read)(void *user, struct Replay *replay, uint32_t address, uint32_t remapped_address, uint32_t value, uint32_t num_bytes, uint32_t access);
+	void (*memory_write)(void *user, struct Replay *replay, uint32_t address, uint32_t remapped_address, uint32_t value, uint32_t num_bytes, uint32_t access);
+	// Start of each NMI
+	void (*nmi)(void *user, struct Replay *replay, uint32_t nmi);
+	void (*dma)(void *user, struct Replay *replay, const struct SnestisticsDma *dma);
+	// Last call, after the replay is done. Write reports here.
+	void (*finish)(void *user);
+};
+
+// Return 0 on success. argument is what was given with -pluginargument (empty string if none).
+typedef int (*SnestisticsPluginInit)(const struct SnestisticsHost *host, const char *argument, struct SnestisticsPlugin *plugin);
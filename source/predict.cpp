@@ -4,6 +4,10 @@
 #include "annotations.h"
 #include "report_writer.h"
 #include "cputable.h" // decode_static_jump
+#include <map>
+#include <unordered_map>
+
+using namespace snestistics;
 
 namespace {
 	inline uint32_t bank_add(Pointer p, uint16_t delta) {
@@ -11,50 +15,320 @@ namespace {
 		a += delta;
 		return (p&0xFF0000)|a;
 	}
-}
-namespace snestistics {
 
-void predict(Options::PredictEnum mode, ReportWriter *writer, const RomAccessor &rom, Trace &trace, const AnnotationResolver &annotations) {
+	// The processor status bits prediction cares about. Index, memory and emulation like in the trace.
+	static const uint16_t TRACKED_P = 0x10|0x20|0x100;
 
-	if (mode == Options::PRD_NEVER)
-		return;
+	/*
+		Each tracked flag is known (its value in P) or unknown (its bit set in P_unknown, cleared in P).
+		Where two paths meet the flags they disagree on become unknown.
+	*/
+	struct FlagState {
+		uint16_t P, P_unknown;
 
-	bool limit_to_functions = mode == Options::PRD_FUNCTIONS;
+		bool operator==(const FlagState &o) const { return P == o.P && P_unknown == o.P_unknown; }
+		bool operator!=(const FlagState &o) const { return !(*this == o); }
 
-	Profile profile("Predict", true);
+		void set_unknown(const uint16_t bits) { P_unknown |= bits; P &= ~bits; }
+		void set_known(const uint16_t bits, const bool value) {
+			P_unknown &= ~bits;
+			if (value) P |= bits; else P &= ~bits;
+		}
+		bool known(const uint16_t bit) const { return (P_unknown & bit) == 0; }
+
+		static FlagState join(const FlagState &a, const FlagState &b) {
+			FlagState r = a;
+			r.set_unknown(b.P_unknown | ((a.P ^ b.P) & TRACKED_P));
+			return r;
+		}
+	};
 
 	struct PredictBranch {
 		const Annotation *annotation;
 		Pointer from_pc;
 		Pointer pc;
-		uint16_t DP, P;
+		uint16_t DP;
+		FlagState flags;
+		uint8_t DB;
+	};
+
+	struct PredictedOp {
+		Pointer pc;
+		Pointer jump_target;
+		FlagState flags; // Flags before the op, unknown flags are stored as zero in the trace
+		uint16_t DP;
 		uint8_t DB;
+		uint8_t size;
+		bool uncertain; // Revisited with flags that make its size unknown, not added to the trace
 	};
 
-	std::vector<PredictBranch> predict_brances;
+	/*
+		Branches never leave the annotation they started in so all branches from one annotation can be explored on their own.
+		Branches outside annotations are grouped per bank. Each partition only sees the ops from the trace and its own ops,
+		the results are merged into the trace in partition order so the outcome does not depend on thread timing.
+
+		The flags at each predicted op are remembered. Coming back to an op with flags that agree stops the walk,
+		otherwise the flags are joined and the walk goes on to update the ops after it. Flags only go from known
+		to unknown so each op is walked a few times at most. An op whose size no longer is known after a join is left out.
+	*/
+	struct Partition {
+		std::vector<PredictBranch> branches; // Worklist, grows while exploring
+		std::vector<PredictedOp> ops;
+		std::vector<Pointer> labels;
+		std::vector<std::string> comments; // For the report
+		std::vector<std::string> warnings;
+	};
+
+	struct PredictContext {
+		const RomAccessor &rom;
+		const AnnotationResolver &annotations;
+		const LargeBitfield &has_op, &inside_op; // Ops from the trace
+		bool limit_to_functions;
+		bool diagnostics;
+	};
+
+	void explore(const PredictContext &context, Partition &partition) {
+		const RomAccessor &rom = context.rom;
+		const AnnotationResolver &annotations = context.annotations;
+		const bool limit_to_functions = context.limit_to_functions;
+
+		// Bytes covered by ops predicted in this partition, true if not the first byte of the op
+		std::unordered_map<Pointer, bool> local_ops;
+		std::unordered_map<Pointer, uint32_t> op_index; // Index into partition.ops for each predicted op
+		const auto inside_op = [&](const Pointer p) {
+			if (context.inside_op[p])
+				return true;
+			auto it = local_ops.find(p);
+			return it != local_ops.end() && it->second;
+		};
+
+		StringBuilder sb;
+
+		for (size_t pbi=0; pbi<partition.branches.size(); ++pbi) {
+			const PredictBranch pb = partition.branches[pbi];
+
+			Pointer pc = pb.pc;
+			Pointer r0 = limit_to_functions ? pb.annotation->startOfRange : 0, r1 = limit_to_functions ? pb.annotation->endOfRange : 0xFFFFFF;
+			FlagState flags = pb.flags;
+			uint16_t DP = pb.DP;
+			uint8_t DB = pb.DB;
+
+			if (inside_op(pc)) {
+				if (context.diagnostics) {
+					sb.clear();
+					sb.format("Predicted jump at %06X jumped inside instruction at %06X. Consider adding a \"hint branch_always/branch_never %06X\" annotation.", pc, pb.from_pc, pb.from_pc);
+					partition.comments.push_back(sb.c_str());
+				}
+				sb.clear();
+				sb.format("Warning; predicted jump went inside instruction at %06X (from %06X)\n", pc, pb.from_pc);
+				partition.warnings.push_back(sb.c_str());
+			}
+
+			while (!context.has_op[pc] && pc >= r0 && pc <= r1) {
+
+				PredictedOp *visited = nullptr;
+				{
+					auto it = op_index.find(pc);
+					if (it != op_index.end()) {
+						visited = &partition.ops[it->second];
+						const FlagState joined = FlagState::join(visited->flags, flags);
+						if (joined == visited->flags)
+							break; // Nothing new to learn from here
+						flags = joined;
+						visited->flags = flags;
+					} else if (local_ops.find(pc) != local_ops.end()) {
+						break; // Inside an op predicted earlier
+					}
+				}
+
+				// Make sure we don't run into a data scope
+				const Annotation *data_scope = nullptr, *function_scope = nullptr;
+				annotations.resolve_annotation(pc, &function_scope, &data_scope);
+				if (data_scope)
+					break;
+				if (function_scope && function_scope != pb.annotation)
+					break;
+
+				uint8_t opcode = rom.evalByte(pc);
+
+				// Only give up if the size of this op depends on a flag we don't know
+				const uint16_t P_all_set = flags.P | flags.P_unknown, P_all_clear = flags.P;
+				const int op_size = instruction_size(opcode, is_memory_accumulator_wide(P_all_set), is_index_wide(P_all_set));
+				if (op_size != (int)instruction_size(opcode, is_memory_accumulator_wide(P_all_clear), is_index_wide(P_all_clear))) {
+					if (context.diagnostics) {
+						sb.clear();
+						sb.format("Aborting trace at %06X due to unknown processor status", pc);
+						if (pb.annotation)
+							sb.format("(in %s)", pb.annotation->name.c_str());
+						partition.comments.push_back(sb.c_str());
+					}
+					if (visited)
+						visited->uncertain = true;
+					break;
+				}
+
+				uint8_t operand = rom.evalByte(pc + 1);
+
+				Pointer target_jump, target_no_jump;
+				bool is_jump_or_branch = decode_static_jump(opcode, rom, pc, &target_jump, &target_no_jump);
+
+				if (visited) {
+					CUSTOM_ASSERT(visited->size == op_size);
+				} else {
+					PredictedOp op;
+					op.pc = pc;
+					op.jump_target = target_jump;
+					op.flags = flags;
+					op.DB = DB; // Note that DB and DP here represent a lie :)
+					op.DP = DP;
+					op.size = (uint8_t)op_size;
+					op.uncertain = false;
+					op_index[pc] = (uint32_t)partition.ops.size();
+					partition.ops.push_back(op);
+
+					for (int i=0; i<op_size; ++i) {
+						// TODO: We should do overlap test for entire range we are "using" now
+						//       Also first might not always be best!
+						bool &inside = local_ops[bank_add(pc, i)];
+						if (i != 0) inside = true;
+					}
+				}
+
+				const Hint *hint = annotations.hint(pc);
+				if (hint && hint->has_hint(Hint::BRANCH_NEVER)) {
+					target_jump = INVALID_POINTER;
+				}
+
+				bool is_jsr = opcode == 0x20||opcode==0x22||opcode==0xFC;
+
+				if (hint && hint->has_hint(Hint::JUMP_IS_JSR)) {
+					 is_jump_or_branch = false;
+					 is_jsr = true;
+				}
+
+				if (is_jump_or_branch) {
+					const Annotation *function = nullptr;
+					if (target_jump != INVALID_POINTER) {
+						annotations.resolve_annotation(target_jump, &function);
+						if (!visited)
+							partition.labels.push_back(target_jump);
+					}
+
+					if (limit_to_functions && context.diagnostics && !visited && (!function || function != pb.annotation)) {
+						sb.clear();
+						sb.format("Branch going out of %s to ", pb.annotation->name.c_str());
+						if (function) {
+							sb.format("%s [%06X]", function->name.c_str(), target_jump);
+						} else {
+							sb.format("%06X", target_jump);
+						}
+						sb.format(". Not following due to range restriction.");
+						partition.comments.push_back(sb.c_str());
+					}
+
+					if (target_jump != INVALID_POINTER) {
+						PredictBranch npb = pb;
+						npb.from_pc = pc;
+						npb.pc = target_jump;
+						npb.flags = flags;
+						partition.branches.push_back(npb);
+					}
+
+					if (hint && hint->has_hint(Hint::BRANCH_ALWAYS)) {
+						// Never continoue after this op since it always diverges control flow
+						break;
+					}
+
+				} else if (opcode == 0xE2) {
+					// SEP
+					//	TODO: Updating DB/DP might be interesting
+					if (operand & 0x10) flags.set_known(0x10, true);
+					if (operand & 0x20) flags.set_known(0x20, true);
+				} else if (opcode == 0xC2) {
+					// REP, can't clear index or memory in emulation mode
+					for (uint16_t bit = 0x10; bit <= 0x20; bit <<= 1) {
+						if (!(operand & bit))
+							continue;
+						if (!flags.known(0x100))
+							flags.set_unknown(bit);
+						else if (!is_emulation_mode(flags.P))
+							flags.set_known(bit, false);
+					}
+				} else if (opcode == 0x28) {
+					flags.set_unknown(0x10|0x20); // PLP
+				} else if (opcode == 0xFB) {
+					// XCE, going to emulation mode sets index and memory. Going to native mode leaves them as they were.
+					flags.set_unknown(0x100);
+					for (uint16_t bit = 0x10; bit <= 0x20; bit <<= 1) {
+						if (!flags.known(bit) || !(flags.P & bit))
+							flags.set_unknown(bit);
+					}
+					// A jump or BRA, stop execution flow (not JSR or non-BRA-branch)
+				} else if (opcode == 0x4C||opcode==0x5C||opcode==0x6C||opcode==0x7C||opcode==0x80) {
+					if (context.diagnostics && opcode != 0x80 && !visited) {
+						sb.clear();
+						sb.format("Not following jump (opcode %02X) at %06X", opcode, pc);
+						if (pb.annotation)
+							sb.format(" in %s", pb.annotation->name.c_str());
+						sb.format(". Only absolute jumps supported.");
+						partition.comments.push_back(sb.c_str());
+					}
+					// TODO: if there is a trace annotation about jmp being jsr we could go on
+					break;
+				} else if (is_jsr) {
+					if (context.diagnostics && !visited) {
+						sb.clear();
+						sb.format("Not following jump with subroutine (opcode %02X) at %06X", opcode, pc);
+						if (pb.annotation)
+							sb.format(" in %s.", pb.annotation->name.c_str());
+						partition.comments.push_back(sb.c_str());
+					}
+				} else if (opcode == 0x40 || opcode == 0x6B || opcode == 0x60) {
+					// some sort of return, stop execution flow
+					break;
+				}
+				pc += op_size;
+			}
+		}
+	}
+}
+
+namespace snestistics {
+
+void predict(Options::PredictEnum mode, ReportWriter *writer, const RomAccessor &rom, Trace &trace, DecodedOps &decoded, const AnnotationResolver &annotations) {
+
+	if (mode == Options::PRD_NEVER)
+		return;
+
+	bool limit_to_functions = mode == Options::PRD_FUNCTIONS;
+
+	Profile profile("Predict", true);
+
+	// Annotation index for branches inside annotations, after those one per bank
+	std::map<uint32_t, Partition> partitions;
+	const uint32_t num_annotations = (uint32_t)annotations._annotations.size();
+
 	LargeBitfield has_op(256*64*1024);
 	LargeBitfield inside_op(256 * 64 * 1024);
 
+	auto decoded_it = decoded.cbegin();
 	for (auto opsit : trace.ops) {
 		const Pointer pc = opsit.first;
+		const DecodedOp &d = *decoded_it++;
+		assert(d.pc == pc);
 
 		const Trace::OpVariantLookup &vl = opsit.second;
 		const OpInfo &example = trace.variant(vl, 0);
 
-		const uint8_t* data = rom.evalPtr(pc);
-		const uint8_t opcode = data[0];
-
-		uint32_t op_size = instruction_size(opcode, is_memory_accumulator_wide(example.P), is_index_wide(example.P));
+		const uint32_t op_size = d.size;
 
 		for (uint32_t i = 0; i < op_size; ++i) {
 			has_op.set_bit(bank_add(pc, i));
 			if (i!=0) inside_op.set_bit(bank_add(pc, i));
 		}
 
-		StringBuilder sb;
-
-		Pointer target_jump, target_no_jump;
-		bool branch_or_jump = decode_static_jump(opcode, rom, pc, &target_jump, &target_no_jump);
+		Pointer target_jump = d.jump_target, target_no_jump = d.secondary_target;
+		const bool branch_or_jump = d.is_jump_or_branch;
 
 		const Hint *hint = annotations.hint(pc);
 		if (hint && hint->has_hint(Hint::BRANCH_ALWAYS)) {
@@ -81,232 +355,81 @@ void predict(Options::PredictEnum mode, ReportWriter *writer, const RomAccessor
 			p.from_pc = pc;
 			p.DB = example.DB;
 			p.DP = example.DP;
-			p.P  = example.P;
+			p.flags.P = example.P & TRACKED_P;
+			p.flags.P_unknown = 0;
+			const uint32_t key = source_annotation ? (uint32_t)(source_annotation - &annotations._annotations[0]) : num_annotations + (pc >> 16);
+			std::vector<PredictBranch> &branches = partitions[key].branches;
 			if (target_jump != INVALID_POINTER && (target_annotation == source_annotation || !limit_to_functions)) {
 				p.pc = target_jump;
 				CUSTOM_ASSERT(target_jump != INVALID_POINTER);
-				predict_brances.push_back(p);
+				branches.push_back(p);
 			}
 			if (target_no_jump != INVALID_POINTER && (!limit_to_functions || (target_no_jump >= source_annotation->startOfRange && target_no_jump <= source_annotation->endOfRange))) {
 				// BRA,BRL and the jumps always branches/jumps
 				p.pc = target_no_jump;
 				CUSTOM_ASSERT(target_no_jump != INVALID_POINTER);
-				predict_brances.push_back(p);
+				branches.push_back(p);
 			}
 		}
 	}
 
-	StringBuilder sb;
-	sb.clear();
-
-	if (writer)
-		writer->writeSeperator("Prediction diagnostics");
-
-	for (int pbi=0; pbi<(int)predict_brances.size(); ++pbi) {
-		const PredictBranch pb = predict_brances[pbi];
+	std::vector<Partition*> work;
+	work.reserve(partitions.size());
+	for (auto &p : partitions)
+		work.push_back(&p.second);
 
-		Pointer pc = pb.pc;
-		Pointer r0 = limit_to_functions ? pb.annotation->startOfRange : 0, r1 = limit_to_functions ? pb.annotation->endOfRange : 0xFFFFFF;
-		uint16_t P = pb.P, DP = pb.DP;
-		uint8_t DB = pb.DB;
+	const PredictContext context = { rom, annotations, has_op, inside_op, limit_to_functions, writer != nullptr };
 
-		bool P_unknown = false;
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)work.size(); ++i) {
+		explore(context, *work[i]);
+	}
 
-		if (inside_op[pc]) {
-			if (writer) {
-				sb.clear();
-				sb.format("Predicted jump at %06X jumped inside instruction at %06X. Consider adding a \"hint branch_always/branch_never %06X\" annotation.", pc, pb.from_pc, pb.from_pc);
-				writer->writeComment(sb);
-			}
-			printf("Warning; predicted jump went inside instruction at %06X (from %06X)\n", pc, pb.from_pc);
-		}
+	if (writer)
+		writer->writeSeperator("Prediction diagnostics");
 
-		while (!has_op[pc] && pc >= r0 && pc <= r1) {
+	// Where partitions overlap the first one to predict an op there wins. Ops overlapping any byte of an op already
+	// in the trace are rejected so decodes never contradict each other.
+	for (const Partition *partition : work) {
+		for (const Pointer label : partition->labels)
+			trace.labels.set_bit(label);
 
-			// Make sure we don't run into a data scope
-			const Annotation *data_scope = nullptr, *function_scope = nullptr;
-			annotations.resolve_annotation(pc, &function_scope, &data_scope);
-			if (data_scope)
+		for (const PredictedOp &op : partition->ops) {
+			if (op.uncertain)
 				continue;
-			if (function_scope && function_scope != pb.annotation)
+			bool overlaps = false;
+			for (int i=0; i<op.size && !overlaps; ++i)
+				overlaps = has_op[bank_add(op.pc, i)];
+			if (overlaps)
 				continue;
 
-			uint8_t opcode = rom.evalByte(pc);
-
-			bool abort_unknown_P = P_unknown;
-
-			if (P_unknown) {
-				switch(opcode) {
-				case 0x02: // COP const
-				case 0x40: // RTI
-				case 0x6B: // RTL
-				case 0x60: // RTS
-				case 0x3B: // TSC
-				case 0xBA: // TSX
-				case 0x8A: // TXA
-				case 0x9A: // TXS
-				case 0x9B: // TXY
-				case 0x98: // TYA
-				case 0xBB: // TYX
-				case 0xCB: // WAI
-				case 0xEB: // XBA
-				case 0xFB: // XCE
-				case 0xAA: // TAX
-				case 0xA8: // TAY
-				case 0x5B: // TCD
-				case 0x1B: // TCS
-				case 0x7B: // TDC
-				case 0xDB: // STP
-				case 0x38: // SEC
-				case 0xF8: // SED
-				case 0x78: // SEI
-				case 0xE2: // SEP
-				case 0xC2: // REP
-				case 0x18: // CLC
-				case 0xD8: // CLD
-				case 0x58: // CLI
-				case 0xB8: // CLV
-				case 0xCA: // DEX
-				case 0x88: // DEY
-				case 0xE8: // INX
-				case 0xC8: // INY
-				case 0xEA: // NOP
-				case 0x8B: // PHB
-				case 0x0B: // PHD
-				case 0x4B: // PHK
-				case 0x08: // PHP
-				case 0xDA: // PHX
-				case 0x5A: // PHY
-				case 0x68: // PLA
-				case 0xAB: // PLB
-				case 0x2B: // PLD
-				case 0x28: // PLP
-				case 0xFA: // PLX
-				case 0x7A: // PLY
-					abort_unknown_P = false;
-				}
+			Trace::OpVariantLookup l;
+			l.count = 1;
+			l.offset = (uint32_t)trace.ops_variants.size();
+			trace.ops[op.pc] = l;
+			OpInfo info;
+			info.P = op.flags.P;
+			info.DB = op.DB;
+			info.DP = op.DP;
+			info.X = info.Y = 0;
+			info.jump_target = op.jump_target;
+			info.indirect_base_pointer = INVALID_POINTER; // TODO: We should be able to set this one sometimes
+			trace.ops_variants.push_back(info);
+
+			for (int i=0; i<op.size; ++i) {
+				trace.is_predicted.set_bit(bank_add(op.pc, i));
+				has_op.set_bit(bank_add(op.pc, i));
 			}
+		}
 
-			if (abort_unknown_P) {
-				if (writer) {
-					sb.clear();
-					sb.format("Aborting trace at %06X due to unknown processor status", pc);
-					if (pb.annotation)
-						sb.format("(in %s)", pb.annotation->name.c_str());
-					writer->writeComment(sb);
-				}
-				break;
-			}
-
-			uint8_t operand = rom.evalByte(pc + 1);
-
-			Pointer target_jump, target_no_jump;
-			bool is_jump_or_branch = decode_static_jump(opcode, rom, pc, &target_jump, &target_no_jump);
-
-			{
-				Trace::OpVariantLookup l;
-				l.count = 1;
-				l.offset = (uint32_t)trace.ops_variants.size();
-				trace.ops[pc] = l;
-				OpInfo info;
-				info.P = P_unknown ? 0 : P;
-				info.DB = DB;
-				info.DP = DP;
-				info.X = info.Y = 0;
-				info.jump_target = target_jump;
-				info.indirect_base_pointer = INVALID_POINTER; // TODO: We should be able to set this one sometimes
-				trace.ops_variants.push_back(info);
-
-				// Note that DB and DP here represent a lie :)
-			}
-
-			const int op_size = instruction_size(rom.evalByte(pc), is_memory_accumulator_wide(P), is_index_wide(P));
-
-			for (int i=0; i<op_size; ++i) {
-				// TODO: We should do overlap test for entire range we are "using" now
-				//       Also first might not always be best!
-				trace.is_predicted.set_bit(bank_add(pc, i));
-				has_op.set_bit(bank_add(pc, i));
-				if (i != 0) inside_op.set_bit(bank_add(pc, i));
-			}
-
-			const Hint *hint = annotations.hint(pc);
-			if (hint && hint->has_hint(Hint::BRANCH_NEVER)) {
-				target_jump = INVALID_POINTER;
-			}
-
-			bool is_jsr = opcode == 0x20||opcode==0x22||opcode==0xFC;
-
-			if (hint && hint->has_hint(Hint::JUMP_IS_JSR)) {
-				 is_jump_or_branch = false;
-				 is_jsr = true;
-			}
-
-			if (is_jump_or_branch) {
-				const Annotation *function = nullptr;
-				if (target_jump != INVALID_POINTER) {
-					annotations.resolve_annotation(target_jump, &function);
-					trace.labels.set_bit(target_jump);
-				}
-
-				if (limit_to_functions && writer && (!function || function != pb.annotation)) {
-					sb.clear();
-					sb.format("Branch going out of %s to ", pb.annotation->name.c_str());
-					if (function) {
-						sb.format("%s [%06X]", function->name.c_str(), target_jump);
-					} else {
-						sb.format("%06X", target_jump);
-					}
-					sb.format(". Not following due to range restriction.");
-					writer->writeComment(sb);
-				}
-				
-				if (target_jump != INVALID_POINTER) {
-					PredictBranch npb = pb;
-					npb.from_pc = pc;
-					npb.pc = target_jump;
-					predict_brances.push_back(npb);
-				}
-
-				if (hint && hint->has_hint(Hint::BRANCH_ALWAYS)) {
-					// Never continoue after this op since it always diverges control flow
-					continue;
-				}
-
-			} else if (opcode == 0xE2) {
-				//	TODO:
-				//	* When we get a REP or SEP parts or P become known again. We could track unknown per the three flags and update.
-				//	* Updating DB/DP might be interesting
-				if (operand & 0x10) P |= 0x0010;
-				if (operand & 0x20) P |= 0x0020;
-			} else if (opcode == 0xC2) {
-				if (operand & 0x10) P &= ~0x0010;
-				if (operand & 0x20) P &= ~0x0020;
-			} else if (opcode == 0x28 || opcode == 0xFB) {
-				P_unknown = true; // PLP or XCE
-				// A jump or BRA, stop execution flow (not JSR or non-BRA-branch)
-			} else if (opcode == 0x4C||opcode==0x5C||opcode==0x6C||opcode==0x7C||opcode==0x80) {
-				if (writer && opcode != 0x80) {
-					sb.clear();
-					sb.format("Not following jump (opcode %02X) at %06X in %s. Only absolute jumps supported.", opcode, pc, pb.annotation->name.c_str());
-					writer->writeComment(sb);
-				}
-				// TODO: if there is a trace annotation about jmp being jsr we could go on
-				continue;
-			} else if (is_jsr) {
-				if (writer) {
-					sb.clear();
-					sb.format("Not following jump with subroutine (opcode %02X) at %06X", opcode, pc);
-					if (pb.annotation)
-						sb.format(" in %s.", pb.annotation->name.c_str());
-					writer->writeComment(sb);
-				}
-			} else if (opcode == 0x40 || opcode == 0x6B || opcode == 0x60) {
-				// some sort of return, stop execution flow
-				continue;
-			}
-			pc += op_size;
+		if (writer) {
+			for (const std::string &comment : partition->comments)
+				writer->writeComment(comment.c_str());
 		}
+		for (const std::string &warning : partition->warnings)
+			printf("%s", warning.c_str());
 	}
+
+	decode_ops(trace, rom, decoded);
 }
 }
@@ -2,11 +2,14 @@
 
 #include "options.h" // TODO: For the enum, can we forward declare enums?
 
+#include "decode.h"
+
 struct ReportWriter;
 
 namespace snestistics {
 	struct Trace;
 	class RomAccessor;
 	class AnnotationResolver;
-	void predict(Options::PredictEnum mode, ReportWriter *writer, const RomAccessor &rom, Trace &trace, const AnnotationResolver &annotations);
+	// Predicted ops are added to trace and decoded
+	void predict(Options::PredictEnum mode, ReportWriter *writer, const RomAccessor &rom, Trace &trace, DecodedOps &decoded, const AnnotationResolver &annotations);
 }
@@ -84,7 +84,7 @@ namespace  {
 	TODO: Skipping should either live 100% in trace.cpp or 100% here. Figure out which!
 */
 
-Replay::Replay(const RomAccessor &rom, const char *const trace_file) : regs(rom), breakpoints(1024 * 64 * 256), _trace_file_name(trace_file) {
+Replay::Replay(const RomAccessor &rom, const char *const trace_file) : regs(rom), breakpoints(1024 * 64 * 256), _script_breakpoints(1024 * 64 * 256), _trace_file_name(trace_file) {
 	_trace_file._file = fopen(trace_file, "rb");
 
 	CUSTOM_ASSERT(_trace_file._file);
@@ -150,7 +150,7 @@ bool Replay::skip_until_nmi(const uint32_t target_skip_nmi) {
 			break;
 		}
 
-		if(target_skip_nmi < header.num_nmis) {
+		if(target_skip_nmi >= header.num_nmis) {
 			printf("Emulation cache does not have enough NMIs, not using\n");
 			fclose(f._file);
 			break;
@@ -205,23 +205,31 @@ bool Replay::skip_until_nmi(const uint32_t target_skip_nmi) {
 
 	CUSTOM_ASSERT(_current_nmi <= target_skip_nmi);
 
-	if (_current_nmi == target_skip_nmi) // We had a skip for the exact right nmi
-		return true;
-
 	// TODO: We might have to re-emulate from start if there was no skip and we want to go to same frame or less
-	// Skips are not for every nmi so make sure we reach the right one
+	// Skips are not for every nmi so make sure we reach the right one. Even a skip for the exact nmi is taken right after
+	// the NMI before, so emulate to just before the NMI starts like when emulating from the start.
+	// Breakpoints are for what happens after the skip
+	_dispatch_hooks = false;
+	bool reached = false;
 	while (true) {
-		if (target_skip_nmi == _current_nmi && _current_op == _next_event_op && _next_event.type == TraceEventType::EVENT_NMI)
-			return true;
+		if (target_skip_nmi == _current_nmi && at_nmi()) {
+			reached = true;
+			break;
+		}
 		if (!next())
-			return false;
+			break;
 	}
+	_dispatch_hooks = true;
+	return reached;
 }
 
 bool Replay::next() {
 	
 	EmulateRegisters &regs = this->regs;
 
+	if (_dispatch_hooks && breakpoints[regs._PC & 0xFFFFFF])
+		run_breakpoints(regs._PC & 0xFFFFFF);
+
 	regs.clear_event();
 
 	Events do_event = Events::NONE;
@@ -252,6 +260,21 @@ bool Replay::next() {
 			regs._memory[r0] = rw.value&0xFF; // Use function to this become traceable from regs
 			regs._memory[r1] = rw.value>>8; // Use function to this become traceable from regs
 			read_next_event();
+		} else if (_next_event.type == TraceEventType::EVENT_DMA) {
+			TraceEventDma dma;
+			size_t num_read = _trace_file.read(&dma, sizeof(dma));
+			CUSTOM_ASSERT(num_read == sizeof(dma));
+			std::vector<uint8_t> values(dma.num_bytes);
+			num_read = _trace_file.read(values.data(), dma.num_bytes);
+			CUSTOM_ASSERT(num_read == dma.num_bytes);
+			uint32_t shifted_bank = dma.adress & 0x00FF0000;
+			if (regs._debug)
+				printf("External DMA write %06X step %d %d bytes op %d\n", dma.adress, dma.step, dma.num_bytes, (int32_t)_current_op);
+			for (uint32_t k = 0; k < dma.num_bytes; ++k) {
+				uint16_t l = (uint16_t)(dma.adress + k * dma.step);
+				regs.write_dma_byte(shifted_bank|l, values[k]);
+			}
+			read_next_event();
 		} else if (_next_event.type == TraceEventType::EVENT_RESET) {
 			do_event = Events::RESET;
 			break;
@@ -343,6 +366,11 @@ bool Replay::next() {
 		}
 	#endif
 	_current_op++;
+
+	if (_dispatch_hooks) {
+		for (const ReplayObserver &o : _op_observers)
+			o.op(*this, PC_before_op, o.context);
+	}
 	return true;
 }
 
@@ -355,20 +383,251 @@ void Replay::read_next_event() {
 	_next_event_op = _accumulated_op_counter;
 }
 
-void replay_set_breakpoint(Replay* replay, uint32_t pc) {
-	if (pc < 1024*64*256)
-		replay->breakpoints.set_bit(pc);
+void Replay::add_breakpoint(const uint32_t pc0, const uint32_t pc1, BreakpointCallback callback, void *context) {
+	if (pc1 < pc0 || pc0 >= 1024*64*256U)
+		return;
+	BreakpointAction a;
+	a.first = pc0;
+	a.last = std::min(pc1, 1024*64*256U-1);
+	a.callback = callback;
+	a.context = context;
+	_breakpoint_actions.push_back(a);
+	breakpoints.set_range(a.first, a.last);
 }
-void replay_set_breakpoint_range(Replay* replay, uint32_t p0, uint32_t p1) {
-	if (p1 < p0)
+
+void Replay::add_script_breakpoint(const uint32_t pc0, const uint32_t pc1) {
+	if (pc1 < pc0 || pc0 >= 1024*64*256U)
 		return;
+	const uint32_t last = std::min(pc1, 1024*64*256U-1);
+	_script_breakpoints.set_range(pc0, last);
+	breakpoints.set_range(pc0, last);
+}
+
+void Replay::set_script_breakpoint_handler(BreakpointCallback callback, void *context) {
+	_script_breakpoint_handler = callback;
+	_script_breakpoint_context = context;
+}
+
+void Replay::run_breakpoints(const uint32_t pc) {
+	for (const BreakpointAction &a : _breakpoint_actions) {
+		if (pc >= a.first && pc <= a.last)
+			a.callback(*this, pc, a.context);
+	}
+	if (_script_breakpoint_handler && _script_breakpoints[pc])
+		_script_breakpoint_handler(*this, pc, _script_breakpoint_context);
+}
 
-	p1 = std::min(p1, 1024*64*256U-1);
+void Replay::add_watchpoint_action(const WatchpointAction &action) {
+	if (action.last < action.first || action.first >= 1024*64*256U || action.kinds == 0)
+		return;
+	WatchpointAction a = action;
+	a.last = std::min(a.last, 1024*64*256U-1);
+
+	if (!_watch_read) {
+		// First watchpoint, start looking at memory accesses
+		_watch_read.reset(new LargeBitfield(1024 * 64 * 256));
+		_watch_write.reset(new LargeBitfield(1024 * 64 * 256));
+		ReplayObserver o;
+		o.context = &_watchpoint_actions;
+		o.memory_read = watch_read;
+		o.memory_write = watch_write;
+		add_observer(o);
+	}
+	if (a.kinds & WATCH_READ)
+		_watch_read->set_range(a.first, a.last);
+	if (a.kinds & (WATCH_WRITE | WATCH_CHANGE))
+		_watch_write->set_range(a.first, a.last);
+	_watchpoint_actions.push_back(a);
+}
+
+void Replay::add_watchpoint(const uint32_t address0, const uint32_t address1, const uint8_t kinds, WatchpointCallback callback, void *context) {
+	WatchpointAction a;
+	a.first = address0;
+	a.last = address1;
+	a.kinds = kinds;
+	a.callback = callback;
+	a.context = context;
+	add_watchpoint_action(a);
+}
+
+void Replay::add_script_watchpoint(const uint32_t address0, const uint32_t address1, const uint8_t kinds) {
+	add_watchpoint(address0, address1, kinds, nullptr, nullptr);
+}
+
+void Replay::set_script_watchpoint_handler(WatchpointCallback callback, void *context) {
+	_script_watchpoint_handler = callback;
+	_script_watchpoint_context = context;
+}
+
+void Replay::run_watchpoints(const uint32_t address, const uint8_t value, const uint8_t old_value, const WatchKind kind) {
+	// By index since a callback may add watchpoints
+	for (size_t i = 0; i < _watchpoint_actions.size(); ++i) {
+		const WatchpointAction a = _watchpoint_actions[i];
+		if (address < a.first || address > a.last || (a.kinds & kind) == 0)
+			continue;
+		if (a.callback)
+			a.callback(*this, address, value, old_value, kind, a.context);
+		else if (_script_watchpoint_handler)
+			_script_watchpoint_handler(*this, address, value, old_value, kind, _script_watchpoint_context);
+	}
+}
+
+void Replay::watch_read(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void *context) {
+	for (int k = 0; k < num_bytes; ++k) {
+		const uint32_t address = (remapped_location + k) & 0xFFFFFF;
+		if ((*replay._watch_read)[address]) {
+			const uint8_t v = (value >> (k * 8)) & 0xFF;
+			replay.run_watchpoints(address, v, v, WATCH_READ);
+		}
+	}
+}
+
+void Replay::watch_write(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void *context) {
+	for (int k = 0; k < num_bytes; ++k) {
+		const uint32_t address = (remapped_location + k) & 0xFFFFFF;
+		if ((*replay._watch_write)[address]) {
+			// Called before the write so memory still has the old value
+			const uint8_t v = (value >> (k * 8)) & 0xFF;
+			const uint8_t old = replay.regs._memory[address];
+			replay.run_watchpoints(address, v, old, WATCH_WRITE);
+			if (v != old)
+				replay.run_watchpoints(address, v, old, WATCH_CHANGE);
+		}
+	}
+}
+
+void Replay::add_observer(const ReplayObserver &observer) {
+	if (observer.op) _op_observers.push_back(observer);
+	if (observer.memory_read) _read_observers.push_back(observer);
+	if (observer.memory_write) _write_observers.push_back(observer);
+	if (observer.dma) _dma_observers.push_back(observer);
+	install_observer_callbacks();
+}
+
+void Replay::remove_observer(const void * const context) {
+	for (std::vector<ReplayObserver> *v : { &_op_observers, &_read_observers, &_write_observers, &_dma_observers }) {
+		v->erase(std::remove_if(v->begin(), v->end(), [context](const ReplayObserver &o) { return o.context == context; }), v->end());
+	}
+	install_observer_callbacks();
+}
 
-	// TODO: Add a function in breakpoints to set a range, could be much faster
-	for (uint32_t p = p0; p <= p1; p++) {
-		replay->breakpoints.set_bit(p);
-	}	
+// Callbacks on regs are shared by all observers (they have one context), so regs must not be given other callbacks
+void Replay::install_observer_callbacks() {
+	const bool any = !_read_observers.empty() || !_write_observers.empty() || !_dma_observers.empty();
+	CUSTOM_ASSERT(regs._callback_context == nullptr || regs._callback_context == this);
+	regs._callback_context = any ? this : nullptr;
+	regs._read_function = _read_observers.empty() ? nullptr : observer_read;
+	regs._write_function = _write_observers.empty() ? nullptr : observer_write;
+	regs._dma_function = _dma_observers.empty() ? nullptr : observer_dma;
+}
+
+void Replay::observer_read(void *context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, MemoryAccessType reason) {
+	Replay &replay = *(Replay*)context;
+	if (!replay._dispatch_hooks)
+		return;
+	for (const ReplayObserver &o : replay._read_observers)
+		o.memory_read(replay, location, remapped_location, value, num_bytes, reason, o.context);
+}
+
+void Replay::observer_write(void *context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, MemoryAccessType reason) {
+	Replay &replay = *(Replay*)context;
+	if (!replay._dispatch_hooks)
+		return;
+	for (const ReplayObserver &o : replay._write_observers)
+		o.memory_write(replay, location, remapped_location, value, num_bytes, reason, o.context);
+}
+
+void Replay::observer_dma(void *context, const DmaTransfer &dma) {
+	Replay &replay = *(Replay*)context;
+	if (!replay._dispatch_hooks)
+		return;
+	for (const ReplayObserver &o : replay._dma_observers)
+		o.dma(replay, dma, o.context);
+}
+
+namespace {
+	void begin_stage(Replay &replay, const ReplayStage &stage) {
+		if (stage.begin)
+			stage.begin(replay, stage.observer.context);
+		replay.add_observer(stage.observer);
+	}
+
+	void end_stage(Replay &replay, const ReplayStage &stage) {
+		replay.remove_observer(stage.observer.context);
+		if (stage.end)
+			stage.end(replay, stage.observer.context);
+	}
+}
+
+void run_replay_stages(const RomAccessor &rom, const char * const trace_file, std::vector<ReplayStage> &stages) {
+	enum State : uint8_t { PENDING, ACTIVE, DONE };
+	std::vector<State> state(stages.size(), PENDING);
+
+	bool from_start = false;
+	uint32_t first_nmi = 0xFFFFFFFF;
+	for (const ReplayStage &s : stages) {
+		from_start |= s.from_start;
+		if (!s.from_start)
+			first_nmi = std::min(first_nmi, s.nmi_first);
+	}
+
+	Replay replay(rom, trace_file);
+
+	if (!from_start && !stages.empty()) {
+		const bool success = replay.skip_until_nmi(first_nmi);
+		CUSTOM_ASSERT(success);
+	}
+
+	for (size_t i = 0; i < stages.size(); ++i) {
+		if (stages[i].from_start || (!from_start && stages[i].nmi_first == first_nmi)) {
+			begin_stage(replay, stages[i]);
+			state[i] = ACTIVE;
+		}
+	}
+
+	size_t num_left = stages.size();
+
+	while (num_left != 0) {
+		for (size_t i = 0; i < stages.size(); ++i) {
+			if (state[i] == PENDING && replay.current_nmi() == stages[i].nmi_first && replay.at_nmi()) {
+				begin_stage(replay, stages[i]);
+				state[i] = ACTIVE;
+			}
+		}
+
+		if (!replay.next())
+			break;
+
+		for (size_t i = 0; i < stages.size(); ++i) {
+			const ReplayStage &s = stages[i];
+			if (state[i] == ACTIVE && s.done && s.done(replay, s.observer.context)) {
+				end_stage(replay, s);
+				state[i] = DONE;
+				num_left--;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < stages.size(); ++i) {
+		if (state[i] == PENDING)
+			begin_stage(replay, stages[i]);
+		if (state[i] != DONE)
+			end_stage(replay, stages[i]);
+	}
+}
+
+void replay_set_breakpoint(Replay* replay, uint32_t pc) {
+	replay->add_script_breakpoint(pc, pc);
+}
+void replay_set_breakpoint_range(Replay* replay, uint32_t p0, uint32_t p1) {
+	replay->add_script_breakpoint(p0, p1);
+}
+
+void replay_set_watchpoint(Replay* replay, uint32_t address, uint32_t kinds) {
+	replay->add_script_watchpoint(address, address, (uint8_t)kinds);
+}
+void replay_set_watchpoint_range(Replay* replay, uint32_t address0, uint32_t address1, uint32_t kinds) {
+	replay->add_script_watchpoint(address0, address1, (uint8_t)kinds);
 }
 
 Registers* replay_registers(Replay *replay) {
@@ -395,3 +654,14 @@ uint32_t replay_read_long(Replay *replay, uint32_t address) {
 	uint8_t* memory = replay->regs._memory;
 	return memory[address+0]+(memory[address+1]<<8)+(memory[address+2]<<16);
 }
+void replay_read_block(Replay *replay, uint32_t address, uint8_t *dest, uint32_t length) {
+	const uint8_t* memory = replay->regs._memory;
+	address &= 0xFFFFFF;
+	while (length > 0) {
+		const uint32_t n = std::min(length, 0x1000000 - address);
+		memcpy(dest, &memory[address], n);
+		dest += n;
+		length -= n;
+		address = 0;
+	}
+}
@@ -9,19 +9,111 @@
 struct Options;
 namespace snestistics {
 	class RomAccessor;
+	struct DmaTransfer;
 }
+struct Replay;
 
 #define VERIFY_OPS
 
+#include <vector>
+#include <memory>
+
+/*
+	Observers see what happens during replay so several analyses can share one emulation.
+	op is called after every op, NMI, IRQ and RESET (see regs.event) with the program counter it started at.
+	Hooks left as nullptr are not called. Memory and DMA callbacks are only installed on regs when some observer
+	has them. Nothing is called while skipping.
+*/
+struct ReplayObserver {
+	typedef void (*OpFunc)(Replay &replay, const uint32_t pc, void *context);
+	typedef void (*MemoryFunc)(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const snestistics::MemoryAccessType reason, void *context);
+	typedef void (*DmaFunc)(Replay &replay, const snestistics::DmaTransfer &dma, void *context);
+	void *context = nullptr;
+	OpFunc op = nullptr;
+	MemoryFunc memory_read = nullptr;
+	MemoryFunc memory_write = nullptr;
+	DmaFunc dma = nullptr;
+};
+
+/*
+	Breakpoints are checked at the start of next(), before the op at pc is executed. Native code gets its own
+	callback and context for each breakpoint. Breakpoints set from scripts (replay_set_breakpoint) all go to the
+	script breakpoint handler, so the script VM is only entered for those.
+
+	Watchpoints trigger on memory accesses to remapped addresses (after mirroring), one byte at a time.
+	WATCH_CHANGE only triggers on writes that change the value. Callbacks are called in the middle of an op,
+	for writes before memory is updated. Nothing is hooked into memory accesses until the first watchpoint is set.
+*/
 struct Replay {
+	typedef void (*BreakpointCallback)(Replay &replay, const uint32_t pc, void *context);
+
+	enum WatchKind : uint8_t {
+		WATCH_READ = 1,
+		WATCH_WRITE = 2,
+		WATCH_CHANGE = 4,
+	};
+	typedef void (*WatchpointCallback)(Replay &replay, const uint32_t address, const uint8_t value, const uint8_t old_value, const WatchKind kind, void *context);
+
 	Replay(const snestistics::RomAccessor &rom, const char *const trace_file);
 	~Replay();
-	snestistics::LargeBitfield breakpoints;
+	snestistics::LargeBitfield breakpoints; // Union of all breakpoints, do not modify directly
 	snestistics::EmulateRegisters regs; // TODO: Make replay use temp_registers instead of regs...
 	Registers temp_registers;
+	// Leaves the replay right before NMI target_skip_nmi starts (current_nmi()==target_skip_nmi and at_nmi()), with or without cache
 	bool skip_until_nmi(const uint32_t target_skip_nmi);
 	bool next();
+
+	void add_breakpoint(const uint32_t pc0, const uint32_t pc1, BreakpointCallback callback, void *context);
+	void add_script_breakpoint(const uint32_t pc0, const uint32_t pc1);
+	void set_script_breakpoint_handler(BreakpointCallback callback, void *context);
+
+	void add_watchpoint(const uint32_t address0, const uint32_t address1, const uint8_t kinds, WatchpointCallback callback, void *context);
+	void add_script_watchpoint(const uint32_t address0, const uint32_t address1, const uint8_t kinds);
+	void set_script_watchpoint_handler(WatchpointCallback callback, void *context);
+
+	void add_observer(const ReplayObserver &observer);
+	void remove_observer(const void * const context); // Removes all observers with this context
+
+	// NMIs started so far. Skipping to n gives n, the NMI starting after that gets number n.
+	uint32_t current_nmi() const { return _current_nmi; }
+	// True if the next call to next() starts an NMI
+	bool at_nmi() const { return _current_op == _next_event_op && _next_event.type == snestistics::TraceEventType::EVENT_NMI; }
+	// NMIs [nmi_first, nmi_last] begin where skip_until_nmi(nmi_first) leaves the replay and are done right before NMI nmi_last+1 starts
+	bool nmi_range_done(const uint32_t nmi_last) const { return _current_nmi > nmi_last && at_nmi(); }
 private:
+	std::vector<ReplayObserver> _op_observers, _read_observers, _write_observers, _dma_observers;
+	void install_observer_callbacks();
+	static void observer_read(void *context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, snestistics::MemoryAccessType reason);
+	static void observer_write(void *context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, snestistics::MemoryAccessType reason);
+	static void observer_dma(void *context, const snestistics::DmaTransfer &dma);
+
+	struct BreakpointAction {
+		uint32_t first, last;
+		BreakpointCallback callback;
+		void *context;
+	};
+	std::vector<BreakpointAction> _breakpoint_actions;
+	snestistics::LargeBitfield _script_breakpoints;
+	BreakpointCallback _script_breakpoint_handler = nullptr;
+	void *_script_breakpoint_context = nullptr;
+	struct WatchpointAction {
+		uint32_t first, last;
+		uint8_t kinds;
+		WatchpointCallback callback; // nullptr for script watchpoints
+		void *context;
+	};
+	std::vector<WatchpointAction> _watchpoint_actions;
+	std::unique_ptr<snestistics::LargeBitfield> _watch_read, _watch_write; // Union of all watchpoints, created with the first one
+	WatchpointCallback _script_watchpoint_handler = nullptr;
+	void *_script_watchpoint_context = nullptr;
+	void add_watchpoint_action(const WatchpointAction &action);
+	void run_watchpoints(const uint32_t address, const uint8_t value, const uint8_t old_value, const WatchKind kind);
+	static void watch_read(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const snestistics::MemoryAccessType reason, void *context);
+	static void watch_write(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const snestistics::MemoryAccessType reason, void *context);
+
+	bool _dispatch_hooks = true; // False while skipping
+	void run_breakpoints(const uint32_t pc);
+
 	std::string _trace_file_name;
 	snestistics::TraceEvent _next_event;
 	snestistics::BigFile _trace_file;
@@ -38,3 +130,23 @@ public:
 private:
 	void read_next_event();
 };
+
+/*
+	Analyses sharing one replay. Each stage observes the replay from when it begins until it is done, so a run that
+	asks for many outputs emulates each frame once.
+	Stages that are not from_start begin where skip_until_nmi(nmi_first) would leave the replay. The replay skips
+	ahead to the first stage that begins unless some stage needs the trace from the start.
+*/
+struct ReplayStage {
+	typedef void (*Func)(Replay &replay, void *context);
+	typedef bool (*DoneFunc)(Replay &replay, void *context);
+	ReplayObserver observer;          // observer.context is passed to the functions below as well
+	bool from_start = false;
+	uint32_t nmi_first = 0;
+	Func begin = nullptr;             // Before the first op
+	DoneFunc done = nullptr;          // Checked after every op. If not given the stage runs to the end of the trace
+	Func end = nullptr;               // Always called, even if the trace ended before the stage began
+};
+
+void run_replay_stages(const snestistics::RomAccessor &rom, const char * const trace_file, std::vector<ReplayStage> &stages);
+
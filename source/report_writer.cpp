@@ -4,38 +4,93 @@
 using namespace snestistics;
 
 void report_writer_print(ReportWriter *report_writer, const char * const str, uint32_t len) {
-	int indent = report_writer->indentation;
-	FILE *f = report_writer->report;
-	for (int i=0; i<indent; ++i) {
-		fputc(' ', f);
-	}
-	fwrite(str, 1, len, f);
-	fputc('\n', f);
+	report_writer->repeat(' ', report_writer->indentation);
+	report_writer->write(str, len);
+	report_writer->write('\n');
 }
 
-ReportWriter::ReportWriter(const char * const filename) : report(fopen(filename, "wb")) {
-	if (!report) {
+ReportWriter::ReportWriter(const char * const filename) : _file(fopen(filename, "wb")), _buffer(new char[BUFFER_SIZE]), _capacity(BUFFER_SIZE) {
+	if (!_file) {
 		printf("Could not open the file '%s'\n", filename);
 		exit(1);
 	}
 }
 
+ReportWriter::ReportWriter(std::string &memory) : _file(nullptr), _memory(&memory), _memory_start(memory.size()) {
+}
+
 ReportWriter::~ReportWriter() {
-	fclose(report);
+	flush();
+	if (_file) {
+		fclose(_file);
+		delete[] _buffer;
+	}
+}
+
+void ReportWriter::flush() {
+	if (_memory) {
+		// Cut off the part of the string not written to yet
+		_memory->resize(_memory_start + _used);
+		_capacity = _used;
+		return;
+	}
+	if (_used == 0)
+		return;
+	write_direct(_buffer, _used);
+	_used = 0;
+}
+
+bool ReportWriter::make_room(const uint32_t len) {
+	if (!_memory) {
+		flush();
+		return len <= _capacity;
+	}
+	// Grow the string and keep formatting into it
+	const uint32_t needed = _used + len;
+	_capacity = std::max(needed, std::max(_capacity * 2, 4096u));
+	_memory->resize(_memory_start + _capacity);
+	_buffer = &(*_memory)[_memory_start];
+	return true;
+}
+
+void ReportWriter::write_direct(const char * const str, const uint32_t len) {
+	fwrite(str, 1, len, _file);
+	_bytes_flushed += len;
+}
+
+int ReportWriter::format(const char * const fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(_buffer + _used, _capacity - _used, fmt, args);
+	va_end(args);
+	assert(len >= 0);
+	if (_used + len < _capacity) {
+		_used += len;
+		return len;
+	}
+	// Did not fit, make room and try again
+	flush();
+	std::vector<char> large(len + 1);
+	va_start(args, fmt);
+	vsnprintf(&large[0], len + 1, fmt, args);
+	va_end(args);
+	write(&large[0], len);
+	return len;
 }
 
 void ReportWriter::writeComment(const char * const str) {
-	fprintf(report, "%s\n", str);
+	write(str);
+	write('\n');
 }
 
 void ReportWriter::writeComment(StringBuilder & sb) {
-	writeComment(sb.c_str());
+	write(sb.c_str(), (uint32_t)sb.length());
+	write('\n');
 	sb.clear();
 }
 
 void ReportWriter::writeSeperator(const char * const text) {
-	fprintf(report, "\n");
-	fprintf(report, "; =====================================================================================================\n");
-	fprintf(report, "; %s\n", text);
-	fprintf(report, "; =====================================================================================================\n");
+	write("\n; =====================================================================================================\n; ");
+	write(text);
+	write("\n; =====================================================================================================\n");
 }
@@ -1,24 +1,153 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <algorithm>
 
 /*
 	The idea of the report writer is to be a convenient object to do small report from script or C++.
 	One such report is the assembler output and the trace log.
+
+	Output is collected in a large buffer and only written to disk when the buffer is full, on flush()
+	or when the writer is destroyed. A writer to memory formats straight into the string instead.
+	Hex and decimal numbers are formatted without going through printf since the trace log and asm
+	output spend most of their time doing that. testdata/report_writer_benchmark.cpp times writing to
+	a file and to memory.
 */
 
 namespace snestistics {
 	struct StringBuilder;
+
+	// Zero padded upper case hex using at least digits (1-8) characters. Returns number of characters written, not null terminated.
+	inline int format_hex(char * const dest, const uint32_t value, const int digits) {
+		static const char hex_digits[] = "0123456789ABCDEF";
+		int n = digits < 1 ? 1 : digits;
+		while (n < 8 && (value >> (n * 4)) != 0) n++;
+		uint32_t v = value;
+		for (int i = n - 1; i >= 0; --i) {
+			dest[i] = hex_digits[v & 0xF];
+			v >>= 4;
+		}
+		return n;
+	}
+
+	// Same as %llu, at most 20 characters. Returns number of characters written, not null terminated.
+	inline int format_decimal64(char * const dest, const uint64_t value) {
+		char reversed[20];
+		int n = 0;
+		uint64_t v = value;
+		do {
+			reversed[n++] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v != 0);
+		int len = 0;
+		while (n > 0) dest[len++] = reversed[--n];
+		return len;
+	}
+
+	// Same as %d. Returns number of characters written, not null terminated.
+	inline int format_decimal(char * const dest, const int32_t value) {
+		if (value < 0) {
+			dest[0] = '-';
+			return 1 + format_decimal64(dest + 1, 0u - (uint32_t)value);
+		}
+		return format_decimal64(dest, (uint32_t)value);
+	}
 }
 
 struct ReportWriter {
 	ReportWriter(const char * const filename);
+	// Output is appended to memory instead of a file. Used to format parts of a report on multiple threads.
+	ReportWriter(std::string &memory);
 	~ReportWriter();
 
-	FILE *report;
+	ReportWriter(const ReportWriter&) = delete;
+	ReportWriter& operator=(const ReportWriter&) = delete;
+
 	int indentation=0;
 
 	void writeComment(const char * const str);
 	void writeComment(snestistics::StringBuilder &sb);
 	void writeSeperator(const char * const text);
-};
\ No newline at end of file
+
+	void write(const char * const str, const uint32_t len) {
+		if (_used + len > _capacity && !make_room(len)) {
+			write_direct(str, len);
+			return;
+		}
+		memcpy(_buffer + _used, str, len);
+		_used += len;
+	}
+	void write(const char * const str) { write(str, (uint32_t)strlen(str)); }
+	void write(const std::string &str) { write(str.c_str(), (uint32_t)str.length()); }
+	void write(const char c) {
+		reserve(1);
+		_buffer[_used++] = c;
+	}
+	void repeat(const char c, const int count) {
+		for (int left = count; left > 0; ) {
+			reserve(1);
+			const uint32_t n = std::min((uint32_t)left, _capacity - _used);
+			memset(_buffer + _used, c, n);
+			_used += n;
+			left -= n;
+		}
+	}
+	int hex(const uint32_t value, const int digits) {
+		reserve(8);
+		const int n = snestistics::format_hex(_buffer + _used, value, digits);
+		_used += n;
+		return n;
+	}
+	int decimal(const int32_t value) {
+		reserve(11);
+		const int n = snestistics::format_decimal(_buffer + _used, value);
+		_used += n;
+		return n;
+	}
+
+	// printf-style, for the things not worth hand formatting. Returns number of characters written.
+	int format(const char * const fmt, ...);
+
+	void flush();
+
+	uint64_t bytes_written() const { return _bytes_flushed + _used; }
+
+private:
+	static const uint32_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+	void reserve(const uint32_t len) {
+		if (_used + len > _capacity) make_room(len);
+	}
+	bool make_room(const uint32_t len); // False if len does not fit in the buffer even after a flush
+	void write_direct(const char * const str, const uint32_t len);
+
+	FILE *_file;
+	std::string *_memory = nullptr;
+	size_t _memory_start = 0;       // Length of the string when the writer was created, the buffer is what follows
+	char *_buffer = nullptr;
+	uint32_t _capacity = 0;
+	uint32_t _used = 0;
+	uint64_t _bytes_flushed = 0;
+};
+
+/*
+	Like Profile but also reports how fast a report was written. Uses wall clock time since output might be formatted on multiple threads.
+*/
+struct ReportWriterProfile {
+	const char * const _msg;
+	const ReportWriter &_writer;
+	const uint64_t _start_bytes;
+	const std::chrono::steady_clock::time_point _start;
+	ReportWriterProfile(const char * const msg, const ReportWriter &writer) : _msg(msg), _writer(writer), _start_bytes(writer.bytes_written()), _start(std::chrono::steady_clock::now()) {}
+	~ReportWriterProfile() {
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		const double mb = (_writer.bytes_written() - _start_bytes) / (1024.0 * 1024.0);
+		if (elapsed > 0.01) {
+			printf(" >%s: %.2f MB in %.2f seconds (%.2f MB/s)\n", _msg, mb, elapsed, mb / elapsed);
+		}
+	}
+};
@@ -54,6 +54,9 @@ public:
 		return false;
 	}
 
+	// Entire ROM file, including header
+	const Array<uint8_t> &data() const { return _rom_data; }
+
 	Pointer lorom_bank_remap(const Pointer resolve_address) const {
 		uint16_t adr = resolve_address & 0xffff;
 		if (adr >= 0x8000) return resolve_address;
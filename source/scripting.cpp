@@ -232,6 +232,40 @@ namespace scripting_interface {
 			return 1;
 		}
 
+		// All registers in one call, saves a VM to native transition per register
+		SQInteger api_replay_registers(HSQUIRRELVM v) {
+			const Registers *r = register_func(v);
+			sq_newtable(v);
+			const SQChar * const names[] = { _SC("pc"), _SC("a"), _SC("x"), _SC("y"), _SC("p"), _SC("s"), _SC("dp"), _SC("db") };
+			const uint32_t values[] = { r->pc, r->a, r->x, r->y, r->p, r->s, r->dp, r->db };
+			for (int i = 0; i < 8; i++) {
+				sq_pushstring(v, names[i], -1);
+				sq_pushinteger(v, values[i]);
+				sq_newslot(v, -3, SQFalse);
+			}
+			return 1;
+		}
+		SQInteger api_replay_read_block(HSQUIRRELVM v) {
+			Scripting *scripting = static_cast<Scripting*>(sq_getforeignptr(v));
+			Replay *t = scripting->class_replay->native_ptr<Replay>(v);
+			SQInteger address, length;
+			sq_getinteger(v, 2, &address);
+			sq_getinteger(v, 3, &length);
+			if (length < 0 || length > 0x10000)
+				return sq_throwerror(v, _SC("read_block length must be between 0 and 65536"));
+			sq_newarray(v, 0);
+			uint8_t block[256];
+			for (SQInteger i = 0; i < length; i += sizeof(block)) {
+				const uint32_t n = (uint32_t)std::min<SQInteger>(length - i, sizeof(block));
+				replay_read_block(t, (uint32_t)(address + i), block, n);
+				for (uint32_t k = 0; k < n; k++) {
+					sq_pushinteger(v, block[k]);
+					sq_arrayappend(v, -2);
+				}
+			}
+			return 1;
+		}
+
 		SQInteger api_replay_set_breakpoint(HSQUIRRELVM v) {
 			Scripting *scripting = static_cast<Scripting*>(sq_getforeignptr(v));
 			Replay *t = scripting->class_replay->native_ptr<Replay>(v);
@@ -249,6 +283,25 @@ namespace scripting_interface {
 			replay_set_breakpoint_range(t, (uint32_t)pc0, (uint32_t)pc1);
 			return 0;
 		}
+		SQInteger api_replay_set_watchpoint(HSQUIRRELVM v) {
+			Scripting *scripting = static_cast<Scripting*>(sq_getforeignptr(v));
+			Replay *t = scripting->class_replay->native_ptr<Replay>(v);
+			SQInteger address, kinds;
+			sq_getinteger(v, 2, &address);
+			sq_getinteger(v, 3, &kinds);
+			replay_set_watchpoint(t, (uint32_t)address, (uint32_t)kinds);
+			return 0;
+		}
+		SQInteger api_replay_set_watchpoint_range(HSQUIRRELVM v) {
+			Scripting *scripting = static_cast<Scripting*>(sq_getforeignptr(v));
+			Replay *t = scripting->class_replay->native_ptr<Replay>(v);
+			SQInteger address0, address1, kinds;
+			sq_getinteger(v, 2, &address0);
+			sq_getinteger(v, 3, &address1);
+			sq_getinteger(v, 4, &kinds);
+			replay_set_watchpoint_range(t, (uint32_t)address0, (uint32_t)address1, (uint32_t)kinds);
+			return 0;
+		}
 		SQInteger api_report_writer_print(HSQUIRRELVM v) {
 			Scripting *scripting = static_cast<Scripting*>(sq_getforeignptr(v));
 			ReportWriter *t = scripting->class_report_writer->native_ptr<ReportWriter>(v);
@@ -281,8 +334,24 @@ namespace scripting_interface {
 				e.add_function("read_byte", api_replay_read_byte);
 				e.add_function("read_word", api_replay_read_word);
 				e.add_function("read_long", api_replay_read_long);
+				e.add_function("registers", api_replay_registers);
+				e.add_function("read_block", api_replay_read_block);
 				e.add_function("set_breakpoint", api_replay_set_breakpoint);
 				e.add_function("set_breakpoint_range", api_replay_set_breakpoint_range);
+				e.add_function("set_watchpoint", api_replay_set_watchpoint);
+				e.add_function("set_watchpoint_range", api_replay_set_watchpoint_range);
+			}
+			{
+				ScopedValidateTop top(v);
+				sq_pushroottable(v);
+				const SQChar * const names[] = { _SC("WATCH_READ"), _SC("WATCH_WRITE"), _SC("WATCH_CHANGE") };
+				const SQInteger values[] = { REPLAY_WATCH_READ, REPLAY_WATCH_WRITE, REPLAY_WATCH_CHANGE };
+				for (int i = 0; i < 3; i++) {
+					sq_pushstring(v, names[i], -1);
+					sq_pushinteger(v, values[i]);
+					sq_newslot(v, -3, SQFalse);
+				}
+				sq_pop(v, 1);
 			}
 			{
 				ScopedValidateTop top(v);
@@ -393,4 +462,27 @@ namespace scripting_interface {
 		}
 		sq_settop(v, top);
 	}
+
+	void scripting_trace_log_watchpoint(Scripting *scripting, ScriptingHandle replay, ScriptingHandle report_writer, uint32_t address, uint8_t value, uint8_t old_value, uint32_t kind) {
+		HSQUIRRELVM &v = scripting->v;
+		SQInteger top = sq_gettop(v);
+		sq_pushroottable(v);
+		sq_pushstring(v, _SC("trace_log_watchpoint"), -1);
+		bool success = SQ_SUCCEEDED(sq_get(v, -2));
+		if (success) {
+			sq_pushroottable(v);
+			sq_pushobject(v, *(HSQOBJECT*)replay);
+			sq_pushobject(v, *(HSQOBJECT*)report_writer);
+			sq_pushinteger(v, address);
+			sq_pushinteger(v, value);
+			sq_pushinteger(v, old_value);
+			sq_pushinteger(v, kind);
+			sq_call(v, 7, SQTrue, SQTrue);
+			sq_pop(v, 1);
+		}
+		else {
+			printf("trace_log_watchpoint not found in script!");
+		}
+		sq_settop(v, top);
+	}
 }
\ No newline at end of file
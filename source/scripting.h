@@ -25,5 +25,6 @@ namespace scripting_interface {
 
 	void scripting_trace_log_init(Scripting *scripting, ScriptingHandle replay);
 	void scripting_trace_log_parameter_printer(Scripting *scripting, ScriptingHandle replay, ScriptingHandle report_writer);
+	void scripting_trace_log_watchpoint(Scripting *scripting, ScriptingHandle replay, ScriptingHandle report_writer, uint32_t address, uint8_t value, uint8_t old_value, uint32_t kind);
 
 }
\ No newline at end of file
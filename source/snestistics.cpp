@@ -19,22 +19,27 @@
 #include "cputable.h"
 #include "trace_log.h"
 #include "trace.h"
+#include "trace_set.h"
 #include "rewind.h"
+#include "frame_budget.h"
+#include "call_graph.h"
+#include "dma_timeline.h"
 #include "scripting.h"
 #include "report_writer.h"
 #include "symbol_export.h"
 #include "auto_annotate.h"
 #include "predict.h"
+#include "plugin.h"
+#include "replay.h"
 
 using namespace snestistics;
 
 void dma_report(ReportWriter &writer, const Trace &trace, const AnnotationResolver &annotations) {
-	Profile profile("DMA report", true);
 	writer.writeSeperator("DMA analysis");
 	writer.writeComment("");
 	writer.writeComment("Currently not sure if we can deduce step or not!");
 	writer.writeComment("Currently not doing anything with data annotations! Let me know what I could do!");
-	writer.writeComment("HDMA is not supported. Can be added in.");
+	writer.writeComment("HDMA lists the table address when the channel is enabled, bytes are only known per scanline.");
 	writer.writeComment("");
 
 	StringBuilder sb;
@@ -70,7 +75,10 @@ void dma_report(ReportWriter &writer, const Trace &trace, const AnnotationResolv
 		if (d.b_address == 0x80) {
 			target = d.wram;
 		}
-		sb.column(24); sb.format("$%05X $%02X:$%04X %s $%02X:%04X (mode=$%02X)%s%s", d.transfer_bytes == 0 ? 0x10000 : d.transfer_bytes, d.a_bank, d.a_address, d.flags & DmaTransfer::REVERSE_TRANSFER ? "<-":"->", target>>16, target&0xFFFF, d.transfer_mode, d.flags & DmaTransfer::A_ADDRESS_DECREMENT ?" (dec)":" (inc)", d.flags & DmaTransfer::A_ADDRESS_FIXED ? " (fixed)":"");
+		sb.column(24); if (d.flags & DmaTransfer::HDMA)
+			sb.format("HDMA   $%02X:$%04X %s $%02X:%04X (mode=$%02X)%s", d.a_bank, d.a_address, d.flags & DmaTransfer::REVERSE_TRANSFER ? "<-":"->", target>>16, target&0xFFFF, d.transfer_mode, d.flags & DmaTransfer::HDMA_INDIRECT ? " (indirect)":"");
+		else
+			sb.format("$%05X $%02X:$%04X %s $%02X:%04X (mode=$%02X)%s%s", d.num_bytes(), d.a_bank, d.a_address, d.flags & DmaTransfer::REVERSE_TRANSFER ? "<-":"->", target>>16, target&0xFFFF, d.transfer_mode, d.flags & DmaTransfer::A_ADDRESS_DECREMENT ?" (dec)":" (inc)", d.flags & DmaTransfer::A_ADDRESS_FIXED ? " (fixed)":"");
 
 		if (print_pc) {
 			sb.column(86);  sb.format("at pc=$%06X", d.pc);
@@ -79,10 +87,48 @@ void dma_report(ReportWriter &writer, const Trace &trace, const AnnotationResolv
 	}
 }
 
+namespace {
+
+// Who accessed one address, functions as annotation index and pc for accesses outside functions
+struct DataAccessors {
+	std::vector<int> readers, writers;
+	std::vector<Pointer> unknown_readers, unknown_writers;
+
+	void clear() {
+		readers.clear(); writers.clear();
+		unknown_readers.clear(); unknown_writers.clear();
+	}
+	void sort_unique() {
+		sort_unique(readers); sort_unique(writers);
+		sort_unique(unknown_readers); sort_unique(unknown_writers);
+	}
+	bool operator==(const DataAccessors &o) const {
+		return readers == o.readers && writers == o.writers && unknown_readers == o.unknown_readers && unknown_writers == o.unknown_writers;
+	}
+	bool empty() const {
+		return readers.empty() && writers.empty() && unknown_readers.empty() && unknown_writers.empty();
+	}
+private:
+	template<typename T>
+	static void sort_unique(std::vector<T> &v) {
+		std::sort(v.begin(), v.end());
+		v.erase(std::unique(v.begin(), v.end()), v.end());
+	}
+};
+
+// Known functions first, then pcs outside functions
+void emit_accessor(StringBuilder &sb, const AnnotationResolver &annotations, const std::vector<int> &known, const std::vector<Pointer> &unknown, const size_t index) {
+	if (index < known.size())
+		sb.format("%s", annotations._annotations[known[index]].name.c_str());
+	else
+		sb.format("%06X", unknown[index - known.size()]);
+}
+
+}
+
 void data_report(ReportWriter &writer, const Trace &trace, const AnnotationResolver &annotations, const bool include_hwregs = true, const bool include_7e7f = true) {
 	StringBuilder sb;
 
-	Profile profile("Data report", true);
 	writer.writeSeperator("Data analysis");
 
 	sb.clear();
@@ -95,183 +141,100 @@ void data_report(ReportWriter &writer, const Trace &trace, const AnnotationResol
 	sb.format("ANNOTATIONS");
 	writer.writeSeperator(sb.c_str());
 
+	// Adjacent addresses (in the trace) with the same accessors and data annotation are printed as one range
 	Pointer first_global = INVALID_POINTER, last_global = INVALID_POINTER;
-
-	std::set<const Annotation*> global_readers;
-	std::set<uint32_t> global_unknown_readers;
-	std::set<const Annotation*> global_writers;
-	std::set<uint32_t> global_unknown_writers;
+	DataAccessors global, current;
 	const Annotation *global_data = nullptr;
 
-	for (uint32_t p = 0; p < trace.memory_accesses.size(); ) {
-		const Trace::MemoryAccess ra = trace.memory_accesses[p];
-		Pointer adress = ra.adress;
+	const auto print_range = [&]() {
+		const size_t num_readers = global.readers.size() + global.unknown_readers.size();
+		const size_t num_writers = global.writers.size() + global.unknown_writers.size();
+		for (size_t line = 0; line < num_readers || line < num_writers; ++line) {
+			sb.clear();
+			if (line == 0) {
+				if (first_global != last_global)
+					sb.format("%06X-%06X", first_global, last_global);
+				else
+					sb.format("%06X", first_global);
+			}
+			if (line < num_readers) {
+				sb.column(20);
+				emit_accessor(sb, annotations, global.readers, global.unknown_readers, line);
+			}
+			if (line < num_writers) {
+				sb.column(60);
+				emit_accessor(sb, annotations, global.writers, global.unknown_writers, line);
+			}
+			if (line == 0 && global_data) {
+				sb.column(90);
+				sb.format("%s [%06X-%06X]", global_data->name.c_str(), global_data->startOfRange, global_data->endOfRange);
+			}
+			writer.writeComment(sb);
+		}
+	};
+
+	const std::vector<Trace::MemoryAccess> &accesses = trace.memory_accesses;
+	for (size_t p = 0; p < accesses.size(); ) {
+		const Pointer adress = accesses[p].adress;
+
+		// All accesses to this adress
+		size_t end = p + 1;
+		while (end < accesses.size() && accesses[end].adress == adress) end++;
+		const size_t begin = p;
+		p = end;
 
 		// This code ignores data reads from WRAM and/or hardware registers (if requested)
 		{
 			const uint8_t bank = adress>>16;
 			const uint32_t bank_less_adress = adress&0xFFFF;
 			if (bank == 0x7E || bank == 0x7F) {
-				if (!include_7e7f) {
-					p++;
+				if (!include_7e7f)
 					continue;
-				}
 			} else if (!include_hwregs && bank_less_adress >= 0x2000 && bank_less_adress <= 0x43FF) {
-				p++;
 				continue;
 			}
 		}
 
-		const Annotation *data = nullptr;
-
 		// Don't care about accesses to code
 		// TODO: Check so we don't write code?
+		const Annotation *data = nullptr;
 		{
 			const Annotation *accessed_function = nullptr;
 			annotations.resolve_annotation(adress, &accessed_function, &data);
-			if (accessed_function != nullptr) {
-				for (uint32_t j=p; j<trace.memory_accesses.size(); j++, p++) {
-					const Trace::MemoryAccess rb = trace.memory_accesses[j];
-					if (adress != rb.adress) break;
-				}
+			if (accessed_function != nullptr)
 				continue;
-			}
 		}
 
-		bool need_flush = false;
-		std::set<const Annotation*> new_readers;
-		std::set<uint32_t> new_unknown_readers;
-		std::set<const Annotation*> new_writers;
-		std::set<uint32_t> new_unknown_writers;
-
-		for (uint32_t j=p; j<trace.memory_accesses.size(); j++, p++) {
-			const Trace::MemoryAccess rb = trace.memory_accesses[j];
-			if (adress != rb.adress) break;
-
-			const bool is_write = (rb.pc & 0x80000000)!=0;
-			const Pointer pc = is_write ? rb.pc & ~0x80000000 : rb.pc;
-
-			const Annotation *our_function = nullptr;
-			annotations.resolve_annotation(pc, &our_function);
-
-			if (our_function) {
-				if (is_write) {
-					new_writers.insert(our_function);
-					if (!need_flush && global_writers.find(our_function) == global_writers.end()) need_flush = true;
-				} else {
-					new_readers.insert(our_function);
-					if (!need_flush && global_readers.find(our_function) == global_readers.end()) need_flush = true;
-				}
-			} else {
-				if (is_write) {
-					new_unknown_writers.insert(pc);
-					if (!need_flush && new_unknown_writers.find(pc) == new_unknown_writers.end()) need_flush = true;
-				} else {
-					new_unknown_readers.insert(pc);
-					if (!need_flush && global_unknown_readers.find(pc) == global_unknown_readers.end()) need_flush = true;
-				}
-			}
+		current.clear();
+		for (size_t j = begin; j < end; ++j) {
+			const bool is_write = (accesses[j].pc & 0x80000000)!=0;
+			const Pointer pc = accesses[j].pc & ~0x80000000;
+			const int function = annotations.function_index(pc);
+			if (function >= 0)
+				(is_write ? current.writers : current.readers).push_back(function);
+			else
+				(is_write ? current.unknown_writers : current.unknown_readers).push_back(pc);
 		}
+		current.sort_unique();
 
-		if (data != global_data)
-			need_flush = true;
-
-		// We know that we aren't adding any new readers/writers, but did we produce the same full list?
-		if (first_global != INVALID_POINTER) {
-			if ((new_readers.size() != global_readers.size()) || (global_unknown_readers.size() != new_unknown_readers.size())) {
-				need_flush = true;
-			}
-			if ((new_writers.size() != global_writers.size()) || (global_unknown_writers.size() != new_unknown_writers.size())) {
-				need_flush = true;
-			}
-		}
-
-		bool update_globals = false;
-		if (need_flush || first_global == INVALID_POINTER) {
-			update_globals = true;
+		if (first_global != INVALID_POINTER && data == global_data && current == global) {
+			last_global = adress;
+			continue;
 		}
 
-		struct AccessIterator {
-			AccessIterator(const std::set<const Annotation*> &known, const std::set<uint32_t> &unknown) : _known(known), _unknown(unknown) {}
-			const std::set<const Annotation*> &_known;
-			const std::set<uint32_t> &_unknown;
-
-			uint32_t _current = 0;
-			bool has() {
-				const uint32_t total = (uint32_t)_known.size() + (uint32_t)_unknown.size();
-				return _current < total;
-			}
-			void advance() {
-				_current++;
-			}
-			void emit(StringBuilder &sb) {
-				if (_current < _known.size()) {
-					auto it = _known.begin();
-					for (uint32_t i=0; i<_current; i++, it++);
-					const Annotation *a = *it;
-					sb.format("%s", a->name.c_str());
-				} else {
-					uint32_t lc = _current - (uint32_t)_known.size();
-					auto it = _unknown.begin();
-					for (uint32_t i=0; i<lc; i++, it++);
-					const uint32_t pc = *it;
-					sb.format("%06X", pc);
-				}
-			}
-		};
-
-		AccessIterator readers(global_readers, global_unknown_readers);
-		AccessIterator writers(global_writers, global_unknown_writers);
+		if (first_global != INVALID_POINTER)
+			print_range();
 
-		// If last range was finished, print it
-		if (need_flush) {
-			bool first_line = true;
-			while (readers.has() || writers.has()) {
-				sb.clear();
-				if (first_line) {
-					if (first_global != last_global)
-						sb.format("%06X-%06X", first_global, last_global);
-					else
-						sb.format("%06X", first_global);
-				}
-				if (readers.has()) {
-					sb.column(20);
-					readers.emit(sb);
-				}
-				if (writers.has()) {
-					sb.column(60);
-					writers.emit(sb);
-				}
-				if (first_line) {
-					if (global_data) {
-						sb.column(90);
-						sb.format("%s [%06X-%06X]", global_data->name.c_str(), global_data->startOfRange, global_data->endOfRange);
-					}
-				}
-				writer.writeComment(sb);
-				first_line = false;
-				readers.advance();
-				writers.advance();
-			}
-			first_global = last_global = adress;
-		} else {
-			if (first_global == INVALID_POINTER) first_global = adress;
-			last_global = adress;
-		}
-		
-		if (update_globals) {
-			std::swap(global_readers, new_readers);
-			std::swap(global_writers, new_writers);
-			std::swap(global_unknown_readers, new_unknown_readers);
-			std::swap(global_unknown_writers, new_unknown_writers);
-			global_data = data;
-		}
+		first_global = last_global = adress;
+		std::swap(global, current);
+		global_data = data;
 	}
 
-	// TODO: Print last range
+	if (first_global != INVALID_POINTER)
+		print_range();
 }
 
-void branch_report(ReportWriter &writer, const RomAccessor &rom, const Trace &op_trace, const AnnotationResolver &annotations) {
+void branch_report(ReportWriter &writer, const DecodedOps &decoded, const AnnotationResolver &annotations) {
 	StringBuilder sb;
 	writer.writeSeperator("Branch analysis");
 	writer.writeComment("NOTE: Branches between two functions could mean that they really are one function.");
@@ -281,14 +244,14 @@ void branch_report(ReportWriter &writer, const RomAccessor &rom, const Trace &op
 
 	sb.clear();
 
-	for (const auto &it : op_trace.ops) {
-		const Pointer pc = it.first;
-		uint8_t opcode = rom.evalByte(pc);
+	for (const DecodedOp &d : decoded) {
+		const Pointer pc = d.pc;
+		uint8_t opcode = d.opcode;
 		if (!branches[opcode])
 			continue;
 
 		for (int myloop = 0; myloop < 2; myloop++) {
-			Pointer target = myloop == 0 ? branch8(pc, rom.evalByte(pc+1)) : pc + 2;
+			Pointer target = myloop == 0 ? d.jump_target : pc + 2;
 			if (myloop == 1 && opcode == 0x80)
 				break;
 
@@ -385,53 +348,93 @@ void entry_point_report(ReportWriter &writer, const Trace &trace, const Annotati
 */
 }
 
-enum class KeepMode {
-	UNION, DIFFERENCE, A_MINUS_B
-};
+void hot_function_report(ReportWriter &writer, const Trace &trace, const AnnotationResolver &annotations) {
+	writer.writeSeperator("Hot functions");
+	writer.writeComment("Cycles are estimated from the opcodes and give a rough idea only.");
+	writer.writeComment("Frames is the most number of NMIs any op of the function executed in.");
+	writer.writeComment("");
 
-std::vector<Trace::MemoryAccess> fix_memory_accesses(const std::vector<Trace::MemoryAccess> &a, const std::vector<Trace::MemoryAccess> &b, KeepMode mode, bool ignore_pc = false) {
-	auto it_a = a.begin();
-	auto it_b = b.begin();
+	StringBuilder sb;
 
-	std::vector<Trace::MemoryAccess> result;
-	result.reserve(std::max(a.size(), b.size()));
+	if (!trace.executed_per_nmi.empty()) {
+		uint64_t total_count = 0, total_cycles = 0;
+		uint32_t max_nmi = 0;
+		for (uint32_t i = 0; i < trace.executed_per_nmi.size(); ++i) {
+			const Trace::NmiExecution &n = trace.executed_per_nmi[i];
+			total_count += n.count;
+			total_cycles += n.cycles;
+			if (n.cycles > trace.executed_per_nmi[max_nmi].cycles)
+				max_nmi = i;
+		}
+		const uint64_t num_nmis = trace.executed_per_nmi.size();
+		sb.clear();
+		sb.format("%llu NMIs, per NMI %llu ops and %llu cycles on average", (unsigned long long)num_nmis, (unsigned long long)(total_count / num_nmis), (unsigned long long)(total_cycles / num_nmis));
+		writer.writeComment(sb);
+		// Index 0 is before the first NMI
+		sb.clear();
+		if (max_nmi == 0)
+			sb.format("Most cycles before the first NMI");
+		else
+			sb.format("Most cycles in NMI %d", max_nmi - 1);
+		sb.format(" with %llu ops and %llu cycles", (unsigned long long)trace.executed_per_nmi[max_nmi].count, (unsigned long long)trace.executed_per_nmi[max_nmi].cycles);
+		writer.writeComment(sb);
+		writer.writeComment("");
+	}
 
-	while (it_a != a.end() && it_b != b.end()) {
-		bool a_less_b = ignore_pc ? (it_a->adress < it_b->adress) : *it_a < *it_b;
-		bool b_less_a = ignore_pc ? (it_b->adress < it_a->adress) : *it_b < *it_a;
+	// Slot 0 is for ops outside all functions
+	struct FunctionExecution {
+		int function;
+		uint64_t count, cycles;
+		uint32_t nmis;
+	};
+	std::vector<FunctionExecution> functions(annotations._annotations.size() + 1);
+	for (size_t i = 0; i < functions.size(); ++i) {
+		FunctionExecution &f = functions[i];
+		f.function = (int)i - 1;
+		f.count = f.cycles = 0;
+		f.nmis = 0;
+	}
 
-		// Since are increasing (not becoming <) when increasing the iterator an element that is smaller has to be unique
+	uint64_t total_cycles = 0;
+	for (const Trace::OpExecution &e : trace.executed_ops) {
+		FunctionExecution &f = functions[annotations.function_index(e.pc) + 1];
+		f.count += e.count;
+		f.cycles += e.cycles;
+		f.nmis = std::max(f.nmis, e.nmis);
+		total_cycles += e.cycles;
+	}
 
-		if (a_less_b) {
-			// We know that A is unique
-			if (mode == KeepMode::A_MINUS_B || mode == KeepMode::DIFFERENCE) {
-				result.push_back(*it_a);
-			}
-			it_a++;
-		} else if (b_less_a) {
-			// We know that B is unique
-			if (mode == KeepMode::DIFFERENCE) {
-				result.push_back(*it_a);
-			}
-			it_b++;
-		} else {
-			if (mode == KeepMode::UNION) {
-				result.push_back(*it_a);
-			}
-			it_a++;
-			it_b++;
-		}
+	std::stable_sort(functions.begin(), functions.end(), [](const FunctionExecution &a, const FunctionExecution &b) {
+		return a.cycles > b.cycles;
+	});
+
+	writer.writeComment("        Cycles      %        Executed   Frames  Function");
+	for (const FunctionExecution &f : functions) {
+		if (f.count == 0)
+			break;
+		sb.clear();
+		sb.format("%14llu %5.1f%% %15llu %8u  %s", (unsigned long long)f.cycles, 100.0 * f.cycles / total_cycles, (unsigned long long)f.count, f.nmis,
+			f.function == -1 ? "(outside functions)" : annotations._annotations[f.function].name.c_str());
+		writer.writeComment(sb);
 	}
-	return result;
 }
 
-int main2(const int argc, const char * const argv[]) {
+int main(const int argc, const char * const argv[]) {
 	try {
 		initLookupTables();
 
 		Options options;
 		parse_options(argc, argv, options);
 
+		if (!options.trace_log_render_file.empty()) {
+			if (options.rendered_trace_log_out_file.empty())
+				throw std::runtime_error("Rendering a binary trace log needs -renderedtracelogoutfile");
+			Profile profile("Render binary trace log");
+			render_trace_log(options);
+			if (options.rom_file.empty())
+				return 0;
+		}
+
 		printf("Loading ROM '%s'\n", options.rom_file.c_str());
 
 		// TODO: TraceHeader has rom_size and rom_mode (lorom/hirom) so lets read them!
@@ -441,95 +444,39 @@ int main2(const int argc, const char * const argv[]) {
 			rom_accessor.load(options.rom_file);
 		}
 
-
-		Trace intro;
-		Trace level1;
-		Trace level2;
-		Trace level3;
-
-		#pragma omp parallel for
-		for (int k=0; k<4; k++) {
-			if (k == 0) create_or_load_trace("diff_trace/intro.trace",  rom_accessor, intro);
-			if (k == 1) create_or_load_trace("diff_trace/level1.trace", rom_accessor, level1);
-			if (k == 2) create_or_load_trace("diff_trace/level2.trace", rom_accessor, level2);
-			if (k == 3) create_or_load_trace("diff_trace/level3.trace", rom_accessor, level3);
-		}
-
-		level1.memory_accesses = fix_memory_accesses(level1.memory_accesses, intro.memory_accesses, KeepMode::A_MINUS_B);
-		level2.memory_accesses = fix_memory_accesses(level2.memory_accesses, intro.memory_accesses, KeepMode::A_MINUS_B);
-		level3.memory_accesses = fix_memory_accesses(level3.memory_accesses, intro.memory_accesses, KeepMode::A_MINUS_B);
-
-		const Trace level1_full = level1, level2_full = level2, level3_full = level3;
-
-		level1.memory_accesses = fix_memory_accesses(level1.memory_accesses, level2_full.memory_accesses, KeepMode::A_MINUS_B);
-		level1.memory_accesses = fix_memory_accesses(level1.memory_accesses, level3_full.memory_accesses, KeepMode::A_MINUS_B);
-
-		level2.memory_accesses = fix_memory_accesses(level2.memory_accesses, level1_full.memory_accesses, KeepMode::A_MINUS_B);
-		level2.memory_accesses = fix_memory_accesses(level2.memory_accesses, level3_full.memory_accesses, KeepMode::A_MINUS_B);
-
-		level3.memory_accesses = fix_memory_accesses(level3.memory_accesses, level1_full.memory_accesses, KeepMode::A_MINUS_B);
-		level3.memory_accesses = fix_memory_accesses(level3.memory_accesses, level2_full.memory_accesses, KeepMode::A_MINUS_B);
-		
-		// We need a "only" keep same... now we have remove same
-
-		AnnotationResolver annotations;
-		{
-			Profile profile("Loading game annotations");
-			annotations.add_mmio_annotations();
-			annotations.add_vector_annotations(rom_accessor);
-			if (options.auto_labels_file.empty()) {
-				// Don't load the auto-labels file if we are re-generating it
-				annotations.load(options.labels_files);
-			} else {
-				std::vector<std::string> copy(options.labels_files);
-				copy.push_back(options.auto_labels_file);
-				annotations.load(copy);
+		bool auto_file_exists = false;
+		if (!options.auto_labels_file.empty()) {
+			FILE *test_file = fopen(options.auto_labels_file.c_str(), "rb");
+			auto_file_exists = test_file != NULL;
+			if (test_file != NULL) {
+				fclose(test_file);
 			}
 		}
+		const bool regenerate_auto_labels = !options.auto_labels_file.empty() && (options.auto_annotate || !auto_file_exists);
 
-		std::unique_ptr<ReportWriter> report_writer;
-		if (!options.report_out_file.empty())
-			report_writer.reset(new ReportWriter(options.report_out_file.c_str()));
+		const bool want_trace_log = !options.trace_log_out_file.empty() || !options.trace_log_binary_out_file.empty();
 
-		report_writer->writeSeperator("Level1");
-		data_report(*report_writer, level1, annotations, false, false);
+		// Recording a single trace can share its replay with the trace log and plugins.
+		// Not if auto labels are regenerated since that needs the trace before the annotations are loaded.
+		const bool can_share_recording = options.trace_files.size() == 1 && options.trace_expression.empty() && !regenerate_auto_labels && (want_trace_log || !options.plugin_files.empty());
+		bool record_in_shared_replay = false;
 
-		report_writer->writeSeperator("Level2 only");
-		data_report(*report_writer, level2, annotations, false, false);
-
-		report_writer->writeSeperator("Level3 only");
-		data_report(*report_writer, level3, annotations, false, false);
-
-	} catch (const std::runtime_error &e) {
-		printf("error: %s\n", e.what());
-		return 1;
-	} catch (const std::exception &e) {
-		printf("error: %s\n", e.what());
-		return 1;
-	}
-
-	return 0;
-}
-
-int main(const int argc, const char * const argv[]) {
-	try {
-		initLookupTables();
-
-		Options options;
-		parse_options(argc, argv, options);
-
-		printf("Loading ROM '%s'\n", options.rom_file.c_str());
+		Trace trace;
 
-		// TODO: TraceHeader has rom_size and rom_mode (lorom/hirom) so lets read them!
-		RomAccessor rom_accessor(options.rom_size);
-		{
-			Profile profile("Load ROM data");
-			rom_accessor.load(options.rom_file);
+		if (!options.trace_expression.empty()) {
+			// All traces are needed before they can be combined
+			std::vector<Trace> traces(options.trace_files.size());
+			#pragma omp parallel for schedule(dynamic)
+			for (int k=0; k<(int)options.trace_files.size(); ++k) {
+				create_or_load_trace(options.trace_files[k], rom_accessor, traces[k]);
+			}
+			std::vector<const Trace*> inputs;
+			for (const Trace &t : traces)
+				inputs.push_back(&t);
+			evaluate_trace_expression(options.trace_expression, inputs, trace);
 		}
 
-		Trace trace;
-
-		for (uint32_t k=0; k<options.trace_files.size(); ++k) {
+		for (uint32_t k=0; k<options.trace_files.size() && options.trace_expression.empty(); ++k) {
 			bool generate = true;
 
 			Trace backing_trace;
@@ -538,7 +485,9 @@ int main(const int argc, const char * const argv[]) {
 			if (load_trace_cache(options.trace_files[k], local_trace))
 				generate = false;
 
-			if (generate) {
+			if (generate && can_share_recording) {
+				record_in_shared_replay = true;
+			} else if (generate) {
 				Profile profile("Create trace using emulation");
 				create_trace(options.trace_files[k], rom_accessor, local_trace); // Will automatically save new cache
 			}
@@ -548,20 +497,16 @@ int main(const int argc, const char * const argv[]) {
 			}
 		}
 
-		if (!options.auto_labels_file.empty()) {
-			FILE *test_file = fopen(options.auto_labels_file.c_str(), "rb");
-			bool auto_file_exists = test_file != NULL;
-			if (test_file != NULL) {
-				fclose(test_file);
-			}
-			
-			if (options.auto_annotate || !auto_file_exists) {
-				Profile profile("Regenerating auto-labels");
-				// We load annotations here since we want to avoid the annotation file
-				AnnotationResolver annotations;
-				annotations.load(options.labels_files);
-				guess_range(trace, rom_accessor, annotations, options.auto_labels_file);
-			}
+		// Decoded ops are shared by everything looking at the trace
+		DecodedOps decoded_ops;
+
+		if (regenerate_auto_labels) {
+			Profile profile("Regenerating auto-labels");
+			// We load annotations here since we want to avoid the annotation file
+			AnnotationResolver annotations;
+			annotations.load(options.labels_files);
+			decode_ops(trace, rom_accessor, decoded_ops);
+			guess_range(decoded_ops, annotations, options.auto_labels_file);
 		}
 
 		AnnotationResolver annotations;
@@ -571,11 +516,11 @@ int main(const int argc, const char * const argv[]) {
 			annotations.add_vector_annotations(rom_accessor);
 			if (options.auto_labels_file.empty()) {
 				// Don't load the auto-labels file if we are re-generating it
-				annotations.load(options.labels_files);
+				annotations.load(options.labels_files, options.labels_cache_file);
 			} else {
 				std::vector<std::string> copy(options.labels_files);
 				copy.push_back(options.auto_labels_file);
-				annotations.load(copy);
+				annotations.load(copy, options.labels_cache_file);
 			}
 		}
 
@@ -588,26 +533,68 @@ int main(const int argc, const char * const argv[]) {
 			symbol_export_mesen_s(annotations, options.symbol_mesen_s_out_file);
 		}
 
-		// Make sure this happens after create_trace so skip file is fresh
+		scripting_interface::Scripting *scripting = nullptr;
+		if (want_trace_log && !options.script_file.empty())
+			scripting = scripting_interface::create_scripting(options.script_file.c_str());
+
+		// Everything that replays the trace runs as stages on one replay so each frame is emulated once.
+		// A trace log on its own can instead be created in parallel.
+		if (want_trace_log && !record_in_shared_replay && options.plugin_files.empty()) {
+			Profile profile("Create trace log");
+			write_trace_log(options, rom_accessor, annotations, scripting);
+		} else if (record_in_shared_replay || want_trace_log || !options.plugin_files.empty()) {
+			Profile profile("Replay");
+
+			std::vector<ReplayStage> stages;
+
+			TraceRecording *recording = nullptr;
+			if (record_in_shared_replay) {
+				recording = create_trace_recording(options.trace_files[0], trace);
+				stages.push_back(trace_recording_stage(recording));
+			}
+
+			TraceLogWriting *trace_log = nullptr;
+			if (want_trace_log) {
+				trace_log = create_trace_log_writing(options, annotations, scripting);
+				stages.push_back(trace_log_stage(trace_log, options));
+			}
+
+			std::unique_ptr<PluginHost> plugins;
+			if (!options.plugin_files.empty()) {
+				plugins.reset(new PluginHost(options.plugin_files, options.plugin_argument));
+				stages.push_back(plugin_stage(*plugins, options));
+			}
+
+			run_replay_stages(rom_accessor, options.trace_files[0].c_str(), stages);
+
+			if (trace_log)
+				destroy_trace_log_writing(trace_log);
+			if (recording)
+				destroy_trace_recording(recording);
+		}
+
+		if (scripting)
+			scripting_interface::destroy_scripting(scripting);
+
+		// Make sure this happens after the trace is recorded so skip file is fresh
+		// Rewind emulates backwards from its own starting point so it has a replay of its own
 		if (!options.rewind_out_file.empty()) {
 			rewind_report(options, rom_accessor, annotations);
 		}
 
-		// Write trace log if requested
-		if (!options.trace_log_out_file.empty()) {
-			Profile profile("Create trace log");
-
-			bool has_scripting = !options.script_file.empty();
+		if (!options.frame_budget_out_file.empty()) {
+			Profile profile("Frame budget");
+			frame_budget_report(options, rom_accessor, annotations);
+		}
 
-			scripting_interface::Scripting *scripting = nullptr;
-			
-			if (!options.script_file.empty())
-				scripting = scripting_interface::create_scripting(options.script_file.c_str());
-			
-			write_trace_log(options, rom_accessor, annotations, scripting);
+		if (!options.call_graph_out_file.empty()) {
+			Profile profile("Call graph");
+			call_graph_report(options, rom_accessor, annotations);
+		}
 
-			if (scripting)
-				scripting_interface::destroy_scripting(scripting);
+		if (!options.dma_timeline_out_file.empty()) {
+			Profile profile("DMA timeline");
+			dma_timeline_report(options, rom_accessor, annotations);
 		}
 
 		std::unique_ptr<ReportWriter> report_writer;
@@ -615,19 +602,44 @@ int main(const int argc, const char * const argv[]) {
 			report_writer.reset(new ReportWriter(options.report_out_file.c_str()));
 
 		// TODO: Maybe run once before guess_range as well to find longer ranges
-		predict(options.predict, report_writer.get(), rom_accessor, trace, annotations);
+		// Trace might have been recorded above
+		decode_ops(trace, rom_accessor, decoded_ops);
+		predict(options.predict, report_writer.get(), rom_accessor, trace, decoded_ops, annotations);
 
 		if (!options.asm_out_file.empty()) {
 			Profile profile("Writing asm");
 			ReportWriter asm_output(options.asm_out_file.c_str());
-			asm_writer(asm_output, options, trace, annotations, rom_accessor);
+			ReportWriterProfile asm_profile("Asm output", asm_output);
+			asm_writer(asm_output, options, trace, decoded_ops, annotations, rom_accessor);
 		}
 
 		if (report_writer) {
-			data_report(*report_writer, trace, annotations);
-			dma_report(*report_writer, trace, annotations);
-			branch_report(*report_writer, rom_accessor, trace, annotations);
-			entry_point_report(*report_writer, trace, annotations);
+			// The reports only read the trace and annotations so they are formatted at the same time and then written in order
+			Profile profile("Writing reports");
+			const int num_reports = 5;
+			std::string reports[num_reports];
+			#pragma omp parallel for schedule(dynamic)
+			for (int r = 0; r < num_reports; ++r) {
+				ReportWriter writer(reports[r]);
+				if (r == 0) {
+					ReportWriterProfile report_profile("Data report", writer);
+					data_report(writer, trace, annotations);
+				} else if (r == 1) {
+					ReportWriterProfile report_profile("DMA report", writer);
+					dma_report(writer, trace, annotations);
+				} else if (r == 2) {
+					ReportWriterProfile report_profile("Branch report", writer);
+					branch_report(writer, decoded_ops, annotations);
+				} else if (r == 3) {
+					ReportWriterProfile report_profile("Entry point report", writer);
+					entry_point_report(writer, trace, annotations);
+				} else {
+					ReportWriterProfile report_profile("Hot function report", writer);
+					hot_function_report(writer, trace, annotations);
+				}
+			}
+			for (const std::string &report : reports)
+				report_writer->write(report);
 		}
 
 	} catch (const std::runtime_error &e) {
@@ -62,20 +62,50 @@ namespace std {
 	};
 }
 
-namespace {
+namespace snestistics {
 
-using namespace snestistics;
+/*
+	State while recording a trace. Recording is a replay stage so it can share the emulation with other analyses.
+	It also writes the emulation cache that lets later replays skip ahead.
+*/
+struct TraceRecording {
+	Trace *trace;
+	BigFile emu_cache;
+	TraceCacheHeader cache_header;
+
+	// Fast structures used during emulation
+	std::set<OpRecord> op_trace;
+	std::set<Trace::MemoryAccess> accesses;
+	std::set<DmaTransfer> dma_transfers;
 
-struct CallbackContext {
+	// Execution counters, one table per bank allocated when the bank first executes
+	struct ExecutionCounter {
+		uint64_t count = 0, cycles = 0;
+		uint32_t nmis = 0, last_nmi = ~0U;
+	};
+	std::vector<std::vector<ExecutionCounter>> executions;
+	std::vector<Trace::NmiExecution> executed_per_nmi;
+
+	// Registers before the op being replayed
 	Pointer current_pc = 0;
-	std::set<snestistics::Trace::MemoryAccess> accesses;
-	std::set<snestistics::DmaTransfer> dma_transfers;
+	uint16_t X_before = 0, Y_before = 0, DP_before = 0, P_before = 0;
+	uint8_t DB_before = 0;
+
+	int nmi = 0;
+	uint32_t last_reported_nmi = 0;
 };
+}
 
-void read_function(void* context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, MemoryAccessType reason) {
+namespace {
+
+using namespace snestistics;
+
+static const uint32_t NMI_PER_SKIP = 10;
+
+void read_function(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void* context) {
 	if (reason != MemoryAccessType::RANDOM && reason != MemoryAccessType::FETCH_INDIRECT)
 		return;
-	CallbackContext &m = *(CallbackContext*)context;
+	TraceRecording &m = *(TraceRecording*)context;
 	snestistics::Trace::MemoryAccess a;
 	for (int k = 0; k < num_bytes; ++k) {
 		a.adress = remapped_location + k;
@@ -84,10 +114,10 @@ void read_function(void* context, Pointer location, Pointer remapped_location, u
 	}
 }
 
-void write_function(void* context, Pointer location, Pointer remapped_location, uint32_t value, int num_bytes, MemoryAccessType reason) {
+void write_function(Replay &replay, const Pointer location, const Pointer remapped_location, const uint32_t value, const int num_bytes, const MemoryAccessType reason, void* context) {
 	if (reason != MemoryAccessType::RANDOM && reason != MemoryAccessType::FETCH_INDIRECT)
 		return;
-	CallbackContext &m = *(CallbackContext*)context;
+	TraceRecording &m = *(TraceRecording*)context;
 	snestistics::Trace::MemoryAccess a;
 	for (int k = 0; k < num_bytes; ++k) {
 		a.adress = remapped_location + k;
@@ -96,11 +126,130 @@ void write_function(void* context, Pointer location, Pointer remapped_location,
 	}
 }
 
-void dma_function(void *context, const snestistics::DmaTransfer &dma) {
-	CallbackContext &m = *(CallbackContext*)context;
+void dma_function(Replay &replay, const snestistics::DmaTransfer &dma, void *context) {
+	TraceRecording &m = *(TraceRecording*)context;
 	m.dma_transfers.insert(dma);
 }
 
+void count_execution(TraceRecording &r, const Pointer pc, const uint32_t cycles, const uint32_t nmi) {
+	std::vector<TraceRecording::ExecutionCounter> &bank = r.executions[(pc >> 16) & 0xFF];
+	if (bank.empty())
+		bank.resize(0x10000);
+	TraceRecording::ExecutionCounter &c = bank[pc & 0xFFFF];
+	c.count++;
+	c.cycles += cycles;
+	if (c.last_nmi != nmi) {
+		c.last_nmi = nmi;
+		c.nmis++;
+	}
+
+	if (nmi >= r.executed_per_nmi.size())
+		r.executed_per_nmi.resize(nmi + 1);
+	Trace::NmiExecution &n = r.executed_per_nmi[nmi];
+	n.count++;
+	n.cycles += cycles;
+}
+
+// Remember the registers we care about before the next op
+void recording_registers_before(TraceRecording &r, const EmulateRegisters &regs) {
+	r.current_pc = regs._PC;
+	r.X_before = regs._X;
+	r.Y_before = regs._Y;
+	r.DP_before = regs._DP;
+	r.P_before = regs._P;
+	r.DB_before = regs._DB;
+}
+
+void recording_begin(Replay &replay, void *context) {
+	TraceRecording &r = *(TraceRecording*)context;
+	memcpy(r.cache_header.trace_file_content_guid, replay._trace_content_guid, 8);
+	recording_registers_before(r, replay.regs);
+}
+
+void recording_op(Replay &replay, const uint32_t pc_before, void *context) {
+	TraceRecording &r = *(TraceRecording*)context;
+	EmulateRegisters &regs = replay.regs;
+	Trace &trace = *r.trace;
+
+	if (r.nmi != r.last_reported_nmi && (r.nmi%100)==0) {
+		printf("%d nmi emulated\n", r.nmi);
+		r.last_reported_nmi = r.nmi;
+	}
+
+	if (r.emu_cache._file && (regs.event == Events::RESET || regs.event == Events::NMI) && (r.nmi % NMI_PER_SKIP)==0) {
+		snestistics::TraceSkip msg;
+		msg.nmi = r.nmi;
+		msg.regs.A = regs._A;
+		msg.regs.X = regs._X;
+		msg.regs.Y = regs._Y;
+		msg.regs.S = regs._S;
+		msg.regs.DB = regs._DB;
+		msg.regs.DP = regs._DP;
+		msg.regs.pc_bank = regs._PC >> 16;
+		msg.regs.pc_address = regs._PC & 0xFFFF;
+		msg.regs.P = regs._P;
+		msg.regs.wram_bank = regs._WRAM >> 16;
+		msg.regs.wram_address = regs._WRAM & 0xFFFF;
+		msg.seek_offset_trace_file = replay._last_after_nmi_offset;
+		msg.current_op = replay._current_op;
+		r.emu_cache.write(msg);
+		r.emu_cache.write(&regs._memory[0x7E0000], 64*1024);
+		r.emu_cache.write(&regs._memory[0x7F0000], 64*1024);
+	}
+
+	const uint32_t jump_pc = regs._PC;
+
+	bool is_jump = false; // Did the event/op cause a discontinous program counter?
+	bool is_return = false;
+	bool op = false; // Did we execute an op here? Anything but reset, nmi, irq or
+
+	switch(regs.event) {
+	case Events::RESET:
+	case Events::NMI:
+	case Events::IRQ:
+		// Do not register this as a jump; nobody cares where we jumped from to an nmi/irq/reset
+		trace.labels.set_bit(jump_pc);
+		break;
+	case Events::RTI:
+	case Events::RTS_OR_RTL:
+		is_return = true;
+		op = true;
+		break;
+	case Events::JMP_OR_JML:
+	case Events::JSR_OR_JSL:
+	case Events::BRANCH:
+		// This means that the op _took_ a jump, not that it was a jump instruction
+		trace.labels.set_bit(jump_pc);
+		is_jump = true;
+	case Events::NONE:
+		op = true;
+	};
+
+	if(regs.event == Events::NMI || regs.event == Events::RESET) {
+		r.nmi++;
+	}
+
+	if (op) {
+		// TODO: Set all to zero if not touched by next()
+		OpRecord o;
+		memset(&o, 0, sizeof(OpRecord)); // Make sure padding is zero since we serialize cache
+		o.PC = pc_before;
+		o.op_info.DB = r.DB_before;//regs.used_DB ? DB_before : 0;
+		o.op_info.DP = r.DP_before;//regs.used_DP ? DP_before : 0;
+		o.op_info.P = r.P_before & (0x10|0x20|0x100); // Index, memory, emulation
+		o.op_info.X = r.X_before & regs.used_X_mask;
+		o.op_info.Y = r.Y_before & regs.used_Y_mask;
+		o.op_info.jump_target = (is_jump||is_return) ? jump_pc : INVALID_POINTER;
+		o.op_info.indirect_base_pointer = regs.indirection_pointer;
+		r.op_trace.insert(o);
+
+		const uint8_t opcode = regs._memory[regs.remap(pc_before)];
+		count_execution(r, pc_before, estimate_cycles(opcode, r.P_before, regs.event == Events::BRANCH), replay.current_nmi());
+	}
+
+	recording_registers_before(r, regs);
+}
+
 // Now count variants for each PC and put them all in a big vector with an index
 // Now we iterate op_trace in order sorted by PC
 void pack_ops(snestistics::Trace &trace, std::set<OpRecord> &op_trace) {
@@ -170,161 +319,113 @@ void save_trace(const snestistics::Trace &trace, BigFile &dest) {
 	if (num_dma_transfers!=0) {
 		dest.write(&trace.dma_transfers[0], sizeof(snestistics::DmaTransfer)*num_dma_transfers);
 	}
+
+	// Write execution profile
+	const uint32_t num_executed_ops = (uint32_t)trace.executed_ops.size();
+	dest.write(num_executed_ops);
+	if (num_executed_ops!=0) {
+		dest.write(&trace.executed_ops[0], sizeof(Trace::OpExecution)*num_executed_ops);
+	}
+	const uint32_t num_nmis = (uint32_t)trace.executed_per_nmi.size();
+	dest.write(num_nmis);
+	if (num_nmis!=0) {
+		dest.write(&trace.executed_per_nmi[0], sizeof(Trace::NmiExecution)*num_nmis);
+	}
 }
 }
 
 namespace snestistics {
 
-void create_trace(const std::string &trace_filename, const RomAccessor &rom_accessor, Trace &trace) {
-	BigFile emu_cache;
-	const uint32_t nmi_per_skip = 10;
+TraceRecording *create_trace_recording(const std::string &trace_filename, Trace &trace) {
+	TraceRecording *r = new TraceRecording;
+	r->trace = &trace;
+	r->executions.resize(256);
 
-	emu_cache._file = fopen((trace_filename + ".emulation_cache").c_str(), "wb");
-	CUSTOM_ASSERT(emu_cache._file);
-	snestistics::TraceCacheHeader cache_header;
-	cache_header.version = TRACE_CACHE_VERSION;
-	cache_header.nmi_per_skip = nmi_per_skip;
+	r->emu_cache._file = fopen((trace_filename + ".emulation_cache").c_str(), "wb");
+	CUSTOM_ASSERT(r->emu_cache._file);
+	r->cache_header.version = TRACE_CACHE_VERSION;
+	r->cache_header.nmi_per_skip = NMI_PER_SKIP;
 
 	// NOTE: Not all values in cache_header are assigned now, some are assigned later
 	//       And will be written to the file again
 
-	emu_cache.write(cache_header);
+	r->emu_cache.write(r->cache_header);
 
-	cache_header.replay_cache_seek_offset = emu_cache._offset;
-
-	// Fast structure used during emulation
-	std::set<OpRecord> op_trace;
-	CallbackContext memory_accesses;
-
-	Replay replay(rom_accessor, trace_filename.c_str());
-
-	memcpy(cache_header.trace_file_content_guid, replay._trace_content_guid, 8);
-
-	EmulateRegisters &regs = replay.regs;
-	regs._read_function = read_function;
-	regs._write_function = write_function;
-	regs._dma_function = dma_function;
-	regs._callback_context = &memory_accesses;
-
-	uint32_t last_reported_nmi = 0;
+	r->cache_header.replay_cache_seek_offset = r->emu_cache._offset;
+	return r;
+}
 
-	{
-		Profile profile("Emulation", true);
-		int nmi = 0;
-
-		while (true) {
-			const uint32_t pc_before = regs._PC;
-			memory_accesses.current_pc = pc_before;
-
-			// We arrived at this op with some registers... Remember the ones we care about
-			const uint16_t X_before = regs._X, Y_before = regs._Y, DP_before = regs._DP, P_before = regs._P;
-			const uint8_t DB_before = regs._DB;
-
-			if (!replay.next())
-				break;
-
-			if (nmi != last_reported_nmi && (nmi%100)==0) {
-				printf("%d nmi emulated\n", nmi);
-				last_reported_nmi = nmi; 
-			}
-
-			if (emu_cache._file && (regs.event == Events::RESET || regs.event == Events::NMI) && (nmi % nmi_per_skip)==0) {
-				snestistics::TraceSkip msg;
-				msg.nmi = nmi;
-				msg.regs.A = regs._A;
-				msg.regs.X = regs._X;
-				msg.regs.Y = regs._Y;
-				msg.regs.S = regs._S;
-				msg.regs.DB = regs._DB;
-				msg.regs.DP = regs._DP;
-				msg.regs.pc_bank = regs._PC >> 16;
-				msg.regs.pc_address = regs._PC & 0xFFFF;
-				msg.regs.P = regs._P;
-				msg.regs.wram_bank = regs._WRAM >> 16;
-				msg.regs.wram_address = regs._WRAM & 0xFFFF;
-				msg.seek_offset_trace_file = replay._last_after_nmi_offset;
-				msg.current_op = replay._current_op;
-				emu_cache.write(msg);
-				emu_cache.write(&regs._memory[0x7E0000], 64*1024);
-				emu_cache.write(&regs._memory[0x7F0000], 64*1024);
-			}
-
-			const uint32_t jump_pc = regs._PC;
-
-			bool is_jump = false; // Did the event/op cause a discontinous program counter?
-			bool is_return = false;
-			bool op = false; // Did we execute an op here? Anything but reset, nmi, irq or
-
-			switch(regs.event) {
-			case Events::RESET:
-			case Events::NMI:
-			case Events::IRQ:
-				// Do not register this as a jump; nobody cares where we jumped from to an nmi/irq/reset
-				trace.labels.set_bit(jump_pc);
-				break;
-			case Events::RTI:
-			case Events::RTS_OR_RTL:
-				is_return = true;
-				op = true;
-				break;
-			case Events::JMP_OR_JML:
-			case Events::JSR_OR_JSL:
-			case Events::BRANCH:
-				// This means that the op _took_ a jump, not that it was a jump instruction
-				trace.labels.set_bit(jump_pc);
-				is_jump = true;
-			case Events::NONE:
-				op = true;
-			};
-
-			if(regs.event == Events::NMI || regs.event == Events::RESET) {
-				nmi++;
-			}
-
-			if (op) {
-				// TODO: Set all to zero if not touched by next()
-				OpRecord o;
-				memset(&o, 0, sizeof(OpRecord)); // Make sure padding is zero since we serialize cache
-				o.PC = pc_before;
-				o.op_info.DB = DB_before;//regs.used_DB ? DB_before : 0;
-				o.op_info.DP = DP_before;//regs.used_DP ? DP_before : 0;
-				o.op_info.P = P_before & (0x10|0x20|0x100); // Index, memory, emulation
-				o.op_info.X = X_before & regs.used_X_mask;
-				o.op_info.Y = Y_before & regs.used_Y_mask;
-				o.op_info.jump_target = (is_jump||is_return) ? jump_pc : INVALID_POINTER;
-				o.op_info.indirect_base_pointer = regs.indirection_pointer;
-				op_trace.insert(o);
-			}
-		}
+ReplayStage trace_recording_stage(TraceRecording *recording) {
+	ReplayStage stage;
+	stage.from_start = true;
+	stage.observer.context = recording;
+	stage.observer.op = recording_op;
+	stage.observer.memory_read = read_function;
+	stage.observer.memory_write = write_function;
+	stage.observer.dma = dma_function;
+	stage.begin = recording_begin;
+	return stage;
+}
 
-		printf("Emulated %d NMIs\n", nmi);
+void destroy_trace_recording(TraceRecording *recording) {
+	TraceRecording &r = *recording;
+	Trace &trace = *r.trace;
 
-		cache_header.num_nmis = nmi;
-	}
+	printf("Emulated %d NMIs\n", r.nmi);
+	r.cache_header.num_nmis = r.nmi;
 
-	pack_ops(trace, op_trace);
+	pack_ops(trace, r.op_trace);
 
 	// Put all DMA transfers in order
-	trace.dma_transfers.reserve(memory_accesses.dma_transfers.size());
-	for (auto it : memory_accesses.dma_transfers) {
+	trace.dma_transfers.reserve(r.dma_transfers.size());
+	for (auto it : r.dma_transfers) {
 		trace.dma_transfers.push_back(it);
 	}
 
 	// Put all memory accesses in order
-	trace.memory_accesses.reserve(memory_accesses.accesses.size());
-	for (auto it : memory_accesses.accesses) {
+	trace.memory_accesses.reserve(r.accesses.size());
+	for (auto it : r.accesses) {
 		trace.memory_accesses.push_back(it);
 	}
 
-	cache_header.trace_summary_seek_offset = emu_cache._offset;
-	save_trace(trace, emu_cache);
+	// Execution profile in pc order
+	for (uint32_t bank = 0; bank < r.executions.size(); ++bank) {
+		const std::vector<TraceRecording::ExecutionCounter> &counters = r.executions[bank];
+		for (uint32_t address = 0; address < counters.size(); ++address) {
+			const TraceRecording::ExecutionCounter &c = counters[address];
+			if (c.count == 0)
+				continue;
+			Trace::OpExecution e;
+			e.count = c.count;
+			e.cycles = c.cycles;
+			e.pc = (bank << 16) | address;
+			e.nmis = c.nmis;
+			trace.executed_ops.push_back(e);
+		}
+	}
+	std::swap(trace.executed_per_nmi, r.executed_per_nmi);
+
+	r.cache_header.trace_summary_seek_offset = r.emu_cache._offset;
+	save_trace(trace, r.emu_cache);
 
-	emu_cache.set_offset(0);
+	r.emu_cache.set_offset(0);
 
-	emu_cache.write(cache_header); // Write it again now that we know all values
+	r.emu_cache.write(r.cache_header); // Write it again now that we know all values
 
-	if (emu_cache._file)
-		fclose(emu_cache._file);
+	if (r.emu_cache._file)
+		fclose(r.emu_cache._file);
+
+	delete recording;
+}
+
+void create_trace(const std::string &trace_filename, const RomAccessor &rom_accessor, Trace &trace) {
+	TraceRecording *recording = create_trace_recording(trace_filename, trace);
+	std::vector<ReplayStage> stages(1, trace_recording_stage(recording));
+	{
+		Profile profile("Emulation", true);
+		run_replay_stages(rom_accessor, trace_filename.c_str(), stages);
+	}
+	destroy_trace_recording(recording);
 }
 
 bool load_trace_cache(const std::string &trace_file_name, Trace &trace) {
@@ -409,10 +510,53 @@ bool load_trace_cache(const std::string &trace_file_name, Trace &trace) {
 	if (num_dma_transfers!=0) {
 		source.read(&trace.dma_transfers[0], sizeof(DmaTransfer)*num_dma_transfers);
 	}
+
+	// Read execution profile
+	uint32_t num_executed_ops = 0;
+	source.read(num_executed_ops);
+	trace.executed_ops.resize(num_executed_ops);
+	if (num_executed_ops!=0) {
+		source.read(&trace.executed_ops[0], sizeof(Trace::OpExecution)*num_executed_ops);
+	}
+	uint32_t num_nmis = 0;
+	source.read(num_nmis);
+	trace.executed_per_nmi.resize(num_nmis);
+	if (num_nmis!=0) {
+		source.read(&trace.executed_per_nmi[0], sizeof(Trace::NmiExecution)*num_nmis);
+	}
 	fclose(source._file);
 	return true;
 }
 
+bool load_emulation_cache_header(const std::string &trace_file, TraceCacheHeader &header) {
+	FILE *f = fopen((trace_file + ".emulation_cache").c_str(), "rb");
+	if (!f)
+		return false;
+	const size_t num_read = fread(&header, 1, sizeof(header), f);
+	fclose(f);
+	return num_read == sizeof(header) && header.version == TRACE_CACHE_VERSION;
+}
+
+bool split_nmi_range(const std::string &trace_file, const uint32_t nmi_first, const uint32_t nmi_last, const uint32_t nmis_per_range, std::vector<std::pair<uint32_t, uint32_t>> &ranges) {
+	TraceCacheHeader header;
+	if (!load_emulation_cache_header(trace_file, header) || header.nmi_per_skip == 0)
+		return false;
+
+	const uint32_t nmi_per_skip = header.nmi_per_skip;
+	const uint32_t nmis_per_chunk = (nmis_per_range + nmi_per_skip - 1) / nmi_per_skip * nmi_per_skip;
+
+	// First range is not aligned, it starts where asked for
+	ranges.clear();
+	for (uint32_t first = nmi_first; first <= nmi_last; ) {
+		if (!ranges.empty() && first >= header.num_nmis)
+			break;
+		const uint32_t next_first = (first / nmis_per_chunk + 1) * nmis_per_chunk;
+		ranges.push_back(std::make_pair(first, std::min(nmi_last, next_first - 1)));
+		first = next_first;
+	}
+	return true;
+}
+
 // This function is stupid!!!
 template<typename T>
 void merge_unique(std::vector<T> &dest, const std::vector<T> &add) {
@@ -422,9 +566,40 @@ void merge_unique(std::vector<T> &dest, const std::vector<T> &add) {
 	std::swap(dest, temp);	
 }
 
+// Sums the profiles of ops found in both
+void merge_executions(std::vector<Trace::OpExecution> &dest, const std::vector<Trace::OpExecution> &add) {
+	std::vector<Trace::OpExecution> temp;
+	temp.reserve(dest.size() + add.size());
+	size_t d = 0, a = 0;
+	while (d < dest.size() || a < add.size()) {
+		if (a == add.size() || (d < dest.size() && dest[d] < add[a])) {
+			temp.push_back(dest[d++]);
+		} else if (d == dest.size() || add[a] < dest[d]) {
+			temp.push_back(add[a++]);
+		} else {
+			Trace::OpExecution e = dest[d++];
+			const Trace::OpExecution &o = add[a++];
+			e.count += o.count;
+			e.cycles += o.cycles;
+			e.nmis += o.nmis;
+			temp.push_back(e);
+		}
+	}
+	std::swap(dest, temp);
+}
+
+const Trace::OpExecution *Trace::execution(const Pointer pc) const {
+	OpExecution key;
+	key.pc = pc;
+	const auto it = std::lower_bound(executed_ops.begin(), executed_ops.end(), key);
+	return it != executed_ops.end() && it->pc == pc ? &*it : nullptr;
+}
+
 void merge_trace(Trace &dest, const Trace &add) {
 	merge_unique(dest.dma_transfers, add.dma_transfers);
 	merge_unique(dest.memory_accesses, add.memory_accesses);
+	merge_executions(dest.executed_ops, add.executed_ops);
+	dest.executed_per_nmi.clear(); // NMIs of different runs don't line up
 	dest.labels.set_union(add.labels);
 
 	// OK the hard one! We cheat by doing it slowly
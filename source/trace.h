@@ -7,11 +7,14 @@
 #include <set>
 #include <string>
 
+struct ReplayStage;
+
 namespace snestistics {
 
 class RomAccessor;
+struct TraceCacheHeader;
 
-static const uint32_t TRACE_CACHE_VERSION = 4;
+static const uint32_t TRACE_CACHE_VERSION = 6;
 
 /*
 	The Trace is where information about the entire run is captured from an emulation replay.
@@ -64,9 +67,17 @@ struct DmaTransfer {
 		REVERSE_TRANSFER=1,
 		A_ADDRESS_FIXED=2,
 		A_ADDRESS_DECREMENT=4,
+		HDMA=8, // Channel enabled for HDMA, a_bank:a_address is the table
+		HDMA_INDIRECT=16,
 	};
 	uint8_t flags;
 
+	// Bytes asked for by the registers, HDMA transfers per scanline so nothing is counted for it
+	uint32_t num_bytes() const {
+		if (flags & HDMA) return 0;
+		return transfer_bytes == 0 ? 0x10000 : transfer_bytes;
+	}
+
 	bool operator<(const DmaTransfer &o) const {
 		if (pc != o.pc) return pc<o.pc;
 		if (channel != o.channel) return channel<o.channel;
@@ -109,16 +120,45 @@ struct Trace {
 	std::vector<MemoryAccess> memory_accesses;
 	std::vector<DmaTransfer> dma_transfers;	
 
+	// Execution profile for each executed pc, sorted on pc. Cycles are estimated from the opcode.
+	struct OpExecution {
+		uint64_t count, cycles;
+		Pointer pc;
+		uint32_t nmis; // Number of NMIs the op executed in
+		bool operator<(const OpExecution &o) const { return pc < o.pc; }
+	};
+	std::vector<OpExecution> executed_ops;
+	const OpExecution *execution(const Pointer pc) const;
+
+	// Ops executed in each NMI, index 0 is from reset to the first NMI and n+1 is NMI n. Only kept for a single trace.
+	struct NmiExecution {
+		uint64_t count, cycles;
+	};
+	std::vector<NmiExecution> executed_per_nmi;
+
 	// Not serialized
 	LargeBitfield is_predicted;
 };
 
 void create_trace(const std::string &trace_filename, const RomAccessor &rom_accessor, Trace &trace);
+
+// Same as create_trace but as a stage so other analyses can share the replay. Trace is complete after destroy.
+struct TraceRecording;
+TraceRecording *create_trace_recording(const std::string &trace_filename, Trace &trace);
+ReplayStage trace_recording_stage(TraceRecording *recording);
+void destroy_trace_recording(TraceRecording *recording);
 void merge_trace(Trace &dest, const Trace &add);
 
 // Since emulation takes time we can save/load traces (caching)
 bool load_trace_cache(const std::string &trace_file, Trace &trace);
 
+// Read header of the emulation cache. Returns false if there is no usable cache
+bool load_emulation_cache_header(const std::string &trace_file, TraceCacheHeader &header);
+
+// Splits NMIs [nmi_first, nmi_last] into ranges of about nmis_per_range to be replayed in parallel. All ranges but the
+// first start on a skip point so a replay can jump straight to it. Returns false if there is no usable cache.
+bool split_nmi_range(const std::string &trace_file, const uint32_t nmi_first, const uint32_t nmi_last, const uint32_t nmis_per_range, std::vector<std::pair<uint32_t, uint32_t>> &ranges);
+
 inline void create_or_load_trace(const std::string &trace_filename, const RomAccessor &rom_accessor, Trace &trace) {
 	bool loaded = load_trace_cache(trace_filename, trace);
 	if (!loaded) {
@@ -49,6 +49,15 @@ namespace snestistics {
 		uint16_t value;
 	};
 
+	// Memory written by DMA or HDMA that can't be emulated during replay (PPU->CPU transfers, HDMA into WRAM)
+	// Applied before the op it is recorded at, byte k goes to bank:(adress + k*step). Only bytes ending up in WRAM are kept.
+	struct TraceEventDma {
+		uint32_t adress;
+		int8_t step;
+		uint32_t num_bytes;
+		// Followed by num_bytes values
+	};
+
 	struct TraceRegisters {
 		uint16_t pc_address;
 		uint16_t wram_address;
@@ -6,56 +6,371 @@
 #include "scripting.h"
 #include <stack>
 #include <unordered_set>
+#include <unordered_map>
 #include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include "replay.h"
 #include "report_writer.h"
 #include "cputable.h"
-
-// Rewrite trace_log_filter to be more like breakpoints so don't need to invoke script
-bool trace_log_filter(Pointer pc, Pointer function_start, Pointer function_end, const char * const function_name) { return true; }
+#include "trace.h"
+#include "trace_cache.h"
+#include "trace_log_format.h"
 
 namespace {
 
+using namespace snestistics;
+
 static const int TRACE_START_INDENTATION = 4;
 
-struct TraceState {
-	std::stack<int> current_depths;
-	FILE *report;
-};
+// Number of NMIs formatted by a worker at a time. Rounded up to a multiple of the skip interval in the emulation cache
+static const uint32_t TRACE_LOG_NMIS_PER_CHUNK = 100;
+// Number of chunks kept in memory before they are written to the trace log
+static const uint32_t TRACE_LOG_CHUNKS_PER_BATCH = 32;
+// Number of records the binary trace log writer and renderer keeps in memory
+static const uint32_t TRACE_LOG_RECORDS_PER_BLOCK = 64 * 1024;
+
+static const char * const separator_texts[] = { "START", "NMI", "IRQ", "RESETTING INDENTATION" };
 
-void trace_separator(TraceState &state, const char * const text) {
+void trace_separator(ReportWriter &rw, const int depth, const char * const text) {
 	static const char lines[]="--------------------------------------------------------------------------------------------------------------------------------------------------------------------------";
 
-	assert(!state.current_depths.empty());
-	int width = state.current_depths.top() * 2 - 1;
+	int width = depth * 2 - 1;
 
 	if (width <= 0) width = 0;
 
-	int s = 0;
-	
-	fputc('\n', state.report);
-	s += (int)fwrite(lines, 1, width, state.report);
-	s += (int)fprintf(state.report, " %s ", text);
+	const int text_length = (int)strlen(text);
+
+	rw.write('\n');
+	rw.write(lines, width);
+	rw.write(' ');
+	rw.write(text, text_length);
+	rw.write(' ');
 
-	int remain_width = 130 - s;
+	int remain_width = 130 - (width + text_length + 2);
 
 	if (remain_width>0)
-		s += (int)fwrite(lines, 1, remain_width, state.report);
+		rw.write(lines, remain_width);
 
-	fputc('\n', state.report);
-	fputc('\n', state.report);
+	rw.write("\n\n", 2);
 }
 
-int trace_indent_line(TraceState &state) {
-	static const char spaces[]="                                                                                                                                                                                                                                                      ";
-
-	assert(!state.current_depths.empty());
-	int width = state.current_depths.top() * 2;
+int trace_indent_line(ReportWriter &rw, const int depth) {
+	int width = depth * 2;
 
 	if (width <= 0) return 0;
 
 	assert(width >=0 && width< 160);
-	return (int)fwrite(spaces, 1, width, state.report);
+	rw.repeat(' ', width);
+	return width;
+}
+
+// X=%04X Y=%04X A=%04X DB=%02X DP=%04X S=%04X P=%04X PC=%06X [%06X-%06X] NMI=%d\n
+int format_register_line(char * const line, const TraceLogRecord &r, const Annotation * const function) {
+	int n = 0;
+	memcpy(line + n, "X=", 2);   n += 2; n += format_hex(line + n, r.X, 4);
+	memcpy(line + n, " Y=", 3);  n += 3; n += format_hex(line + n, r.Y, 4);
+	memcpy(line + n, " A=", 3);  n += 3; n += format_hex(line + n, r.A, 4);
+	memcpy(line + n, " DB=", 4); n += 4; n += format_hex(line + n, r.DB, 2);
+	memcpy(line + n, " DP=", 4); n += 4; n += format_hex(line + n, r.DP, 4);
+	memcpy(line + n, " S=", 3);  n += 3; n += format_hex(line + n, r.S, 4);
+	memcpy(line + n, " P=", 3);  n += 3; n += format_hex(line + n, r.P, 4);
+	memcpy(line + n, " PC=", 4); n += 4; n += format_hex(line + n, r.target, 6);
+	memcpy(line + n, " [", 2);   n += 2; n += format_hex(line + n, function ? function->startOfRange : 0, 6);
+	line[n++] = '-';                     n += format_hex(line + n, function ? function->endOfRange : 0, 6);
+	memcpy(line + n, "] NMI=", 6); n += 6; n += format_decimal(line + n, (int32_t)r.nmi);
+	line[n++] = '\n';
+	return n;
+}
+
+/*
+	Format a record as a text trace log line. The function indices in the record refer to functions.
+	Both the text trace log and rendering of binary trace logs goes through here so they always agree.
+*/
+void write_record_text(ReportWriter &rw, const TraceLogRecord &r, const std::vector<Annotation> &functions) {
+	const Annotation *function = r.function != TRACE_LOG_NO_FUNCTION ? &functions[r.function] : nullptr;
+
+	switch (r.type) {
+	case TraceLogRecord::SEPARATOR:
+		trace_separator(rw, r.depth, separator_texts[r.info]);
+		break;
+	case TraceLogRecord::NMI:
+		trace_indent_line(rw, r.depth);
+		rw.write("  # NMI ");
+		rw.decimal((int32_t)r.nmi);
+		rw.write('\n');
+		break;
+	case TraceLogRecord::IRQ:
+		trace_indent_line(rw, r.depth);
+		rw.write("  # IRQ\n");
+		break;
+	case TraceLogRecord::RETURN_FROM_INTERRUPT:
+		rw.write("\n --- RETURN FROM INTERRUPT --- \n\n");
+		break;
+	case TraceLogRecord::LEFT_FUNCTION:
+		trace_indent_line(rw, r.depth);
+		rw.write("WARNING: Was in function ");
+		rw.write(functions[r.from_function].name);
+		if (function) {
+			rw.write(" but now running in ");
+			rw.write(function->name);
+			rw.write(' ');
+		} else {
+			rw.write(" but now running outside at ");
+		}
+		rw.hex(r.pc, 6);
+		rw.write('\n');
+		break;
+	case TraceLogRecord::FUNCTION: {
+		const int indentation = trace_indent_line(rw, r.depth);
+		int spacing = 0;
+		if (function) {
+			rw.write(function->name);
+			spacing = (int)function->name.length();
+		} else {
+			rw.write("Jumped from ");
+			rw.hex(r.pc, 6);
+			rw.write(" to ");
+			rw.hex(r.target, 6);
+			rw.write(" (not annotated)");
+			spacing = 12 + 6 + 4 + 6 + 16;
+		}
+		// If we wrote a function name, output regs
+		if (spacing > 0) {
+			int move = 76 - (indentation + spacing);
+			while (move<0) move+=8;
+			rw.repeat(' ', move);
+			char line[128];
+			rw.write(line, format_register_line(line, r, function));
+		}
+		break;
+	}
+	case TraceLogRecord::MISSING_ANNOTATION:
+		trace_indent_line(rw, r.depth);
+		rw.write("MISSING ANNOTATION FOR ");
+		rw.hex(r.target, 6);
+		rw.write(" (only reporting once)\n");
+		break;
+	}
+}
+
+/*
+	Include/exclude filter given on the command line. Either a function name or a hex range (808000-80FFFF)
+	that the start of the function must be in. Anything but hex digits around the dash makes it a name.
+*/
+struct FunctionFilter {
+	std::string spec, name;
+	Pointer first = INVALID_POINTER, last = INVALID_POINTER;
+	bool used = false;
+
+	FunctionFilter(const std::string &filter) : spec(filter) {
+		static const char * const HEX_DIGITS = "0123456789abcdefABCDEF";
+		const char * const s = spec.c_str();
+		const size_t first_digits = strspn(s, HEX_DIGITS);
+		const size_t last_digits = s[first_digits] == '-' ? strspn(s + first_digits + 1, HEX_DIGITS) : 0;
+		if (first_digits != 0 && last_digits != 0 && first_digits + 1 + last_digits == spec.size()) {
+			const Pointer a = (Pointer)strtoul(s, nullptr, 16);
+			const Pointer b = (Pointer)strtoul(s + first_digits + 1, nullptr, 16);
+			if (a <= b) {
+				first = a;
+				last = b;
+				return;
+			}
+		}
+		name = spec;
+	}
+
+	bool matches(const Annotation &function) const {
+		if (first != INVALID_POINTER)
+			return function.startOfRange >= first && function.startOfRange <= last;
+		return function.name == name;
+	}
+};
+
+/*
+	Everything the trace log wants to know about a pc. Functions come from the annotation index shared
+	with the other reports, if a function is logged is decided once per function up front.
+*/
+class TraceLogLookup {
+public:
+	TraceLogLookup(const AnnotationResolver &annotations, const std::vector<std::string> &includes, const std::vector<std::string> &excludes) : _resolver(annotations), _log_function(annotations._annotations.size(), true), _log_outside_functions(includes.empty()) {
+		Profile profile("Trace log lookup", true);
+
+		std::vector<FunctionFilter> include_filters(includes.begin(), includes.end());
+		std::vector<FunctionFilter> exclude_filters(excludes.begin(), excludes.end());
+
+		// Decide once per function if it should be logged
+		for (size_t i = 0; i < annotations._annotations.size(); ++i) {
+			const Annotation &a = annotations._annotations[i];
+			if (a.type != ANNOTATION_FUNCTION)
+				continue;
+			bool log = include_filters.empty();
+			for (FunctionFilter &f : include_filters) {
+				if (f.matches(a)) {
+					f.used = true;
+					log = true;
+				}
+			}
+			for (FunctionFilter &f : exclude_filters) {
+				if (f.matches(a)) {
+					f.used = true;
+					log = false;
+				}
+			}
+			_log_function[i] = log;
+		}
+		for (const FunctionFilter &f : include_filters) {
+			if (!f.used) printf("Trace log include '%s' did not match any function\n", f.spec.c_str());
+		}
+		for (const FunctionFilter &f : exclude_filters) {
+			if (!f.used) printf("Trace log exclude '%s' did not match any function\n", f.spec.c_str());
+		}
+	}
+
+	const Annotation *function(const Pointer pc) const {
+		const int index = _resolver.function_index(pc);
+		return index != -1 ? &_resolver._annotations[index] : nullptr;
+	}
+	bool log_enabled(const Annotation *function) const {
+		return function ? _log_function[function - &_resolver._annotations[0]] : _log_outside_functions;
+	}
+	bool jump_is_jsr(const Pointer pc) const {
+		const Hint *hint = _resolver.hint(pc);
+		return hint && hint->has_hint(Hint::JUMP_IS_JSR);
+	}
+
+private:
+	const AnnotationResolver &_resolver;
+	std::vector<bool> _log_function; // Per annotation
+	bool _log_outside_functions;      // Only included functions are logged when there are includes
+};
+
+/*
+	Writes the binary trace log. Function indices in records refer to AnnotationResolver::_annotations
+	when added, they are remapped to only include the functions that are actually used.
+*/
+class BinaryTraceLogWriter {
+public:
+	BinaryTraceLogWriter(const std::string &filename, const std::vector<Annotation> &annotations) : _annotations(annotations) {
+		_file._file = fopen(filename.c_str(), "wb");
+		if (!_file._file) {
+			throw std::runtime_error("Could not open binary trace log '" + filename + "' for writing");
+		}
+		_file.write(_header);
+		_records.reserve(TRACE_LOG_RECORDS_PER_BLOCK);
+	}
+
+	~BinaryTraceLogWriter() {
+		flush_records();
+
+		std::sort(_function_index.begin(), _function_index.end());
+
+		_header.nmi_index_seek_offset = _file._offset;
+		_header.num_nmi_index = (uint32_t)_nmi_index.size();
+		if (!_nmi_index.empty())
+			_file.write(&_nmi_index[0], sizeof(TraceLogIndexEntry) * _nmi_index.size());
+
+		_header.function_index_seek_offset = _file._offset;
+		_header.num_function_index = (uint32_t)_function_index.size();
+		if (!_function_index.empty())
+			_file.write(&_function_index[0], sizeof(TraceLogIndexEntry) * _function_index.size());
+
+		_header.functions_seek_offset = _file._offset;
+		_header.num_functions = (uint32_t)_functions.size();
+		for (const uint32_t annotation_index : _functions) {
+			const Annotation &a = _annotations[annotation_index];
+			TraceLogFunction f;
+			f.start = a.startOfRange;
+			f.end = a.endOfRange;
+			f.name_length = (uint32_t)a.name.length();
+			_file.write(f);
+			_file.write(a.name.c_str(), f.name_length);
+		}
+
+		_file.set_offset(0);
+		_file.write(_header);
+		fclose(_file._file);
+	}
+
+	void add(const TraceLogRecord &record) {
+		TraceLogRecord r = record;
+		r.function = remap(record.function);
+		r.from_function = remap(record.from_function);
+
+		const uint32_t index = _header.num_records++;
+
+		if (r.type == TraceLogRecord::NMI) {
+			TraceLogIndexEntry e = { r.nmi, index };
+			_nmi_index.push_back(e);
+		} else if (r.type == TraceLogRecord::FUNCTION && record.function != TRACE_LOG_NO_FUNCTION) {
+			TraceLogIndexEntry e = { _annotations[record.function].startOfRange, index };
+			_function_index.push_back(e);
+		}
+
+		_records.push_back(r);
+		if (_records.size() == TRACE_LOG_RECORDS_PER_BLOCK)
+			flush_records();
+	}
+
+private:
+	uint32_t remap(const uint32_t annotation_index) {
+		if (annotation_index == TRACE_LOG_NO_FUNCTION)
+			return TRACE_LOG_NO_FUNCTION;
+		auto it = _function_ids.find(annotation_index);
+		if (it != _function_ids.end())
+			return it->second;
+		const uint32_t id = (uint32_t)_functions.size();
+		_functions.push_back(annotation_index);
+		_function_ids[annotation_index] = id;
+		return id;
+	}
+
+	void flush_records() {
+		if (!_records.empty())
+			_file.write(&_records[0], sizeof(TraceLogRecord) * _records.size());
+		_records.clear();
+	}
+
+	const std::vector<Annotation> &_annotations;
+	BigFile _file;
+	TraceLogHeader _header;
+	std::vector<TraceLogRecord> _records;
+	std::vector<TraceLogIndexEntry> _nmi_index, _function_index;
+	std::vector<uint32_t> _functions;
+	std::unordered_map<uint32_t, uint32_t> _function_ids;
+};
+
+struct TraceState {
+	std::stack<int> current_depths;
+	std::unordered_set<uint32_t> missing_annotation;
+	const std::vector<Annotation> *functions;
+	ReportWriter *text;           // Optional
+	BinaryTraceLogWriter *binary; // Optional
+};
+
+TraceLogRecord make_record(const TraceLogRecord::Type type) {
+	TraceLogRecord r;
+	memset(&r, 0, sizeof(r));
+	r.type = type;
+	r.function = r.from_function = TRACE_LOG_NO_FUNCTION;
+	return r;
+}
+
+void trace_emit(TraceState &state, const TraceLogRecord &record) {
+	assert(!state.current_depths.empty());
+	TraceLogRecord r = record;
+	r.depth = (uint8_t)state.current_depths.top();
+	if (state.text)
+		write_record_text(*state.text, r, *state.functions);
+	if (state.binary)
+		state.binary->add(r);
+}
+
+void trace_separator(TraceState &state, const TraceLogRecord::Separator separator) {
+	TraceLogRecord r = make_record(TraceLogRecord::SEPARATOR);
+	r.info = separator;
+	trace_emit(state, r);
 }
 
 void trace_fix_depth(TraceState &state) {
@@ -63,183 +378,495 @@ void trace_fix_depth(TraceState &state) {
 	if (state.current_depths.empty() || state.current_depths.top() > 50 || state.current_depths.top() < 0 || state.current_depths.size() > 10) {
 		while (!state.current_depths.empty()) state.current_depths.pop();
 		state.current_depths.push(TRACE_START_INDENTATION);
-		trace_separator(state, "RESETTING INDENTATION");
+		trace_separator(state, TraceLogRecord::SEPARATOR_RESET_INDENTATION);
 	}
 }
+
+/*
+	A chunk is the trace log for a range of NMIs. Chunks are recorded in parallel so the indentation
+	is not known while recording. Instead all changes to the indentation are recorded as commands and
+	played back in order when the chunks are written. This way the output is identical to a serial run.
+*/
+struct TraceLogChunk {
+	enum CommandType : uint8_t {
+		RECORD,             // Write next record
+		PUSH_DEPTH,
+		POP_DEPTH,
+		INCREASE_DEPTH,
+		DECREASE_DEPTH,
+	};
+
+	std::vector<TraceLogRecord> records;
+	std::vector<CommandType> commands;
+
+	void command(CommandType type) {
+		commands.push_back(type);
+	}
+
+	TraceLogRecord &record(const TraceLogRecord::Type type) {
+		commands.push_back(RECORD);
+		records.push_back(make_record(type));
+		return records.back();
+	}
+
+	void clear() {
+		records.clear();
+		commands.clear();
+	}
+};
+
+void write_chunk(TraceState &state, const TraceLogChunk &chunk) {
+	size_t next_record = 0;
+	for (const TraceLogChunk::CommandType c : chunk.commands) {
+		switch (c) {
+		case TraceLogChunk::RECORD: {
+			const TraceLogRecord &r = chunk.records[next_record++];
+			if (r.type == TraceLogRecord::MISSING_ANNOTATION) {
+				if (!state.missing_annotation.insert(r.target).second)
+					break;
+				printf("Missing annotation at pc %06X\n", r.target);
+			}
+			trace_emit(state, r);
+			break;
+		}
+		case TraceLogChunk::PUSH_DEPTH:
+			state.current_depths.push(TRACE_START_INDENTATION);
+			break;
+		case TraceLogChunk::POP_DEPTH:
+			state.current_depths.pop();
+			trace_fix_depth(state);
+			break;
+		case TraceLogChunk::INCREASE_DEPTH:
+			state.current_depths.top()++;
+			trace_fix_depth(state);
+			break;
+		case TraceLogChunk::DECREASE_DEPTH:
+			state.current_depths.top()--;
+			trace_fix_depth(state);
+			break;
+		}
+	}
 }
 
-namespace snestistics {
+// Only used when running serially. Lets scripts print directly into the trace log at breakpoints.
+struct TraceLogScripting {
+	scripting_interface::Scripting *scripting;
+	scripting_interface::ScriptingHandle replay;
+	scripting_interface::ScriptingHandle report_writer;
+	ReportWriter *rw;
+};
 
-void write_trace_log(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting) {
-	
-	CUSTOM_ASSERT(options.trace_files.size() == 1);
+/*
+	Records the trace log op by op into chunk, from where the replay stands when begun until NMI nmi_last is done.
+	If state is given the chunk is written (and cleared) at every NMI and before every script call.
+	If resume is set the chunk continues where the previous chunk ended, so pick up the function we are in.
+*/
+struct TraceLogRecorder {
+	const AnnotationResolver *annotations;
+	const TraceLogLookup *lookup;
+	uint32_t nmi_last;
+	bool resume;
+	TraceLogChunk *chunk;
+	TraceState *state;              // Optional
+	TraceLogScripting *scripting;   // Optional
+
+	const Annotation* current_function = nullptr;
+	uint32_t current_nmi = 0;
+	bool do_logging_for_current_function = true;
+};
 
-	Replay replay(rom, options.trace_files[0].c_str());
+// Script breakpoint handler. Flush what we have so the script output ends up in the right place.
+void trace_log_script_breakpoint(Replay &replay, const uint32_t pc, void *context) {
+	TraceLogRecorder &r = *static_cast<TraceLogRecorder*>(context);
+	if (!r.do_logging_for_current_function)
+		return;
+	write_chunk(*r.state, *r.chunk);
+	r.chunk->clear();
+	r.scripting->rw->indentation = r.state->current_depths.top() * 2 + 1; // Set indentation
+	scripting_trace_log_parameter_printer(r.scripting->scripting, r.scripting->replay, r.scripting->report_writer);
+}
 
-	ReportWriter rw(options.trace_log_out_file.c_str());
+// Script watchpoint handler. Called in the middle of an op, output ends up before the records of the op.
+void trace_log_script_watchpoint(Replay &replay, const uint32_t address, const uint8_t value, const uint8_t old_value, const Replay::WatchKind kind, void *context) {
+	TraceLogRecorder &r = *static_cast<TraceLogRecorder*>(context);
+	write_chunk(*r.state, *r.chunk);
+	r.chunk->clear();
+	r.scripting->rw->indentation = r.state->current_depths.top() * 2 + 1; // Set indentation
+	scripting_trace_log_watchpoint(r.scripting->scripting, r.scripting->replay, r.scripting->report_writer, address, value, old_value, kind);
+}
 
-	scripting_interface::ScriptingHandle scripting_replay = scripting ? scripting_interface::create_replay(scripting, &replay) : nullptr;
-	scripting_interface::ScriptingHandle scripting_report_writer = scripting ? scripting_interface::create_report_writer(scripting, &rw) : nullptr;
+uint32_t function_index(const AnnotationResolver &annotations, const Annotation * const function) {
+	return function ? (uint32_t)(function - &annotations._annotations[0]) : TRACE_LOG_NO_FUNCTION;
+}
 
-	if (scripting) {
-		scripting_interface::scripting_trace_log_init(scripting, scripting_replay);
+void trace_log_begin(Replay &replay, void *context) {
+	TraceLogRecorder &r = *static_cast<TraceLogRecorder*>(context);
+	r.current_nmi = replay.current_nmi();
+	if (r.resume) {
+		r.current_function = r.lookup->function(replay.regs._PC);
+	}
+	if (r.scripting) {
+		replay.set_script_breakpoint_handler(trace_log_script_breakpoint, &r);
+		replay.set_script_watchpoint_handler(trace_log_script_watchpoint, &r);
 	}
+}
 
-	TraceState ts;
-	ts.report = rw.report;
-	ts.current_depths.push(TRACE_START_INDENTATION);
+void trace_log_end(Replay &replay, void *context) {
+	TraceLogRecorder &r = *static_cast<TraceLogRecorder*>(context);
+	if (r.scripting) {
+		replay.set_script_breakpoint_handler(nullptr, nullptr);
+		replay.set_script_watchpoint_handler(nullptr, nullptr);
+	}
+	if (r.state) {
+		write_chunk(*r.state, *r.chunk);
+		r.chunk->clear();
+	}
+}
 
-	trace_separator(ts, "START");
+bool trace_log_done(Replay &replay, void *context) {
+	return replay.nmi_range_done(static_cast<TraceLogRecorder*>(context)->nmi_last);
+}
 
-	const Annotation* current_function = nullptr;
+// Called after each op, pc is where it started
+void trace_log_op(Replay &replay, const uint32_t pc, void *context) {
+	TraceLogRecorder &r = *static_cast<TraceLogRecorder*>(context);
+	const EmulateRegisters &regs = replay.regs;
+	const TraceLogLookup &lookup = *r.lookup;
+	const AnnotationResolver &annotations = *r.annotations;
+	TraceLogChunk &chunk = *r.chunk;
+
+	// Plain ops in code that isn't logged have nothing to record, only events and leaving the function matter
+	if (regs.event == Events::NONE && !r.do_logging_for_current_function &&
+		(!r.current_function || (pc >= r.current_function->startOfRange && pc <= r.current_function->endOfRange)))
+		return;
+
+	const uint32_t jump_pc  = regs._PC;
+
+	bool pc_change = true;
+	bool is_jump_with_return = false;
+	bool is_return = false;
+
+	if (regs.event == Events::NMI) {
+		if (r.state) {
+			write_chunk(*r.state, chunk);
+			chunk.clear();
+		}
+		chunk.record(TraceLogRecord::NMI).nmi = r.current_nmi;
+		chunk.command(TraceLogChunk::PUSH_DEPTH);
+		chunk.record(TraceLogRecord::SEPARATOR).info = TraceLogRecord::SEPARATOR_NMI;
+		r.current_nmi++;
+	} else if (regs.event == Events::RESET) {
+		// This have no impact. If we skip frames it will not happen.
+		return;
+	} else if (regs.event == Events::IRQ) {
+		chunk.record(TraceLogRecord::IRQ).nmi = r.current_nmi;
+		chunk.command(TraceLogChunk::PUSH_DEPTH);
+		chunk.record(TraceLogRecord::SEPARATOR).info = TraceLogRecord::SEPARATOR_IRQ;
+		return;
+	} else if (regs.event == Events::RTI) {
+		if (r.do_logging_for_current_function)
+			chunk.record(TraceLogRecord::RETURN_FROM_INTERRUPT).nmi = r.current_nmi;
+		chunk.command(TraceLogChunk::POP_DEPTH);
+	} else if (regs.event == Events::JMP_OR_JML) {
+	} else if (regs.event == Events::JSR_OR_JSL) {
+		is_jump_with_return = true;
+	} else if (regs.event == Events::RTS_OR_RTL) {
+		is_return = true;
+	} else if (regs.event == Events::BRANCH) {
+	} else if (regs.event == Events::NONE) {
+		// Just a plain boring regular op
+		pc_change = false;
+	} else {
+		assert(false);
+	}
 
-	std::unordered_set<uint32_t> missing_annotation;
+	// If there was no jump but we strayed outside our function, print a warning
+	// This is about function annotations being off
+	if (!pc_change && r.current_function && (pc < r.current_function->startOfRange || pc > r.current_function->endOfRange)) {
 
-	const uint32_t capture_nmi_first = options.nmi_first, capture_nmi_last = options.nmi_last;
+		const Annotation *target_function = lookup.function(pc);
 
-	printf("Skipping to nmi %d\n", capture_nmi_first);
-	EmulateRegisters &regs = replay.regs;
-	bool success = replay.skip_until_nmi(capture_nmi_first);
-	assert(success);
-
-	uint32_t current_nmi = capture_nmi_first;
+		TraceLogRecord &rec = chunk.record(TraceLogRecord::LEFT_FUNCTION);
+		rec.pc = pc;
+		rec.nmi = r.current_nmi;
+		rec.function = function_index(annotations, target_function);
+		rec.from_function = function_index(annotations, r.current_function);
+		r.current_function = target_function;
 
-	bool do_logging_for_current_function = true;
+		// We are in a new function (or in no function no, make sure we print its name)
+		pc_change = true;
+	}
 
-	while (true) {
+	if (pc_change) {
+		// Avoid updating depth if we are ignoring the function
+		if (!r.current_function) {
+			const bool jump_has_faked_return = lookup.jump_is_jsr(pc);
 
-		const uint32_t pc = regs._PC;
+			if (is_jump_with_return || jump_has_faked_return) {
+				chunk.command(TraceLogChunk::INCREASE_DEPTH);
+			} else if (is_return) {
+				chunk.command(TraceLogChunk::DECREASE_DEPTH);
+			}
+		}
 
-		if (do_logging_for_current_function && scripting && replay.breakpoints[pc]) {
-			rw.indentation = ts.current_depths.top() * 2 + 1; // Set indentation
-			scripting_trace_log_parameter_printer(scripting, scripting_replay, scripting_report_writer);
+		const Annotation *target_function = lookup.function(jump_pc);
+		r.do_logging_for_current_function = lookup.log_enabled(target_function);
+
+		if (r.do_logging_for_current_function && r.current_function != target_function) {
+			TraceLogRecord &rec = chunk.record(TraceLogRecord::FUNCTION);
+			rec.pc = pc;
+			rec.target = jump_pc;
+			rec.nmi = r.current_nmi;
+			rec.function = function_index(annotations, target_function);
+			rec.X = regs._X;
+			rec.Y = regs._Y;
+			rec.A = regs._A;
+			rec.DB = regs._DB;
+			rec.DP = regs._DP;
+			rec.S = regs._S;
+			rec.P = regs._P;
+
+			if (!target_function) {
+				TraceLogRecord &m = chunk.record(TraceLogRecord::MISSING_ANNOTATION);
+				m.pc = pc;
+				m.target = jump_pc;
+				m.nmi = r.current_nmi;
+			}
 		}
+		r.current_function = target_function;
+	}
+}
 
-		bool more = replay.next();
-		const uint32_t jump_pc  = regs._PC;
+// Record a range of NMIs on a replay of its own. Used by the parallel trace log.
+void record_trace_log(Replay &replay, const AnnotationResolver &annotations, const TraceLogLookup &lookup, const uint32_t nmi_first, const uint32_t nmi_last, const bool resume, TraceLogChunk &chunk) {
+	const bool success = replay.skip_until_nmi(nmi_first);
+	assert(success);
 
-		if (!more)
+	TraceLogRecorder r;
+	r.annotations = &annotations;
+	r.lookup = &lookup;
+	r.nmi_last = nmi_last;
+	r.resume = resume;
+	r.chunk = &chunk;
+	r.state = nullptr;
+	r.scripting = nullptr;
+
+	trace_log_begin(replay, &r);
+	while (!trace_log_done(replay, &r)) {
+		const uint32_t pc = replay.regs._PC;
+		if (!replay.next())
 			break;
+		trace_log_op(replay, pc, &r);
+	}
+	trace_log_end(replay, &r);
+}
+}
 
-		if (current_nmi > capture_nmi_last)
-			break;
+namespace snestistics {
 
-		bool pc_change = true;
-		bool is_jump_with_return = false;
-		bool is_return = false;
-
-		if (regs.event == Events::NMI) {
-			trace_indent_line(ts); fprintf(rw.report, "  # NMI %d\n", current_nmi);
-			ts.current_depths.push(TRACE_START_INDENTATION);
-			trace_separator(ts, "NMI");
-			//printf("Tracelog for nmi %d (%.1f%%)\n", current_nmi, (1+current_nmi-capture_nmi_first)*100.0f/(capture_nmi_last-capture_nmi_first+1));
-			current_nmi++;
-		} else if (regs.event == Events::RESET) {
-			// This have no impact. If we skip frames it will not happen.
-			continue;
-		} else if (regs.event == Events::IRQ) {
-			trace_indent_line(ts); fprintf(rw.report, "  # IRQ\n");
-			ts.current_depths.push(TRACE_START_INDENTATION);
-			trace_separator(ts, "IRQ");
-			continue;
-		} else if (regs.event == Events::RTI) {
-			if (do_logging_for_current_function)
-				fprintf(rw.report, "\n --- RETURN FROM INTERRUPT --- \n\n");
-			ts.current_depths.pop();
-			trace_fix_depth(ts);
-		} else if (regs.event == Events::JMP_OR_JML) {
-		} else if (regs.event == Events::JSR_OR_JSL) {
-			is_jump_with_return = true;
-		} else if (regs.event == Events::RTS_OR_RTL) {
-			is_return = true;
-		} else if (regs.event == Events::BRANCH) {
-		} else if (regs.event == Events::NONE) {
-			// Just a plain boring regular op
-			pc_change = false;
-		} else {
-			assert(false);
+/*
+	Everything needed to write a trace log, both when run as a stage in a shared replay and when run in parallel.
+*/
+struct TraceLogWriting {
+	TraceLogWriting(const Options &options, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting)
+		: lookup(annotations, options.trace_log_includes, options.trace_log_excludes)
+	{
+		if (!options.trace_log_out_file.empty())
+			rw.reset(new ReportWriter(options.trace_log_out_file.c_str()));
+
+		if (!options.trace_log_binary_out_file.empty())
+			binary.reset(new BinaryTraceLogWriter(options.trace_log_binary_out_file, annotations._annotations));
+
+		// Script printers write text
+		if (!rw && scripting) {
+			printf("Scripting is ignored for binary trace logs\n");
+			scripting = nullptr;
 		}
 
-		int spacing = 0;
-		bool print_missing_annotation = false;
+		if (rw)
+			profile.reset(new ReportWriterProfile("Trace log output", *rw));
+
+		ts.functions = &annotations._annotations;
+		ts.text = rw.get();
+		ts.binary = binary.get();
+		ts.current_depths.push(TRACE_START_INDENTATION);
+
+		trace_separator(ts, TraceLogRecord::SEPARATOR_START);
+
+		recorder.annotations = &annotations;
+		recorder.lookup = &lookup;
+		recorder.nmi_last = options.nmi_last;
+		recorder.resume = false;
+		recorder.chunk = &chunk;
+		recorder.state = &ts;
+		recorder.scripting = scripting ? &script_context : nullptr;
+		script_context.scripting = scripting;
+		script_context.rw = rw.get();
+	}
 
-		// If there was no jump but we strayed outside our function, print a warning
-		// This is about function annotations being off
-		if (!pc_change && current_function && (pc < current_function->startOfRange || pc > current_function->endOfRange)) {
+	std::unique_ptr<ReportWriter> rw;
+	std::unique_ptr<BinaryTraceLogWriter> binary;
+	std::unique_ptr<ReportWriterProfile> profile;
+	TraceState ts;
+	const TraceLogLookup lookup;
+	TraceLogChunk chunk;
+	TraceLogRecorder recorder;
+	TraceLogScripting script_context;
+};
 
-			const Annotation *target_function = nullptr;
-			annotations.resolve_annotation(pc, &target_function );
+}
 
-			if (target_function) {
-				trace_indent_line(ts); fprintf(rw.report, "WARNING: Was in function %s but now running in %s %06X\n", current_function->name.c_str(), target_function->name.c_str(), pc);
-			} else {
-				trace_indent_line(ts); fprintf(rw.report, "WARNING: Was in function %s but now running outside at %06X\n", current_function->name.c_str(), pc);
-			}
-			current_function = target_function;
+namespace {
 
-			// We are in a new function (or in no function no, make sure we print its name)
-			pc_change = true;
-		}
+void trace_log_stage_begin(Replay &replay, void *context) {
+	TraceLogWriting &w = *static_cast<TraceLogWriting*>(context);
+	if (w.recorder.scripting) {
+		TraceLogScripting &sc = w.script_context;
+		sc.replay = scripting_interface::create_replay(sc.scripting, &replay);
+		sc.report_writer = scripting_interface::create_report_writer(sc.scripting, w.rw.get());
+		scripting_interface::scripting_trace_log_init(sc.scripting, sc.replay);
+	}
+	trace_log_begin(replay, &w.recorder);
+}
 
-		if (pc_change) {
-			// Avoid updating depth if we are ignoring the function
-			if (!current_function) {
-				const Hint *ta = annotations.hint(pc);
-				const bool jump_has_faked_return = ta && ta->has_hint(Hint::JUMP_IS_JSR);
+void trace_log_stage_op(Replay &replay, const uint32_t pc, void *context) {
+	trace_log_op(replay, pc, &static_cast<TraceLogWriting*>(context)->recorder);
+}
 
-				if (is_jump_with_return || jump_has_faked_return) {
-					ts.current_depths.top()++;
-					trace_fix_depth(ts);
-				} else if (is_return) {
-					ts.current_depths.top()--;
-					trace_fix_depth(ts);
-				}
-			}
+bool trace_log_stage_done(Replay &replay, void *context) {
+	return trace_log_done(replay, &static_cast<TraceLogWriting*>(context)->recorder);
+}
 
-			const Annotation *target_function = nullptr;
-			annotations.resolve_annotation(jump_pc, &target_function );
+void trace_log_stage_end(Replay &replay, void *context) {
+	TraceLogWriting &w = *static_cast<TraceLogWriting*>(context);
+	trace_log_end(replay, &w.recorder);
+	if (w.recorder.scripting) {
+		TraceLogScripting &sc = w.script_context;
+		scripting_interface::destroy_handle(sc.scripting, sc.replay);
+		scripting_interface::destroy_handle(sc.scripting, sc.report_writer);
+	}
+}
+}
 
-			if (target_function) {
-				do_logging_for_current_function = trace_log_filter(jump_pc, target_function->startOfRange, target_function->endOfRange, target_function->name.c_str());
-			} else {
-				do_logging_for_current_function = true;
-			}
+namespace snestistics {
 
-			if (do_logging_for_current_function && current_function != target_function) {
-				if (target_function) {
-					spacing += trace_indent_line(ts);
-					spacing += fprintf(rw.report, "%s", target_function->name.c_str());
-				} else {
-					spacing += trace_indent_line(ts);
-					spacing += fprintf(rw.report, "Jumped from %06X to %06X (not annotated)", pc, jump_pc);
-
-					if (missing_annotation.find(jump_pc) == missing_annotation.end()) {
-						missing_annotation.insert(jump_pc);
-						print_missing_annotation = true;
-					}
-				}
+TraceLogWriting *create_trace_log_writing(const Options &options, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting) {
+	return new TraceLogWriting(options, annotations, scripting);
+}
+
+ReplayStage trace_log_stage(TraceLogWriting *writing, const Options &options) {
+	ReplayStage stage;
+	stage.nmi_first = options.nmi_first;
+	stage.observer.context = writing;
+	stage.observer.op = trace_log_stage_op;
+	stage.begin = trace_log_stage_begin;
+	stage.done = trace_log_stage_done;
+	stage.end = trace_log_stage_end;
+	return stage;
+}
+
+void destroy_trace_log_writing(TraceLogWriting *writing) {
+	delete writing;
+}
+
+void write_trace_log(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting) {
+
+	CUSTOM_ASSERT(options.trace_files.size() == 1);
+
+	const std::string &trace_file = options.trace_files[0];
+
+	std::unique_ptr<TraceLogWriting> writing(create_trace_log_writing(options, annotations, scripting));
+
+	const uint32_t capture_nmi_first = options.nmi_first, capture_nmi_last = options.nmi_last;
+
+	printf("Skipping to nmi %d\n", capture_nmi_first);
+
+	// Chunks must start on skip points so a worker can jump straight to it. Scripts have state so they always run serially.
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+	const bool parallel = !writing->recorder.scripting && split_nmi_range(trace_file, capture_nmi_first, capture_nmi_last, TRACE_LOG_NMIS_PER_CHUNK, ranges);
+
+	if (!parallel) {
+		std::vector<ReplayStage> stages(1, trace_log_stage(writing.get(), options));
+		run_replay_stages(rom, trace_file.c_str(), stages);
+		return;
+	}
+
+	for (size_t batch = 0; batch < ranges.size(); batch += TRACE_LOG_CHUNKS_PER_BATCH) {
+		const int batch_first = (int)batch;
+		const int batch_end = (int)std::min(ranges.size(), batch + TRACE_LOG_CHUNKS_PER_BATCH);
+
+		std::vector<TraceLogChunk> chunks(batch_end - batch_first);
+
+		#pragma omp parallel
+		{
+			Replay replay(rom, trace_file.c_str());
+
+			#pragma omp for schedule(dynamic)
+			for (int i = batch_first; i < batch_end; ++i) {
+				record_trace_log(replay, annotations, writing->lookup, ranges[i].first, ranges[i].second, i != 0, chunks[i - batch_first]);
 			}
-			current_function = target_function;
 		}
 
-		// If we wrote a function name, output regs
-		if (spacing > 0) {
-			int move = 76-spacing;
-			while (move<0) move+=8;
-			for (int k=0; k<move; k++) fputc(' ', rw.report);
-			fprintf(rw.report, "X=%04X Y=%04X A=%04X DB=%02X DP=%04X S=%04X P=%04X PC=%06X [%06X-%06X] NMI=%d\n", regs._X, regs._Y, regs._A, regs._DB, regs._DP, regs._S, regs._P, regs._PC, current_function ? current_function->startOfRange : 0, current_function ? current_function->endOfRange : 0, current_nmi);
+		for (const TraceLogChunk &chunk : chunks) {
+			write_chunk(writing->ts, chunk);
 		}
+	}
+}
 
-		if (print_missing_annotation) {
-			trace_indent_line(ts);
-			fprintf(rw.report, "MISSING ANNOTATION FOR %06X (only reporting once)\n", jump_pc);
-			printf("Missing annotation at pc %06X\n", jump_pc);
-		}
+void render_trace_log(const Options &options) {
+	BigFile f;
+	f._file = fopen(options.trace_log_render_file.c_str(), "rb");
+	if (!f._file) {
+		throw std::runtime_error("Could not open binary trace log '" + options.trace_log_render_file + "'");
 	}
 
-	if (scripting) {
-		scripting_interface::destroy_handle(scripting, scripting_replay);
-		scripting_interface::destroy_handle(scripting, scripting_report_writer);
+	TraceLogHeader header;
+	const uint64_t expected_magic = header.magic;
+	f.read(header);
+	if (header.magic != expected_magic || header.version != TRACE_LOG_VERSION) {
+		fclose(f._file);
+		throw std::runtime_error("'" + options.trace_log_render_file + "' is not a binary trace log of the right version");
 	}
+
+	std::vector<TraceLogIndexEntry> nmi_index(header.num_nmi_index);
+	f.set_offset(header.nmi_index_seek_offset);
+	if (!nmi_index.empty())
+		f.read(&nmi_index[0], sizeof(TraceLogIndexEntry) * nmi_index.size());
+
+	std::vector<Annotation> functions(header.num_functions);
+	f.set_offset(header.functions_seek_offset);
+	for (Annotation &a : functions) {
+		TraceLogFunction tf;
+		f.read(tf);
+		a.type = ANNOTATION_FUNCTION;
+		a.startOfRange = tf.start;
+		a.endOfRange = tf.end;
+		a.name.resize(tf.name_length);
+		if (tf.name_length != 0)
+			f.read(&a.name[0], tf.name_length);
+	}
+
+	// Records before the first NMI belong to it. Records from the NMI after the last one are not included.
+	const TraceLogIndexEntry first_key = { options.nmi_first, 0 }, end_key = { options.nmi_last + 1, 0 };
+	auto first_it = std::lower_bound(nmi_index.begin(), nmi_index.end(), first_key);
+	auto end_it = std::lower_bound(nmi_index.begin(), nmi_index.end(), end_key);
+	const uint32_t record_first = first_it == nmi_index.begin() ? 0 : (first_it == nmi_index.end() ? header.num_records : first_it->record);
+	const uint32_t record_end = end_it == nmi_index.end() ? header.num_records : end_it->record;
+
+	ReportWriter rw(options.rendered_trace_log_out_file.c_str());
+	ReportWriterProfile profile("Rendered trace log output", rw);
+
+	std::vector<TraceLogRecord> records(TRACE_LOG_RECORDS_PER_BLOCK);
+	f.set_offset(sizeof(TraceLogHeader) + (uint64_t)record_first * sizeof(TraceLogRecord));
+	for (uint32_t r = record_first; r < record_end; ) {
+		const uint32_t n = std::min(record_end - r, TRACE_LOG_RECORDS_PER_BLOCK);
+		f.read(&records[0], sizeof(TraceLogRecord) * n);
+		for (uint32_t i = 0; i < n; ++i) {
+			write_record_text(rw, records[i], functions);
+		}
+		r += n;
+	}
+
+	fclose(f._file);
 }
 }
@@ -3,6 +3,7 @@
 #include <string>
 
 struct Options;
+struct ReplayStage;
 namespace scripting_interface {
 	struct Scripting;
 }
@@ -13,6 +14,14 @@ class AnnotationResolver;
 class RomAccessor;
 void write_trace_log(const Options &options, const RomAccessor &rom, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting);
 
+// Trace log as a stage so other analyses can share the replay. Always runs serially. Output is done after destroy.
+struct TraceLogWriting;
+TraceLogWriting *create_trace_log_writing(const Options &options, const AnnotationResolver &annotations, scripting_interface::Scripting *scripting);
+ReplayStage trace_log_stage(TraceLogWriting *writing, const Options &options);
+void destroy_trace_log_writing(TraceLogWriting *writing);
+// Render NMIs in [nmi_first, nmi_last] of a binary trace log to text. Needs no ROM or trace.
+void render_trace_log(const Options &options);
+
 }
 
 struct TraceLog {
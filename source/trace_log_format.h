@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+	Binary trace log. It holds the same information as the text trace log but each line is a fixed size record
+	so it is cheap to write and any part of it can be found by seeking. It is rendered back to text using
+	snestistics (see TraceLogRender).
+
+	Layout:
+		TraceLogHeader
+		TraceLogRecord[num_records]
+		TraceLogIndexEntry[num_nmi_index]       at nmi_index_seek_offset, key is NMI, sorted
+		TraceLogIndexEntry[num_function_index]  at function_index_seek_offset, key is function start, sorted
+		TraceLogFunction[num_functions]         at functions_seek_offset, each followed by its name
+*/
+
+namespace snestistics {
+
+	static const uint32_t TRACE_LOG_VERSION = 1;
+	static const uint32_t TRACE_LOG_NO_FUNCTION = 0xFFFFFFFF;
+
+	#pragma pack(push, 1)
+	struct TraceLogHeader {
+		uint64_t magic = 0x534e53544c4f4742;
+		uint32_t version = TRACE_LOG_VERSION;
+		uint32_t num_records = 0;
+		uint32_t num_nmi_index = 0;
+		uint32_t num_function_index = 0;
+		uint32_t num_functions = 0;
+		uint64_t nmi_index_seek_offset = 0;
+		uint64_t function_index_seek_offset = 0;
+		uint64_t functions_seek_offset = 0;
+	};
+
+	struct TraceLogRecord {
+		enum Type : uint8_t {
+			SEPARATOR,             // Separator, kind in info
+			NMI,                   // Start of nmi
+			IRQ,
+			RETURN_FROM_INTERRUPT,
+			LEFT_FUNCTION,         // Strayed outside from_function without a jump, now at pc in function
+			FUNCTION,              // Jumped from pc to target in function. Registers are after the jump
+			MISSING_ANNOTATION,    // First jump to target without annotation
+		};
+		enum Separator : uint8_t {
+			SEPARATOR_START,
+			SEPARATOR_NMI,
+			SEPARATOR_IRQ,
+			SEPARATOR_RESET_INDENTATION,
+		};
+
+		uint8_t type;
+		uint8_t info;
+		uint8_t depth; // Indentation depth when record was written
+		uint8_t DB;
+		uint16_t X, Y, A, DP, S, P;
+		uint32_t pc, target;
+		uint32_t nmi;
+		uint32_t function, from_function; // Index into functions or TRACE_LOG_NO_FUNCTION
+	};
+
+	struct TraceLogIndexEntry {
+		uint32_t key;
+		uint32_t record;
+		bool operator<(const TraceLogIndexEntry &o) const {
+			if (key != o.key) return key < o.key;
+			return record < o.record;
+		}
+	};
+
+	struct TraceLogFunction {
+		uint32_t start, end;
+		uint32_t name_length;
+	};
+	#pragma pack(pop)
+}
@@ -0,0 +1,252 @@
+#include "trace_set.h"
+#include "trace.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+using namespace snestistics;
+
+namespace {
+
+static const uint32_t MAX_TRACES = 16;
+
+// Postfix program, evaluated on 32 memberships at a time
+struct TraceExpression {
+	enum Type : uint8_t { TRACE, UNION, INTERSECTION, MINUS };
+	struct Instruction {
+		Type type;
+		uint32_t trace;
+	};
+	std::vector<Instruction> program;
+	uint32_t max_depth = 0;
+
+	uint32_t evaluate(const uint32_t * const leaves, uint32_t * const stack) const {
+		uint32_t depth = 0;
+		for (const Instruction &i : program) {
+			if (i.type == TRACE) {
+				stack[depth++] = leaves[i.trace];
+				continue;
+			}
+			const uint32_t b = stack[--depth], a = stack[depth - 1];
+			if (i.type == UNION) stack[depth - 1] = a | b;
+			else if (i.type == INTERSECTION) stack[depth - 1] = a & b;
+			else stack[depth - 1] = a & ~b;
+		}
+		return stack[0];
+	}
+};
+
+struct ExpressionParser {
+	const std::string &text;
+	const uint32_t num_traces;
+	size_t at = 0;
+	uint32_t depth = 0;
+	TraceExpression &expression;
+
+	ExpressionParser(const std::string &text_, const uint32_t num_traces_, TraceExpression &expression_) : text(text_), num_traces(num_traces_), expression(expression_) {}
+
+	void fail(const char * const what) {
+		printf("Trace expression '%s': %s at position %d\n", text.c_str(), what, (int)at);
+		throw std::runtime_error("Bad trace expression!");
+	}
+	char peek() {
+		while (at < text.length() && isspace((unsigned char)text[at])) at++;
+		return at < text.length() ? text[at] : '\0';
+	}
+	void push(const TraceExpression::Type type, const uint32_t trace = 0) {
+		const TraceExpression::Instruction i = { type, trace };
+		expression.program.push_back(i);
+		if (type == TraceExpression::TRACE) {
+			depth++;
+			expression.max_depth = std::max(expression.max_depth, depth);
+		} else {
+			depth--;
+		}
+	}
+	void term() {
+		const char c = peek();
+		if (c == '(') {
+			at++;
+			expr();
+			if (peek() != ')')
+				fail("expected )");
+			at++;
+		} else if (isdigit((unsigned char)c)) {
+			uint32_t trace = 0;
+			while (at < text.length() && isdigit((unsigned char)text[at]))
+				trace = std::min(trace * 10 + (text[at++] - '0'), MAX_TRACES);
+			if (trace >= num_traces)
+				fail("no such trace");
+			push(TraceExpression::TRACE, trace);
+		} else {
+			fail("expected trace number or (");
+		}
+	}
+	void expr() {
+		term();
+		for (;;) {
+			const char c = peek();
+			TraceExpression::Type type;
+			if (c == '|') type = TraceExpression::UNION;
+			else if (c == '&') type = TraceExpression::INTERSECTION;
+			else if (c == '-') type = TraceExpression::MINUS;
+			else return;
+			at++;
+			term();
+			push(type);
+		}
+	}
+	void parse() {
+		expr();
+		if (peek() != '\0')
+			fail("unexpected character");
+	}
+};
+
+struct TraceOp {
+	Pointer pc;
+	OpInfo info;
+	bool operator<(const TraceOp &o) const {
+		if (pc != o.pc) return pc < o.pc;
+		return info < o.info;
+	}
+};
+
+// One pass over all inputs at once, keep[mask] says if an element found in the traces in mask is kept
+template<typename T>
+void merge_sorted(const std::vector<const std::vector<T>*> &inputs, const std::vector<uint8_t> &keep, std::vector<T> &result) {
+	const size_t n = inputs.size();
+	std::vector<size_t> at(n, 0);
+	for (;;) {
+		const T *smallest = nullptr;
+		for (size_t i = 0; i < n; ++i) {
+			if (at[i] < inputs[i]->size() && (!smallest || (*inputs[i])[at[i]] < *smallest))
+				smallest = &(*inputs[i])[at[i]];
+		}
+		if (!smallest)
+			break;
+		const T value = *smallest;
+		uint32_t mask = 0;
+		for (size_t i = 0; i < n; ++i) {
+			if (at[i] < inputs[i]->size() && !(value < (*inputs[i])[at[i]])) {
+				mask |= 1 << i;
+				at[i]++;
+			}
+		}
+		if (keep[mask])
+			result.push_back(value);
+	}
+}
+
+void flatten_ops(const Trace &trace, std::vector<TraceOp> &ops) {
+	ops.reserve(trace.ops_variants.size());
+	for (const auto &op : trace.ops) {
+		for (uint32_t k = 0; k < op.second.count; ++k) {
+			TraceOp o;
+			o.pc = op.first;
+			o.info = trace.variant(op.second, k);
+			ops.push_back(o);
+		}
+	}
+}
+
+void combine_ops(const std::vector<const Trace*> &traces, const std::vector<uint8_t> &keep, Trace &result) {
+	std::vector<std::vector<TraceOp>> flat(traces.size());
+	std::vector<const std::vector<TraceOp>*> inputs(traces.size());
+	for (size_t i = 0; i < traces.size(); ++i) {
+		flatten_ops(*traces[i], flat[i]);
+		inputs[i] = &flat[i];
+	}
+	std::vector<TraceOp> ops;
+	merge_sorted(inputs, keep, ops);
+
+	result.ops.clear();
+	result.ops_variants.resize(ops.size());
+	for (size_t i = 0; i < ops.size(); ) {
+		Trace::OpVariantLookup lookup;
+		lookup.offset = (uint32_t)i;
+		lookup.count = 0;
+		const Pointer pc = ops[i].pc;
+		for (; i < ops.size() && ops[i].pc == pc; ++i, ++lookup.count)
+			result.ops_variants[i] = ops[i].info;
+		result.ops.insert(result.ops.end(), std::make_pair(pc, lookup));
+	}
+
+	// Kept ops get the executions from all traces
+	result.executed_ops.clear();
+	for (const auto &op : result.ops) {
+		Trace::OpExecution e;
+		memset(&e, 0, sizeof(e));
+		e.pc = op.first;
+		for (const Trace *t : traces) {
+			const Trace::OpExecution *o = t->execution(op.first);
+			if (!o)
+				continue;
+			e.count += o->count;
+			e.cycles += o->cycles;
+			e.nmis += o->nmis;
+		}
+		if (e.count != 0)
+			result.executed_ops.push_back(e);
+	}
+	result.executed_per_nmi.clear();
+}
+
+void combine_labels(const std::vector<const Trace*> &traces, const TraceExpression &expression, Trace &result) {
+	const uint32_t num_words = result.labels.num_words();
+	std::vector<uint32_t> leaves(traces.size()), stack(expression.max_depth);
+	for (uint32_t w = 0; w < num_words; ++w) {
+		for (size_t i = 0; i < traces.size(); ++i)
+			leaves[i] = traces[i]->labels.word(w);
+		result.labels.set_word(w, expression.evaluate(&leaves[0], &stack[0]));
+	}
+}
+
+}
+
+namespace snestistics {
+
+void evaluate_trace_expression(const std::string &expression_text, const std::vector<const Trace*> &traces, Trace &result) {
+	Profile profile("Evaluating trace expression", true);
+
+	if (traces.size() > MAX_TRACES) {
+		printf("Trace expressions can use at most %d traces\n", MAX_TRACES);
+		throw std::runtime_error("Too many traces!");
+	}
+
+	TraceExpression expression;
+	ExpressionParser(expression_text, (uint32_t)traces.size(), expression).parse();
+
+	// Lookup table from which traces an element is in to if it is kept
+	const uint32_t num_traces = (uint32_t)traces.size();
+	std::vector<uint8_t> keep(1 << num_traces);
+	{
+		std::vector<uint32_t> leaves(num_traces), stack(expression.max_depth);
+		for (uint32_t mask = 0; mask < keep.size(); ++mask) {
+			for (uint32_t i = 0; i < num_traces; ++i)
+				leaves[i] = (mask >> i) & 1;
+			keep[mask] = expression.evaluate(&leaves[0], &stack[0]) & 1;
+		}
+	}
+
+	std::vector<const std::vector<Trace::MemoryAccess>*> memory_accesses;
+	std::vector<const std::vector<DmaTransfer>*> dma_transfers;
+	for (const Trace *t : traces) {
+		memory_accesses.push_back(&t->memory_accesses);
+		dma_transfers.push_back(&t->dma_transfers);
+	}
+
+	result.memory_accesses.clear();
+	result.dma_transfers.clear();
+
+	// Each kind of data is combined on its own
+	#pragma omp parallel for schedule(dynamic)
+	for (int kind = 0; kind < 4; ++kind) {
+		if (kind == 0) combine_ops(traces, keep, result);
+		if (kind == 1) merge_sorted(memory_accesses, keep, result.memory_accesses);
+		if (kind == 2) merge_sorted(dma_transfers, keep, result.dma_transfers);
+		if (kind == 3) combine_labels(traces, expression, result);
+	}
+}
+}
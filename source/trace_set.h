@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+	Set algebra over traces, like "(1|2)-0" to get what level 1 and 2 do that the intro does not.
+	Traces are numbered from 0 in the order they are given. | is union, & is intersection and - removes
+	what is in the right hand side. Operators are evaluated left to right, use parentheses to group.
+
+	Ops (per variant), labels, memory accesses and DMA transfers are all combined the same way.
+*/
+
+namespace snestistics {
+	struct Trace;
+
+	// Throws if the expression is malformed or refers to a trace that does not exist
+	void evaluate_trace_expression(const std::string &expression, const std::vector<const Trace*> &traces, Trace &result);
+}
@@ -1,5 +1,16 @@
 #include "utils.h"
 
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
 namespace snestistics {
 
 void LargeBitfield::write_file(FILE * f) const {
@@ -58,4 +69,49 @@ void read_file(const std::string & filename, Array<uint8_t>& result) {
 	fread(&result[0], 1, fileSize, f);
 	fclose(f);
 }
+
+MappedFile::MappedFile(const std::string &filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	_file_handle = file;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	size = (size_t)file_size.QuadPart;
+	_open = true;
+	if (size == 0)
+		return;
+	_mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping_handle)
+		data = (const char*)MapViewOfFile(_mapping_handle, FILE_MAP_READ, 0, 0, 0);
+#else
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+		size = (size_t)st.st_size;
+		_open = true;
+		if (size != 0) {
+			void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED)
+				data = (const char*)mapped;
+		}
+	}
+	close(fd); // The mapping stays valid
+#endif
+	if (size != 0 && !data)
+		_open = false;
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (_mapping_handle) CloseHandle(_mapping_handle);
+	if (_file_handle) CloseHandle(_file_handle);
+#else
+	if (data) munmap((void*)data, size);
+#endif
+}
 }
@@ -67,6 +67,27 @@ public:
 		_state[bucket] = current;
 		assert(this->operator[](p) == newStat);
 	}
+	// Set all bits in [first, last], whole words at a time
+	void set_range(const uint32_t first, const uint32_t last, const bool newStat = true) {
+		if (last < first)
+			return;
+		const uint32_t first_bucket = first / 32, last_bucket = last / 32;
+		const uint32_t first_mask = ~0u << (first & 31);
+		const uint32_t last_mask = ~0u >> (31 - (last & 31));
+		assert(last_bucket < _num_elements);
+		if (first_bucket == last_bucket) {
+			set_mask(first_bucket, first_mask & last_mask, newStat);
+			return;
+		}
+		set_mask(first_bucket, first_mask, newStat);
+		memset(_state + first_bucket + 1, newStat ? 0xFF : 0, (last_bucket - first_bucket - 1) * sizeof(uint32_t));
+		set_mask(last_bucket, last_mask, newStat);
+	}
+
+	// Raw access to the bits, 32 per word
+	uint32_t num_words() const { return _num_elements; }
+	uint32_t word(const uint32_t index) const { return _state[index]; }
+	void set_word(const uint32_t index, const uint32_t value) { _state[index] = value; }
 
 	void write_file(FILE *f) const;
 	void write_file(BigFile &file) const;
@@ -81,6 +102,13 @@ public:
 		}
 
 	}
+private:
+	void set_mask(const uint32_t bucket, const uint32_t mask, const bool newStat) {
+		if (newStat)
+			_state[bucket] |= mask;
+		else
+			_state[bucket] &= ~mask;
+	}
 };
 
 struct StringBuilder {
@@ -310,4 +338,40 @@ private:
 
 void read_file(const std::string &filename, Array<uint8_t> &result);
 
+// 64-bit FNV-1a
+struct Fnv1a {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	void add(const void * const data, const size_t len) {
+		const uint8_t *bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < len; ++i) {
+			h ^= bytes[i];
+			h *= 0x100000001b3ULL;
+		}
+	}
+	template<typename T>
+	void add(const T &t) { add(&t, sizeof(T)); }
+	void add(const std::string &str) {
+		add((uint32_t)str.length());
+		add(str.c_str(), str.length());
+	}
+};
+
+// Entire file mapped read-only into memory. data is null for empty files.
+struct MappedFile {
+	MappedFile(const std::string &filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool is_open() const { return _open; }
+
+	const char *data = nullptr;
+	size_t size = 0;
+
+private:
+	bool _open = false;
+	void *_file_handle = nullptr, *_mapping_handle = nullptr;
+};
+
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+/*
+	Breakpoint handler throughput benchmark.
+
+	Sets a breakpoint on every instruction and reads the registers and a small structure each hit.
+	Run the trace log with this script twice, once with batched = false and once with batched = true,
+	and compare the time reported for the trace log.
+*/
+
+local batched = true;
+local struct_address = 0x7E0000;
+local struct_length = 16;
+local checksum = 0;
+
+function trace_log_parameter_printer(replay, report)
+{
+	if (batched) {
+		local r = replay.registers();
+		checksum += r.pc + r.a + r.x + r.y + r.p + r.s + r.dp + r.db;
+		local data = replay.read_block(struct_address, struct_length);
+		foreach (b in data) checksum += b;
+	} else {
+		checksum += replay.pc() + replay.a() + replay.x() + replay.y() + replay.p() + replay.s() + replay.dp() + replay.db();
+		for (local i = 0; i < struct_length; i++) checksum += replay.read_byte(struct_address + i);
+	}
+}
+
+function trace_log_init(replay) {
+	replay.set_breakpoint_range(0, 0xFFFFFF);
+}
@@ -0,0 +1,92 @@
+/*
+	Minimal native plugin, see source/plugin_api.h. Counts ops and DMA bytes per NMI and prints the busiest NMI.
+	Written in C to keep the plugin interface C compatible.
+
+	snestistics -romfile game.sfc -tracefile game.trace -pluginfile example_plugin.so -pluginargument report.txt
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin_api.h"
+
+struct ExamplePlugin {
+	char filename[256]; // Empty for stdout
+	uint32_t nmi;
+	uint64_t ops, dma_bytes;             // In the current NMI
+	uint64_t total_ops, total_dma_bytes;
+	uint32_t num_nmis;
+	uint32_t busiest_nmi;
+	uint64_t busiest_ops;
+};
+
+static void end_nmi(struct ExamplePlugin *p) {
+	if (p->ops > p->busiest_ops) {
+		p->busiest_ops = p->ops;
+		p->busiest_nmi = p->nmi;
+	}
+	p->total_ops += p->ops;
+	p->total_dma_bytes += p->dma_bytes;
+	p->ops = 0;
+	p->dma_bytes = 0;
+}
+
+static void example_op(void *user, struct Replay *replay, uint32_t pc, uint32_t event) {
+	struct ExamplePlugin *p = (struct ExamplePlugin*)user;
+	(void)replay; (void)pc;
+	if ((event & (SNESTISTICS_EVENT_NMI | SNESTISTICS_EVENT_IRQ | SNESTISTICS_EVENT_RESET)) == 0)
+		p->ops++; // Not an interrupt or reset
+}
+
+static void example_nmi(void *user, struct Replay *replay, uint32_t nmi) {
+	struct ExamplePlugin *p = (struct ExamplePlugin*)user;
+	(void)replay;
+	if (p->num_nmis != 0)
+		end_nmi(p);
+	p->nmi = nmi;
+	p->num_nmis++;
+}
+
+static void example_dma(void *user, struct Replay *replay, const struct SnestisticsDma *dma) {
+	struct ExamplePlugin *p = (struct ExamplePlugin*)user;
+	(void)replay;
+	p->dma_bytes += dma->transfer_bytes;
+}
+
+static void example_finish(void *user) {
+	struct ExamplePlugin *p = (struct ExamplePlugin*)user;
+	FILE *f = stdout;
+	if (p->num_nmis != 0)
+		end_nmi(p);
+	if (p->filename[0] != '\0') {
+		f = fopen(p->filename, "w");
+		if (!f) {
+			printf("Example plugin could not open '%s' for writing\n", p->filename);
+			f = stdout;
+		}
+	}
+	fprintf(f, "%u NMIs, %llu ops, %llu DMA bytes\n", p->num_nmis, (unsigned long long)p->total_ops, (unsigned long long)p->total_dma_bytes);
+	if (p->num_nmis != 0)
+		fprintf(f, "Busiest NMI %u with %llu ops\n", p->busiest_nmi, (unsigned long long)p->busiest_ops);
+	if (f != stdout)
+		fclose(f);
+	free(p);
+}
+
+SNESTISTICS_PLUGIN_EXPORT int snestistics_plugin_init(const struct SnestisticsHost *host, const char *argument, struct SnestisticsPlugin *plugin) {
+	struct ExamplePlugin *p;
+	if (host->api_version != SNESTISTICS_PLUGIN_API_VERSION)
+		return 1;
+
+	p = (struct ExamplePlugin*)calloc(1, sizeof(struct ExamplePlugin));
+	if (!p)
+		return 1;
+	strncpy(p->filename, argument, sizeof(p->filename) - 1);
+
+	plugin->user = p;
+	plugin->op = example_op;
+	plugin->nmi = example_nmi;
+	plugin->dma = example_dma;
+	plugin->finish = example_finish;
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+	Loads a native plugin the way the plugin host does and calls its hooks without a replay.
+	Checks that a plugin built against plugin_api.h exports its init function and initializes.
+
+	plugin_load_test example_plugin.so
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "plugin_api.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <dlfcn.h>
+#endif
+
+static struct Registers fake_registers;
+
+static struct Registers *fake_registers_function(struct Replay *replay) { (void)replay; return &fake_registers; }
+static uint8_t fake_read_byte(struct Replay *replay, uint32_t address) { (void)replay; (void)address; return 0; }
+static uint16_t fake_read_word(struct Replay *replay, uint32_t address) { (void)replay; (void)address; return 0; }
+static uint32_t fake_read_long(struct Replay *replay, uint32_t address) { (void)replay; (void)address; return 0; }
+static void fake_read_block(struct Replay *replay, uint32_t address, uint8_t *dest, uint32_t length) { (void)replay; (void)address; memset(dest, 0, length); }
+
+int main(int argc, char **argv) {
+	struct SnestisticsHost host;
+	struct SnestisticsPlugin plugin;
+	struct SnestisticsDma dma;
+	SnestisticsPluginInit init;
+	uint32_t nmi;
+	void *library;
+
+	if (argc != 2) {
+		printf("Usage: plugin_load_test <plugin>\n");
+		return 1;
+	}
+
+#ifdef _WIN32
+	library = (void*)LoadLibraryA(argv[1]);
+	init = library ? (SnestisticsPluginInit)GetProcAddress((HMODULE)library, SNESTISTICS_PLUGIN_INIT_NAME) : NULL;
+#else
+	library = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+	init = library ? (SnestisticsPluginInit)dlsym(library, SNESTISTICS_PLUGIN_INIT_NAME) : NULL;
+#endif
+	if (!library) {
+		printf("Failed to load plugin '%s'\n", argv[1]);
+		return 1;
+	}
+	if (!init) {
+		printf("Plugin '%s' does not export %s\n", argv[1], SNESTISTICS_PLUGIN_INIT_NAME);
+		return 1;
+	}
+
+	host.api_version = SNESTISTICS_PLUGIN_API_VERSION;
+	host.registers = fake_registers_function;
+	host.read_byte = fake_read_byte;
+	host.read_word = fake_read_word;
+	host.read_long = fake_read_long;
+	host.read_block = fake_read_block;
+
+	memset(&plugin, 0, sizeof(plugin));
+	if (init(&host, "", &plugin) != 0) {
+		printf("Plugin '%s' failed to initialize\n", argv[1]);
+		return 1;
+	}
+
+	// A couple of NMIs with an op and a DMA each
+	memset(&dma, 0, sizeof(dma));
+	dma.b_address = 0x2118;
+	dma.transfer_bytes = 0x800;
+	for (nmi = 0; nmi < 2; ++nmi) {
+		if (plugin.op) plugin.op(plugin.user, NULL, 0x8000, SNESTISTICS_EVENT_NMI);
+		if (plugin.nmi) plugin.nmi(plugin.user, NULL, nmi);
+		if (plugin.op) plugin.op(plugin.user, NULL, 0x8000, SNESTISTICS_EVENT_NONE);
+		if (plugin.memory_read) plugin.memory_read(plugin.user, NULL, 0x7E0000, 0x7E0000, 0, 1, SNESTISTICS_ACCESS_RANDOM);
+		if (plugin.memory_write) plugin.memory_write(plugin.user, NULL, 0x7E0000, 0x7E0000, 0, 1, SNESTISTICS_ACCESS_RANDOM);
+		if (plugin.dma) plugin.dma(plugin.user, NULL, &dma);
+	}
+	if (plugin.finish) plugin.finish(plugin.user);
+
+#ifdef _WIN32
+	FreeLibrary((HMODULE)library);
+#else
+	dlclose(library);
+#endif
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*
+	Times the two ReportWriter write paths with asm and trace log like lines: a file writer to a null sink and
+	in-memory writers of the sizes the asm banks, reports and trace log chunks use. Best of five runs.
+
+	report_writer_benchmark [lines]
+*/
+
+#include "report_writer.h"
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+#ifdef _WIN32
+	const char * const NULL_SINK = "NUL";
+#else
+	const char * const NULL_SINK = "/dev/null";
+#endif
+
+void write_line(ReportWriter &w, const int i) {
+	w.repeat(' ', 2);
+	w.write("lda.l $");
+	w.hex(i & 0xFFFFFF, 6);
+	w.write(" ; ");
+	w.decimal(i);
+	w.write('\n');
+	if ((i & 1023) == 0)
+		w.format("; formatted %d %s\n", i, "line");
+}
+
+template<typename F>
+double best_of_five(F f) {
+	double best = 1e9;
+	for (int run = 0; run < 5; ++run) {
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+// Same number of lines in total, split over num_writers writers to memory
+double memory_writers(const int num_writers, const int lines) {
+	return best_of_five([&]() {
+		std::vector<std::string> out(num_writers);
+		for (int w = 0; w < num_writers; ++w) {
+			ReportWriter writer(out[w]);
+			for (int i = 0; i < lines / num_writers; ++i)
+				write_line(writer, i);
+		}
+	});
+}
+}
+
+int main(int argc, char **argv) {
+	const int lines = argc > 1 ? atoi(argv[1]) : 5000000;
+
+	const double file = best_of_five([&]() {
+		ReportWriter writer(NULL_SINK);
+		for (int i = 0; i < lines; ++i)
+			write_line(writer, i);
+	});
+	printf("%d lines\n", lines);
+	printf("File writer to %s:   %.3f s\n", NULL_SINK, file);
+	printf("1 writer to memory:       %.3f s\n", memory_writers(1, lines));
+	printf("200 writers to memory:    %.3f s\n", memory_writers(200, lines));
+	printf("20000 writers to memory:  %.3f s\n", memory_writers(20000, lines));
+	return 0;
+}
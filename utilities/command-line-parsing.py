@@ -19,16 +19,29 @@ options=[
 	Option("rom",        "RomSize",          "rs", "uint",    "0",     "Size of ROM cartridge (without header). 0 means auto-detect"),
 	#Option("rom",        "RomMode",          "rm", "enum",    "trace", "Type of ROM"),
 	Option("trace",      "Trace",            "t",  "input*",  "",      "Trace file from an emulation session. Multiple allowed for assembly source listing"),
+	Option("trace",      "TraceExpression",  "te", "string",  "",      "Combine the ${Trace} files with set algebra instead of merging them all, like (1|2)-0. Traces are numbered from 0 in the order given. | is union, & is intersection and - is difference"),
 	#Option("trace",      "Regenerate",       "rg", "bool",    "false", "Regenerate emulation caches. Should happen automatically"),
 	Option("tracelog",   "NmiFirst",         "n0", "uint",    "0",     "First NMI to consider for trace log"),
 	Option("tracelog",   "NmiLast",          "n1", "uint",    "0",     "Last NMI to consider for trace log"),
 	Option("tracelog",   "TraceLog",         "tl", "output",  "",      "Generate trace log. Nmi range can be controlled using ${NmiFirst} and ${NmiLast}. Custom printing can be done using scripting"),
+	Option("tracelog",   "TraceLogInclude",  "tli", "string*", "",     "Only log functions with this name or starting in this hex range (like 808000-80FFFF). Multiple allowed. Code outside functions is then not logged"),
+	Option("tracelog",   "TraceLogExclude",  "tle", "string*", "",     "Do not log functions with this name or starting in this hex range. Multiple allowed. Wins over ${TraceLogInclude}"),
+	Option("tracelog",   "TraceLogBinary",   "tlb", "output", "",      "Generate binary trace log. Much smaller and faster to write than ${TraceLog} and indexed by NMI and function. Use ${TraceLogRender} to turn it into text"),
+	Option("tracelog",   "TraceLogRender",   "tlr", "input",  "",      "Binary trace log to render as text into ${RenderedTraceLog}. Only NMIs ${NmiFirst} to ${NmiLast} are rendered. Needs no ROM or trace"),
+	Option("tracelog",   "RenderedTraceLog", "rtl", "output", "",      "Text trace log rendered from ${TraceLogRender}"),
 	Option("scripting",  "Script",           "s",  "input",   "",      "A squirrel script. See user guide for scripting reference"),
+	Option("scripting",  "Plugin",           "pl", "input*",  "",      "A native plugin (shared library) run on NMIs ${NmiFirst} to ${NmiLast}. Multiple allowed. See user guide for the plugin interface"),
+	Option("scripting",  "PluginArgument",   "pla", "string", "",      "Passed on to every ${Plugin} when it is initialized"),
 	Option("annotation", "Labels",           "l",  "input*",  "",      "A file containing annotations. Custom file format"),
 	Option("annotation", "AutoLabels",       "al", "inout",   "",      "A file containing annotations. It will be regenerated if missing or if ${AutoAnnotate} is specified"),
 	Option("annotation", "AutoAnnotate"    , "aa", "bool",    "false", "A file where automatically generated annotations are stored"),
+	Option("annotation", "LabelsCache",      "lc", "inout",   "",      "Finalized annotations from ${Labels} and ${AutoLabels} are stored here and reused while none of the files change"),
 	Option("annotation", "SymbolFma",        "sf", "output",  "",      "Generate symbols file in FMA format compatible with bsnes-plus"),
+	Option("annotation", "SymbolMesenS",     "sm", "output",  "",      "Generate symbols file in Mesen format compatible with Mesen emulator"),
 	Option("rewind",     "Rewind",           "rw", "output",  "",      "Generate rewind report in dot file format. Use graphviz to generate PDF/PNG report"),
+	Option("profile",    "FrameBudget",      "fb", "output",  "",      "CSV with instructions, estimated cycles and DMA bytes for each NMI from ${NmiFirst} to ${NmiLast}, in total and per function"),
+	Option("profile",    "CallGraph",        "cg", "output",  "",      "Call graph in callgrind format with call counts and exclusive and inclusive cost of each function for NMIs ${NmiFirst} to ${NmiLast} of all ${Trace} files. Open it in a profile viewer such as KCachegrind"),
+	Option("profile",    "DmaTimeline",      "dt", "output",  "",      "Report with every DMA transfer in NMIs ${NmiFirst} to ${NmiLast} and bandwidth per NMI, channel, target and function"),
 	Option("asm",        "Report",           "rp", "output",  "",      "Generate assembly report. Companion file to ${Asm}"),
 	Option("asm",        "Asm",              "a",  "output",  "",      "Generate assembly listing"),
 	Option("asm",        "AsmHeader",        "ah", "input",   "",      "File content will be included in assembly listing"),
@@ -38,6 +51,7 @@ options=[
 	Option("asm",        "AsmPrintRegisterSizes",     "ars",   "bool", "true",  "Print registers sizes in assembly source listing"),
 	Option("asm",        "AsmPrintDb",                "adb",   "bool", "true",  "Print data bank in assembly source listing"),
 	Option("asm",        "AsmPrintDp",                "adp",   "bool", "true",  "Print direct page in assembly source listing"),
+	Option("asm",        "AsmPrintCounts",            "acn",   "bool", "true",  "Print how many times each op was executed in assembly source listing"),
 	Option("asm",        "AsmLowerCaseOp",       "",   "bool", "true",  "Print lower-case opcode in assembly source listing"),
 	Option("asm",        "AsmCorrectWla",        "",   "bool", "false", "Make sure generated source compiled in WLA DX"),
 	Option("predict",    "Predict",          "p",  "enum",    "functions",      "This setting specify where snestistics is allowed to predict code. This is currently only used for assembly listing"),
@@ -67,13 +81,22 @@ needs={
 	"trace" : set([
 		"Asm",
 		"TraceLog",
+		"TraceLogBinary",
 		"Rewind",
+		"Plugin",
+		"FrameBudget",
+		"CallGraph",
+		"DmaTimeline",
 		# "Regenerate",
 	 	"Predict"
 	 ]),
 	"single_trace" : set([
 		"TraceLog", 
-		"Rewind"
+		"TraceLogBinary",
+		"Rewind",
+		"Plugin",
+		"FrameBudget",
+		"DmaTimeline"
 	]),
 	"rom" : set([
 		"Trace"
@@ -194,6 +217,7 @@ def write_documentation(destination_prefix, section_prefix = "##"):
 		"inout"  : "input/output file name",
 		"uint"   : "integer",
 		"bool"   : "boolean",
+		"string" : "text",
 		"enum"   : "enumeration"
 	}
 
@@ -295,6 +319,8 @@ def generate_parser_header(file):
 			"input*":  "std::vector<std::string>",
 			"output": "std::string",
 			"inout":  "std::string",
+			"string": "std::string",
+			"string*": "std::vector<std::string>",
 			"uint":   "uint32_t",
 			"bool":   "bool",
 			"enum":   "enum",
@@ -435,6 +461,8 @@ def generate_parser_source(file):
 						"input*" : "filename",
 						"output" : "filename",
 						"inout"  : "filename",
+						"string" : "text",
+						"string*": "text",
 						"uint"   : "number",
 						"bool"   : "true|false",
 					}